@@ -118,45 +118,8 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 
 	//kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n", code, sig, trapcodenames[code], epc, vaddr);
 
-  struct addrspace *as;
-  struct proc *p = curproc;
-  curproc->exitCode = _MKWAIT_SIG(sig);
-
-  KASSERT(curproc->p_addrspace != NULL);
-  as_deactivate();
-  /*
-   * clear p_addrspace before calling as_destroy. Otherwise if
-   * as_destroy sleeps (which is quite possible) when we
-   * come back we'll be calling as_activate on a
-   * half-destroyed address space. This tends to be
-   * messily fatal.
-   */
-  as = curproc_setas(NULL);
-  as_destroy(as);
-
-  V(curproc->procSem); // allow waitpid call to return
-
-  // delay process destruction until waitpid cannot be called,
-  // aka when parent process is NULL
-
-  if (curproc->parentPid != -1 && getProc(curproc->parentPid) != NULL) {
-    wchan_lock(getProc(curproc->parentPid)->procWchan);
-    wchan_sleep(getProc(curproc->parentPid)->procWchan);
-  }
-  setProcToNull(curproc->pid);
-  // wake up all children processes from their delayed destruction
-  wchan_wakeall(curproc->procWchan);
-
-  /* detach this thread from its process */
-  /* note: curproc cannot be used after this call */
-  proc_remthread(curthread);
-
-  /* if this is the last user process in the system, proc_destroy()
-     will wake up the kernel menu thread */
-  proc_destroy(p);
-
-  thread_exit();
-  /* thread_exit() does not return, so we should never get here */
+  /* the whole process goes, not just this thread */
+  proc_exit(_MKWAIT_SIG(sig));
 	panic("dead threads tell no tale\n");
 }
 
@@ -237,6 +200,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * Interrupted in user mode while the process is exiting
+		 * (the timer will get us here): leave it now. Turn
+		 * interrupts back on first, as for the other traps.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			sys___threadexit();
+		}
 		goto done2;
 	}
 
@@ -357,6 +331,15 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/*
+	 * Going back to user mode in a process that's exiting: leave
+	 * it instead. This is where threads that proc_exit couldn't
+	 * wake, or that it woke with EINTR, finish.
+	 */
+	if (!iskern && curproc->p_exiting) {
+		sys___threadexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
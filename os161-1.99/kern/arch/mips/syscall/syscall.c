@@ -34,7 +34,11 @@
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <clock.h>
 #include <syscall.h>
+#include <trace.h>
+#include <copyinout.h>
+#include <endian.h>
 
 
 /*
@@ -80,13 +84,21 @@ syscall(struct trapframe *tf)
 {
 	int callno;
 	int32_t retval;
+	off_t retval64;
+	bool is64;
+	uint64_t arg64;
+	int whence;
 	int err;
+	uint64_t start;
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
+	start = getcycles();
 	callno = tf->tf_v0;
+	TRACE(TRACE_SYSCALL, callno, 0);
+	syscallstats_enter(callno);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -98,6 +110,7 @@ syscall(struct trapframe *tf)
 	 */
 
 	retval = 0;
+	is64 = false;
 
 	switch (callno) {
 	    case SYS_reboot:
@@ -108,6 +121,11 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
 #ifdef UW
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
@@ -115,6 +133,35 @@ syscall(struct trapframe *tf)
 			  (int)tf->tf_a2,
 			  (int *)(&retval));
 	  break;
+	case SYS_read:
+	  err = sys_read((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
+	case SYS_lseek:
+	  /* the offset is in a2/a3, and whence is on the stack */
+	  join32to64(tf->tf_a2, tf->tf_a3, &arg64);
+	  err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+		       sizeof(int));
+	  if (err) {
+	    break;
+	  }
+	  err = sys_lseek((int)tf->tf_a0, (off_t)arg64, whence, &retval64);
+	  is64 = true;
+	  break;
+	case SYS_pipe:
+	  err = sys_pipe((userptr_t)tf->tf_a0);
+	  break;
 	case SYS__exit:
 	  sys__exit((int)tf->tf_a0);
 	  /* sys__exit does not return, execution should not get here */
@@ -134,6 +181,45 @@ syscall(struct trapframe *tf)
   case SYS_fork:
     err = sys_fork(tf, (pid_t *)&retval);
     break;
+
+  case SYS_vfork:
+    err = sys_vfork(tf, (pid_t *)&retval);
+    break;
+
+  case SYS___threadfork:
+    err = sys___threadfork(tf, (userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+    break;
+
+  case SYS___threadexit:
+    sys___threadexit();
+    /* sys___threadexit does not return, execution should not get here */
+    panic("unexpected return from sys___threadexit");
+    break;
+
+  case SYS___futexwait:
+    err = sys___futexwait((userptr_t)tf->tf_a0, (int)tf->tf_a1);
+    break;
+
+  case SYS___futexwake:
+    err = sys___futexwake((userptr_t)tf->tf_a0, (int)tf->tf_a1, &retval);
+    break;
+
+  case SYS_mmap:
+    err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2,
+                   (int)tf->tf_a3, (userptr_t)(tf->tf_sp + 16), &retval);
+    break;
+
+  case SYS_munmap:
+    err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+    break;
+
+  case SYS_msync:
+    err = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2);
+    break;
+
+  case SYS___syscallstats:
+    err = sys___syscallstats((int)tf->tf_a0, (userptr_t)tf->tf_a1, &retval);
+    break;
  
   case SYS_execv:
     err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
@@ -145,6 +231,8 @@ syscall(struct trapframe *tf)
 	  break;
 	}
 
+	syscallstats_exit(callno, start, getcycles());
+	TRACE(TRACE_SYSRET, callno, err);
 
 	if (err) {
 		/*
@@ -157,7 +245,13 @@ syscall(struct trapframe *tf)
 	}
 	else {
 		/* Success. */
-		tf->tf_v0 = retval;
+		if (is64) {
+			split64to32((uint64_t)retval64, &tf->tf_v0,
+				    &tf->tf_v1);
+		}
+		else {
+			tf->tf_v0 = retval;
+		}
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 	
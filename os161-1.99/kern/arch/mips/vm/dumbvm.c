@@ -34,9 +34,12 @@
 #include <spinlock.h>
 #include <proc.h>
 #include <current.h>
+#include <cpu.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <mmap.h>
+#include <trace.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,6 +62,20 @@ static paddr_t lo, hi;
 static bool coremapInitialized = false;
 static int numOfFrames;
 
+/* protects as_threadstackpbase in every address space */
+static struct spinlock threadstackLock = SPINLOCK_INITIALIZER;
+
+/*
+ * Stacks for extra user threads sit one after another below the main
+ * stack, each DUMBVM_STACKPAGES long.
+ */
+static
+vaddr_t
+thread_stack_top(int slot)
+{
+  return USERSTACK - (slot+1)*DUMBVM_STACKPAGES*PAGE_SIZE;
+}
+
 void
 vm_bootstrap(void)
 {
@@ -82,7 +99,7 @@ static
 paddr_t
 getppages(unsigned long npages)
 {
-  paddr_t addr;
+  paddr_t addr = 0;
 
   spinlock_acquire(&stealmem_lock);
 
@@ -122,7 +139,8 @@ alloc_kpages(int npages)
 void 
 free_kpages(vaddr_t addr)
 {
-  spinlock_acquire(&coremapLock);
+  // same lock as getppages, which also walks the coremap
+  spinlock_acquire(&stealmem_lock);
 
   paddr_t paddr = addr - MIPS_KSEG0;
   int targetFrame = (paddr - lo) / PAGE_SIZE;
@@ -130,20 +148,74 @@ free_kpages(vaddr_t addr)
   for (int i = 0; i < npagesToDelete; i++)
     coremap[targetFrame+i] = 0;
 
-  spinlock_release(&coremapLock);
+  spinlock_release(&stealmem_lock);
 }
 
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(ts->ts_vaddr & PAGE_FRAME, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
+
+/*
+ * Load a translation into the TLB. An existing entry for the page is
+ * replaced (a read-only page may be becoming writable); otherwise an
+ * empty slot is used if there is one, and a random one if not.
+ */
+static
+void
+dumbvm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writable)
+{
+  uint32_t ehi, elo;
+  int i, spl;
+
+  /* Disable interrupts on this CPU while frobbing the TLB. */
+  spl = splhigh();
+
+  i = tlb_probe(vaddr, 0);
+  if (i < 0) {
+    for (i = 0; i < NUM_TLB; i++) {
+      tlb_read(&ehi, &elo, i);
+      if (!(elo & TLBLO_VALID)) {
+        break;
+      }
+    }
+  }
+
+  ehi = vaddr;
+  elo = paddr | TLBLO_VALID;
+  if (writable) {
+    elo |= TLBLO_DIRTY;
+  }
+  DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", vaddr, paddr);
+  if (i < NUM_TLB) {
+    tlb_write(ehi, elo, i);
+  }
+  else {
+    // out of TLB entries, so we randomly replace one
+    tlb_random(ehi, elo);
+  }
+
+  splx(spl);
 }
 
 int
@@ -151,18 +223,16 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
+	int i, result;
 	struct addrspace *as;
-	int spl;
 
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+	TRACE(TRACE_VMFAULT, faultaddress, faulttype);
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-        return EFAULT;
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -188,13 +258,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
-	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_vbase1 != 0);
-	KASSERT(as->as_pbase1 != 0);
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	KASSERT(as->as_pbase2 != 0);
-	KASSERT(as->as_npages2 != 0);
+	/*
+	 * Assert that the address space has been set up properly.
+	 * Either region may be missing if its segment is shared text.
+	 */
+	KASSERT(as->as_npages1 == 0 || as->as_pbase1 != 0);
+	KASSERT(as->as_npages2 == 0 || as->as_pbase2 != 0);
 	KASSERT(as->as_stackpbase != 0);
 	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
 	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
@@ -212,44 +281,57 @@ vm_fault(int faulttype, vaddr_t faultaddress)
   bool isReadOnlySegment = false;
 	if (faultaddress >= vbase1 && faultaddress < vtop1) {
 		paddr = (faultaddress - vbase1) + as->as_pbase1;
-    isReadOnlySegment = true;
+    isReadOnlySegment = !as->as_writeable1;
 	}
 	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
 		paddr = (faultaddress - vbase2) + as->as_pbase2;
+    isReadOnlySegment = !as->as_writeable2;
 	}
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
 	}
 	else {
-		return EFAULT;
+    // maybe it's on the stack of one of the extra user threads
+    for (i = 0; i < DUMBVM_MAXTHREADS; i++) {
+      stacktop = thread_stack_top(i);
+      stackbase = stacktop - DUMBVM_STACKPAGES * PAGE_SIZE;
+      if (faultaddress >= stackbase && faultaddress < stacktop) {
+        break;
+      }
+    }
+    if (i < DUMBVM_MAXTHREADS) {
+      /*
+       * Load the entry with threadstackLock held: as_release_thread_stack
+       * clears the slot under it before shooting down and freeing the
+       * stack, so we either see it gone or get shot down with the rest.
+       */
+      spinlock_acquire(&threadstackLock);
+      if (as->as_threadstackpbase[i] != 0) {
+        paddr = (faultaddress - stackbase) + as->as_threadstackpbase[i];
+        result = 0;
+        if (faulttype == VM_FAULT_READONLY) {
+          result = EFAULT;
+        }
+        else {
+          dumbvm_tlb_load(faultaddress, paddr, true);
+        }
+        spinlock_release(&threadstackLock);
+        return result;
+      }
+      spinlock_release(&threadstackLock);
+    }
+    // file mappings and shared text handle their own protection
+    return mmap_fault(as, faultaddress, faulttype, dumbvm_tlb_load);
 	}
 
+  if (faulttype == VM_FAULT_READONLY) {
+    return EFAULT;
+  }
+
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-    elo = (isReadOnlySegment && as->loadedElf) ? elo & ~TLBLO_DIRTY : elo;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
-	}
-
-  // reaching here means we ran out of TLB entries, so we randomly replace one
-  ehi = faultaddress;
-  elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-  elo = (isReadOnlySegment && as->loadedElf) ? elo & ~TLBLO_DIRTY : elo;
-  tlb_random(ehi, elo);
-	splx(spl);
+  dumbvm_tlb_load(faultaddress, paddr, !(isReadOnlySegment && as->loadedElf));
 	return 0;
 }
 
@@ -264,11 +346,15 @@ as_create(void)
 	as->as_vbase1 = 0;
   as->as_pbase1 = 0;
 	as->as_npages1 = 0;
+  as->as_writeable1 = false;
 	as->as_vbase2 = 0;
   as->as_pbase2 = 0;
 	as->as_npages2 = 0;
+  as->as_writeable2 = false;
   as->as_stackpbase = 0;
+  for (int i = 0; i < DUMBVM_MAXTHREADS; i++) as->as_threadstackpbase[i] = 0;
   as->loadedElf = false;
+  as->as_mmaps = NULL;
 
 	return as;
 }
@@ -276,6 +362,21 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
+  mmap_destroy(as);
+  if (as->as_pbase1 != 0) {
+    free_kpages(PADDR_TO_KVADDR(as->as_pbase1));
+  }
+  if (as->as_pbase2 != 0) {
+    free_kpages(PADDR_TO_KVADDR(as->as_pbase2));
+  }
+  if (as->as_stackpbase != 0) {
+    free_kpages(PADDR_TO_KVADDR(as->as_stackpbase));
+  }
+  for (int i = 0; i < DUMBVM_MAXTHREADS; i++) {
+    if (as->as_threadstackpbase[i] != 0) {
+      free_kpages(PADDR_TO_KVADDR(as->as_threadstackpbase[i]));
+    }
+  }
 	kfree(as);
 }
 
@@ -324,20 +425,21 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
-	/* We don't use these - all pages are read-write */
+	/* Read-only regions become read-only once loaded */
 	(void)readable;
-	(void)writeable;
 	(void)executable;
 
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
+    as->as_writeable1 = writeable != 0;
 		return 0;
 	}
 
 	if (as->as_vbase2 == 0) {
 		as->as_vbase2 = vaddr;
 		as->as_npages2 = npages;
+    as->as_writeable2 = writeable != 0;
 		return 0;
 	}
 
@@ -348,6 +450,33 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	return EUNIMP;
 }
 
+/*
+ * Check whether [VADDR, VADDR+LEN) runs into either region or the
+ * stacks. The whole window the thread stacks can occupy counts, used
+ * or not, so a stack defined later can't land on top of something.
+ */
+bool
+as_overlaps(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+  vaddr_t end, stackbase;
+
+  end = vaddr + len;
+  if (end < vaddr) {
+    return true;
+  }
+  if (as->as_npages1 > 0 && vaddr < as->as_vbase1 + as->as_npages1*PAGE_SIZE
+      && end > as->as_vbase1) {
+    return true;
+  }
+  if (as->as_npages2 > 0 && vaddr < as->as_vbase2 + as->as_npages2*PAGE_SIZE
+      && end > as->as_vbase2) {
+    return true;
+  }
+  stackbase = thread_stack_top(DUMBVM_MAXTHREADS-1)
+    - DUMBVM_STACKPAGES * PAGE_SIZE;
+  return end > stackbase && vaddr < USERSTACK;
+}
+
 static
 void
 as_zero_region(paddr_t paddr, unsigned npages)
@@ -355,6 +484,18 @@ as_zero_region(paddr_t paddr, unsigned npages)
 	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
 }
 
+int
+as_define_text(struct addrspace *as, struct vnode *v, off_t offset,
+               vaddr_t vaddr, size_t sz)
+{
+  size_t skew;
+
+  /* Align the region; the file offset moves down with the address. */
+  skew = vaddr & ~(vaddr_t)PAGE_FRAME;
+  KASSERT(offset % PAGE_SIZE == skew);
+  return mmap_text(as, v, offset - skew, vaddr - skew, sz + skew);
+}
+
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -362,23 +503,27 @@ as_prepare_load(struct addrspace *as)
 	KASSERT(as->as_pbase2 == 0);
 	KASSERT(as->as_stackpbase == 0);
 
-	as->as_pbase1 = getppages(as->as_npages1);
-	if (as->as_pbase1 == 0) {
-		return ENOMEM;
-	}
+  /* A region is missing if its segment went to as_define_text. */
+  if (as->as_npages1 > 0) {
+    as->as_pbase1 = getppages(as->as_npages1);
+    if (as->as_pbase1 == 0) {
+      return ENOMEM;
+    }
+    as_zero_region(as->as_pbase1, as->as_npages1);
+  }
 
-	as->as_pbase2 = getppages(as->as_npages2);
-	if (as->as_pbase2 == 0) {
-		return ENOMEM;
-	}
+  if (as->as_npages2 > 0) {
+    as->as_pbase2 = getppages(as->as_npages2);
+    if (as->as_pbase2 == 0) {
+      return ENOMEM;
+    }
+    as_zero_region(as->as_pbase2, as->as_npages2);
+  }
 
 	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
 	if (as->as_stackpbase == 0) {
 		return ENOMEM;
 	}
-	
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
 	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
 
 	return 0;
@@ -412,6 +557,71 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_thread_stack(struct addrspace *as, int *slot, vaddr_t *stackptr)
+{
+  paddr_t pbase;
+  int i;
+
+  pbase = getppages(DUMBVM_STACKPAGES);
+  if (pbase == 0) {
+    return ENOMEM;
+  }
+  as_zero_region(pbase, DUMBVM_STACKPAGES);
+
+  spinlock_acquire(&threadstackLock);
+  for (i = 0; i < DUMBVM_MAXTHREADS; i++) {
+    if (as->as_threadstackpbase[i] == 0) {
+      as->as_threadstackpbase[i] = pbase;
+      break;
+    }
+  }
+  spinlock_release(&threadstackLock);
+
+  if (i == DUMBVM_MAXTHREADS) {
+    free_kpages(PADDR_TO_KVADDR(pbase));
+    return ENPROC;
+  }
+
+  *slot = i;
+  *stackptr = thread_stack_top(i);
+  return 0;
+}
+
+void
+as_release_thread_stack(struct addrspace *as, int slot)
+{
+  struct tlbshootdown ts;
+  vaddr_t stackbase;
+  paddr_t pbase;
+  int i;
+
+  KASSERT(slot >= 0 && slot < DUMBVM_MAXTHREADS);
+
+  spinlock_acquire(&threadstackLock);
+  pbase = as->as_threadstackpbase[slot];
+  as->as_threadstackpbase[slot] = 0;
+  spinlock_release(&threadstackLock);
+  KASSERT(pbase != 0);
+
+  /*
+   * Other threads of this process may be running on other CPUs and
+   * have touched this stack, so get rid of their mappings too before
+   * the frames can be handed out again. The broadcast waits for every
+   * CPU to be done, and vm_fault can't load a new entry now that the
+   * slot is clear.
+   */
+  stackbase = thread_stack_top(slot) - DUMBVM_STACKPAGES * PAGE_SIZE;
+  ts.ts_addrspace = as;
+  for (i = 0; i < DUMBVM_STACKPAGES; i++) {
+    ts.ts_vaddr = stackbase + i * PAGE_SIZE;
+    vm_tlbshootdown(&ts);
+    ipi_tlbshootdown_broadcast(&ts);
+  }
+
+  free_kpages(PADDR_TO_KVADDR(pbase));
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -424,8 +634,10 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
 	new->as_vbase1 = old->as_vbase1;
 	new->as_npages1 = old->as_npages1;
+  new->as_writeable1 = old->as_writeable1;
 	new->as_vbase2 = old->as_vbase2;
 	new->as_npages2 = old->as_npages2;
+  new->as_writeable2 = old->as_writeable2;
   new->loadedElf = old->loadedElf;
 
 	/* (Mis)use as_prepare_load to allocate some physical memory. */
@@ -434,8 +646,8 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
-	KASSERT(new->as_pbase1 != 0);
-	KASSERT(new->as_pbase2 != 0);
+	KASSERT(new->as_npages1 == 0 || new->as_pbase1 != 0);
+	KASSERT(new->as_npages2 == 0 || new->as_pbase2 != 0);
 	KASSERT(new->as_stackpbase != 0);
 
 	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
@@ -449,6 +661,24 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
+
+  // the forking thread may be running on one of the extra stacks
+  for (int i = 0; i < DUMBVM_MAXTHREADS; i++) {
+    if (old->as_threadstackpbase[i] == 0) continue;
+    new->as_threadstackpbase[i] = getppages(DUMBVM_STACKPAGES);
+    if (new->as_threadstackpbase[i] == 0) {
+      as_destroy(new);
+      return ENOMEM;
+    }
+    memmove((void *)PADDR_TO_KVADDR(new->as_threadstackpbase[i]),
+      (const void *)PADDR_TO_KVADDR(old->as_threadstackpbase[i]),
+      DUMBVM_STACKPAGES*PAGE_SIZE);
+  }
+
+  if (mmap_copy(old, new)) {
+    as_destroy(new);
+    return ENOMEM;
+  }
 	
 	*ret = new;
 	return 0;
@@ -34,12 +34,14 @@
 #include <cpu.h>
 #include <spl.h>
 #include <clock.h>
+#include <prof.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
 #include <mainbus.h>
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
+#include <platform/maxcpus.h>
 #include "autoconf.h"
 
 /*
@@ -73,6 +75,53 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Read the cycle counter and the cause register.
+ */
+static
+uint32_t
+mips_count_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+static
+uint32_t
+mips_cause_get(void)
+{
+	uint32_t cause;
+
+	/* $13 == c0_cause */
+	__asm volatile("mfc0 %0, $13" : "=r" (cause));
+	return cause;
+}
+
+/*
+ * Each cpu's on-chip timer. The counter goes back to zero every time
+ * it reaches the compare value, which is normally one hardclock
+ * period but is pushed out as far as it goes while the cpu is idle.
+ * So that the cycle count stays right, keep the total of the values
+ * it has reset at.
+ */
+struct cputimer {
+	uint64_t ct_base;	/* cycles at the last counter reset */
+	uint32_t ct_compare;	/* count at which it next resets */
+};
+
+static struct cputimer cputimers[MAXCPUS];
+
+#define TIMER_PERIOD (CPU_FREQUENCY / HZ)
+#define TIMER_MAX 0xffffffff
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -83,6 +132,8 @@ static struct lamebus_softc *lamebus;
 void
 mainbus_bootstrap(void)
 {
+	unsigned i;
+
 	/* Interrupts should be off (and have been off since startup) */
 	KASSERT(curthread->t_curspl > 0);
 
@@ -112,8 +163,13 @@ mainbus_bootstrap(void)
 
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
+	 * (Secondary cpus set theirs on their first timer interrupt.)
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	for (i = 0; i < MAXCPUS; i++) {
+		cputimers[i].ct_base = 0;
+		cputimers[i].ct_compare = TIMER_PERIOD;
+	}
+	mips_timer_set(TIMER_PERIOD);
 }
 
 /*
@@ -251,6 +307,90 @@ mainbus_send_ipi(struct cpu *target)
 #define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
 #define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
 
+/*
+ * Cycle counter.
+ *
+ * Add the counter to the cycles counted up to its last reset (see
+ * struct cputimer). If the counter has wrapped but the timer
+ * interrupt hasn't been taken yet, ct_base is one reset behind; the
+ * pending bit in the cause register says so. Reading the counter on
+ * both sides of the cause register catches a wrap in between.
+ */
+uint64_t
+getcycles(void)
+{
+	struct cputimer *ct;
+	uint32_t before, after, cause;
+	uint64_t base;
+	int spl;
+
+	spl = splhigh();
+	ct = &cputimers[curcpu->c_number];
+	base = ct->ct_base;
+	before = mips_count_get();
+	cause = mips_cause_get();
+	after = mips_count_get();
+	if (after < before || (cause & MIPS_TIMER_BIT)) {
+		base += ct->ct_compare;
+	}
+	splx(spl);
+
+	return base + after;
+}
+
+/*
+ * Stop hardclocks on this cpu while it idles: push the timer out as
+ * far as it goes (about three minutes at 25 MHz). A tick that is
+ * already pending is dropped, but its counter reset still counts.
+ */
+void
+hardclock_stop(void)
+{
+	struct cputimer *ct;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	ct = &cputimers[curcpu->c_number];
+	if (mips_cause_get() & MIPS_TIMER_BIT) {
+		ct->ct_base += ct->ct_compare;
+	}
+	ct->ct_compare = TIMER_MAX;
+	mips_timer_set(ct->ct_compare);
+}
+
+/*
+ * Start hardclocks again: the next one is a period from now, and the
+ * interrupt handler goes back to the usual period after that.
+ */
+void
+hardclock_start(void)
+{
+	struct cputimer *ct;
+	uint32_t count;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	ct = &cputimers[curcpu->c_number];
+	if (mips_cause_get() & MIPS_TIMER_BIT) {
+		/* idle long enough for the counter to reach TIMER_MAX */
+		ct->ct_base += ct->ct_compare;
+	}
+	count = mips_count_get();
+	if (count < TIMER_MAX - TIMER_PERIOD) {
+		ct->ct_compare = count + TIMER_PERIOD;
+	}
+	else {
+		ct->ct_compare = TIMER_MAX;
+	}
+	mips_timer_set(ct->ct_compare);
+}
+
+uint32_t
+getcyclerate(void)
+{
+	return CPU_FREQUENCY;
+}
+
 void
 mainbus_interrupt(struct trapframe *tf)
 {
@@ -268,8 +408,14 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 	}
 	else if (cause & MIPS_TIMER_BIT) {
+		struct cputimer *ct = &cputimers[curcpu->c_number];
+
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		ct->ct_base += ct->ct_compare;
+		ct->ct_compare = TIMER_PERIOD;
+		mips_timer_set(ct->ct_compare);
+		/* give the profiler the interrupted PC */
+		prof_sample(tf->tf_epc);
 		/* and call hardclock */
 		hardclock();
 	}
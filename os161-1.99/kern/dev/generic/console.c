@@ -46,6 +46,11 @@
  * and (2) if the system crashes before we find a console, no output
  * at all may appear.
  *
+ * Output goes through a ring buffer: writers copy characters in and
+ * return, and each write-done interrupt starts the next character.
+ * Writers only block when the ring is full. Polled output drains the
+ * ring first so that nothing comes out of order.
+ *
  * Note that we have no input buffering; characters typed too rapidly
  * will be lost.
  */
@@ -54,6 +59,8 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
@@ -102,23 +109,49 @@ static
 void
 flush_delay_buf(void)
 {
-	size_t i;
-	for (i=0; i<delayed_outbuf_pos; i++) {
-		putch(delayed_outbuf[i]);
-	}
+	putchars(delayed_outbuf, delayed_outbuf_pos);
 	delayed_outbuf_pos = 0;
 }
 
 //////////////////////////////////////////////////
 
+/*
+ * Take the oldest character out of the output ring. Must hold the
+ * output lock and the ring must not be empty.
+ */
+static
+int
+con_outbuf_take(struct con_softc *cs)
+{
+	unsigned tail;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+	KASSERT(cs->cs_outbuf_count > 0);
+
+	tail = (cs->cs_outbuf_head + CONSOLE_OUTPUT_BUFFER_SIZE
+		- cs->cs_outbuf_count) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	cs->cs_outbuf_count--;
+	return cs->cs_outbuf[tail];
+}
+
 /*
  * Print a character, using polling instead of interrupts to wait for
- * I/O completion.
+ * I/O completion. Anything still queued for interrupt output goes
+ * first, unless we got here from inside the console code itself.
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	if (!spinlock_do_i_hold(&cs->cs_outlock)) {
+		spinlock_acquire(&cs->cs_outlock);
+		while (cs->cs_outbuf_count > 0) {
+			cs->cs_sendpolled(cs->cs_devdata,
+					  con_outbuf_take(cs));
+		}
+		wchan_wakeall(cs->cs_outwchan);
+		spinlock_release(&cs->cs_outlock);
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
@@ -143,18 +176,52 @@ putch_complete_polled(struct con_softc *cs)
 //////////////////////////////////////////////////
 
 /*
- * Print a character, using interrupts to wait for I/O completion.
+ * If the device is idle and there's something queued, send the next
+ * character. Must hold the output lock.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+
+	if (!cs->cs_txbusy && cs->cs_outbuf_count > 0) {
+		cs->cs_txbusy = true;
+		cs->cs_send(cs->cs_devdata, con_outbuf_take(cs));
+	}
+}
+
+/*
+ * Queue characters for output, using interrupts to drain the queue.
+ * Waits only while the ring is full.
  */
 static
 void
-putch_intr(struct con_softc *cs, int ch)
+putchars_intr(struct con_softc *cs, const char *buf, size_t len)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	size_t i;
+
+	spinlock_acquire(&cs->cs_outlock);
+	for (i=0; i<len; i++) {
+		while (cs->cs_outbuf_count == CONSOLE_OUTPUT_BUFFER_SIZE) {
+			con_kick(cs);
+			wchan_lock(cs->cs_outwchan);
+			spinlock_release(&cs->cs_outlock);
+			wchan_sleep(cs->cs_outwchan);
+			spinlock_acquire(&cs->cs_outlock);
+		}
+		cs->cs_outbuf[cs->cs_outbuf_head] = buf[i];
+		cs->cs_outbuf_head =
+			(cs->cs_outbuf_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+		cs->cs_outbuf_count++;
+	}
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
 }
 
 /*
  * Read a character, using interrupts to wait for I/O completion.
+ * Returns -1 if the caller's process is exiting.
  */
 static
 int
@@ -162,7 +229,9 @@ getch_intr(struct con_softc *cs)
 {
 	unsigned char ret;
 
-	P(cs->cs_rsem);
+	if (P_intr(cs->cs_rsem)) {
+		return -1;
+	}
 	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
@@ -198,13 +267,21 @@ con_input(void *vcs, int ch)
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Starts the next character, and lets blocked writers go once half
+ * the ring is free so they don't wake up for every character.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_txbusy = false;
+	con_kick(cs);
+	if (cs->cs_outbuf_count <= CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		wchan_wakeall(cs->cs_outwchan);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -219,17 +296,30 @@ con_start(void *vcs)
 
 void
 putch(int ch)
+{
+	char c = ch;
+
+	putchars(&c, 1);
+}
+
+void
+putchars(const char *buf, size_t len)
 {
 	struct con_softc *cs = the_console;
+	size_t i;
 
 	if (cs==NULL) {
-		putch_delayed(ch);
+		for (i=0; i<len; i++) {
+			putch_delayed(buf[i]);
+		}
 	}
 	else if (curthread->t_in_interrupt || curthread->t_iplhigh_count > 0) {
-		putch_polled(cs, ch);
+		for (i=0; i<len; i++) {
+			putch_polled(cs, buf[i]);
+		}
 	}
 	else {
-		putch_intr(cs, ch);
+		putchars_intr(cs, buf, len);
 	}
 }
 
@@ -298,12 +388,20 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/*
+ * Writes are copied in this many characters at a time (before the
+ * newline expansion, which can double the size).
+ */
+#define CON_WRITECHUNK 64
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
-	int result;
+	int result, c;
 	char ch;
+	char chunk[CON_WRITECHUNK], outbuf[2*CON_WRITECHUNK];
+	size_t len, outlen, i;
 	struct lock *lk;
 
 	(void)dev;  // unused
@@ -320,7 +418,12 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			c = getch();
+			if (c < 0) {
+				lock_release(lk);
+				return EINTR;
+			}
+			ch = c;
 			if (ch=='\r') {
 				ch = '\n';
 			}
@@ -334,15 +437,23 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			len = uio->uio_resid;
+			if (len > CON_WRITECHUNK) {
+				len = CON_WRITECHUNK;
+			}
+			result = uiomove(chunk, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
+			outlen = 0;
+			for (i=0; i<len; i++) {
+				if (chunk[i]=='\n') {
+					outbuf[outlen++] = '\r';
+				}
+				outbuf[outlen++] = chunk[i];
 			}
-			putch(ch);
+			putchars(outbuf, outlen);
 		}
 	}
 	lock_release(lk);
@@ -375,6 +486,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_open = con_open;
 	dev->d_close = con_close;
 	dev->d_io = con_io;
+	dev->d_submit = NULL;
 	dev->d_ioctl = con_ioctl;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
@@ -398,7 +510,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *wwc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -418,29 +531,33 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	wwc = wchan_create("console write");
+	if (wwc == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wwc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wwc);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = wwc;
+	cs->cs_txbusy = false;
+	cs->cs_outbuf_head = 0;
+	cs->cs_outbuf_count = 0;
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -128,6 +128,7 @@ config_random(struct random_softc *rs, int unit)
 	rs->rs_dev.d_open = randopen;
 	rs->rs_dev.d_close = randclose;
 	rs->rs_dev.d_io = randio;
+	rs->rs_dev.d_submit = NULL;
 	rs->rs_dev.d_ioctl = randioctl;
 	rs->rs_dev.d_blocks = 0;
 	rs->rs_dev.d_blocksize = 1;
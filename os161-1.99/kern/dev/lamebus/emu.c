@@ -260,35 +260,39 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 }
 
 /*
- * Common code for read and readdir.
+ * Common code for read and readdir. Copies what the host hands back
+ * out of the I/O window into BUF (a kernel buffer) and moves *OFFSET
+ * to where the host says it ended up.
+ *
+ * This and emu_write expect the caller to hold e_lock, so a caller
+ * can do several operations back to back. The caller must not touch
+ * user memory while holding it: faulting in a page of a program
+ * mapped from emufs reads through here too.
  */
 static
 int
 emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	   uint32_t op, struct uio *uio)
+	   uint32_t op, off_t *offset, void *buf, uint32_t *got)
 {
 	int result;
 
-	KASSERT(uio->uio_rw == UIO_READ);
-
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	emu_wreg(sc, REG_OFFSET, *offset);
 	emu_wreg(sc, REG_OPER, op);
 	result = emu_waitdone(sc);
 	if (result) {
-		goto out;
+		return result;
 	}
-	
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
 
-	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	*got = emu_rreg(sc, REG_IOLEN);
+	KASSERT(*got <= len);
+	memcpy(buf, sc->e_iobuf, *got);
 
- out:
-	lock_release(sc->e_lock);
-	return result;
+	*offset = emu_rreg(sc, REG_OFFSET);
+	return 0;
 }
 
 /*
@@ -297,9 +301,9 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 static
 int
 emu_read(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	 struct uio *uio)
+	 off_t *offset, void *buf, uint32_t *got)
 {
-	return emu_doread(sc, handle, len, EMU_OP_READ, uio);
+	return emu_doread(sc, handle, len, EMU_OP_READ, offset, buf, got);
 }
 
 /*
@@ -308,44 +312,34 @@ emu_read(struct emu_softc *sc, uint32_t handle, uint32_t len,
 static
 int
 emu_readdir(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	    struct uio *uio)
+	    off_t *offset, void *buf, uint32_t *got)
 {
-	return emu_doread(sc, handle, len, EMU_OP_READDIR, uio);
+	return emu_doread(sc, handle, len, EMU_OP_READDIR, offset, buf, got);
 }
 
 /*
- * Write to a hardware-level file handle.
+ * Write LEN bytes from BUF (a kernel buffer) to a hardware-level file
+ * handle at OFFSET. Caller holds e_lock, as for emu_doread.
  */
 static
 int
 emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	  struct uio *uio)
+	  off_t offset, const void *buf)
 {
-	int result;
-
-	KASSERT(uio->uio_rw == UIO_WRITE);
-
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
-
-	result = uiomove(sc->e_iobuf, len, uio);
-	if (result) {
-		goto out;
-	}
+	emu_wreg(sc, REG_OFFSET, offset);
+	memcpy(sc->e_iobuf, buf, len);
 
 	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
-	result = emu_waitdone(sc);
-
- out:
-	lock_release(sc->e_lock);
-	return result;
+	return emu_waitdone(sc);
 }
 
 /*
  * Get the file size associated with a hardware-level file handle.
+ * Caller holds e_lock.
  */
 static
 int
@@ -353,7 +347,7 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 {
 	int result;
 
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
@@ -361,29 +355,22 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 	if (result==0) {
 		*retval = emu_rreg(sc, REG_IOLEN);
 	}
-
-	lock_release(sc->e_lock);
 	return result;
 }
 
 /*
- * Truncate a hardware-level file handle.
+ * Truncate a hardware-level file handle. Caller holds e_lock.
  */
 static
 int
 emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 {
-	int result;
-
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
 	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
-	result = emu_waitdone(sc);
-
-	lock_release(sc->e_lock);
-	return result;
+	return emu_waitdone(sc);
 }
 
 //
@@ -479,11 +466,19 @@ emufs_reclaim(struct vnode *v)
 	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
 
-	if (ev->ev_v.vn_refcount != 1) {
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount != 1) {
+
+		/* consume the reference VOP_DECREF gave us */
+		KASSERT(v->vn_refcount>1);
+		v->vn_refcount--;
+
+		spinlock_release(&v->vn_countlock);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	spinlock_release(&v->vn_countlock);
 
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
@@ -519,40 +514,108 @@ emufs_reclaim(struct vnode *v)
 	return 0;
 }
 
+/*
+ * File sizes are cached in the vnode so stat doesn't have to ask the
+ * host every time. The host may hand out several handles, and so us
+ * several vnodes, for one file, and there's no telling which; so any
+ * write or truncate through any vnode invalidates every cached size
+ * by bumping ef_sizegen, and a cached size only counts if it was
+ * taken at the current generation. (Changes made on the host side
+ * aren't seen.) All of this is protected by e_lock.
+ *
+ * Called after changing the file behind EV so that it is NEWSIZE
+ * long; keeps EV's own cached size if it was good.
+ */
+static
+void
+emufs_sizechanged(struct emufs_vnode *ev, off_t newsize)
+{
+	struct emufs_fs *ef = ev->ev_v.vn_fs->fs_data;
+	bool valid;
+
+	KASSERT(lock_do_i_hold(ev->ev_emu->e_lock));
+
+	valid = ev->ev_sizegen == ef->ef_sizegen;
+	ef->ef_sizegen++;
+	if (ef->ef_sizegen == 0) {
+		/* 0 is never current; see emufs_loadvnode */
+		ef->ef_sizegen = 1;
+	}
+	if (valid) {
+		ev->ev_size = newsize;
+		ev->ev_sizegen = ef->ef_sizegen;
+	}
+}
+
 /*
  * VOP_READ
+ *
+ * Reads are done in batches of up to EMU_MAXBATCH bytes: the batch's
+ * window-sized reads go back to back under one hold of e_lock into a
+ * bounce buffer, and only after the lock is dropped is the data moved
+ * to the caller, since that may fault (see emu_doread).
  */
 static
 int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	uint32_t amt;
-	size_t oldresid;
-	int result;
+	struct emu_softc *sc = ev->ev_emu;
+	char *buf;
+	size_t bufsize, filled;
+	uint32_t amt, got;
+	off_t pos;
+	int result = 0, moveresult;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	bufsize = uio->uio_resid < EMU_MAXBATCH ? uio->uio_resid : EMU_MAXBATCH;
+	if (bufsize == 0) {
+		return 0;
+	}
+	buf = kmalloc(bufsize);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	pos = uio->uio_offset;
 	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
+		filled = 0;
+		got = 0;
+		lock_acquire(sc->e_lock);
+		while (filled < bufsize && filled < uio->uio_resid) {
+			amt = bufsize - filled;
+			if (amt > uio->uio_resid - filled) {
+				amt = uio->uio_resid - filled;
+			}
+			if (amt > EMU_MAXIO) {
+				amt = EMU_MAXIO;
+			}
+			result = emu_read(sc, ev->ev_handle, amt, &pos,
+					  buf + filled, &got);
+			if (result || got == 0) {
+				break;
+			}
+			filled += got;
 		}
+		lock_release(sc->e_lock);
 
-		oldresid = uio->uio_resid;
-
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
-		if (result) {
-			return result;
+		if (filled > 0) {
+			uio->uio_offset = pos - filled;
+			moveresult = uiomove(buf, filled, uio);
+			if (moveresult) {
+				result = moveresult;
+				break;
+			}
 		}
-		
-		if (uio->uio_resid == oldresid) {
-			/* nothing read - EOF */
+		if (result || got == 0) {
+			/* error, or nothing read - EOF */
 			break;
 		}
 	}
 
-	return 0;
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -563,7 +626,11 @@ int
 emufs_getdirentry(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	uint32_t amt;
+	struct emu_softc *sc = ev->ev_emu;
+	char *buf;
+	uint32_t amt, got;
+	off_t pos;
+	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
@@ -571,44 +638,89 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 	if (amt > EMU_MAXIO) {
 		amt = EMU_MAXIO;
 	}
+	buf = kmalloc(amt);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	pos = uio->uio_offset;
+	lock_acquire(sc->e_lock);
+	result = emu_readdir(sc, ev->ev_handle, amt, &pos, buf, &got);
+	lock_release(sc->e_lock);
 
-	return emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
+	if (result == 0) {
+		result = uiomove(buf, got, uio);
+		/* the offset is a cookie from the host, not a byte count */
+		uio->uio_offset = pos;
+	}
+	kfree(buf);
+	return result;
 }
 
 /*
  * VOP_WRITE
+ *
+ * Batched like VOP_READ: each batch is copied in from the caller
+ * first, then written out under one hold of e_lock.
  */
 static
 int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emu_softc *sc = ev->ev_emu;
+	char *buf;
+	size_t bufsize, len, done;
 	uint32_t amt;
-	size_t oldresid;
-	int result;
+	off_t pos;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	bufsize = uio->uio_resid < EMU_MAXBATCH ? uio->uio_resid : EMU_MAXBATCH;
+	if (bufsize == 0) {
+		return 0;
+	}
+	buf = kmalloc(bufsize);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
 	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
+		pos = uio->uio_offset;
+		len = uio->uio_resid < bufsize ? uio->uio_resid : bufsize;
+		result = uiomove(buf, len, uio);
+		if (result) {
+			break;
 		}
 
-		oldresid = uio->uio_resid;
-
-		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
+		lock_acquire(sc->e_lock);
+		for (done = 0; done < len; done += amt) {
+			amt = len - done;
+			if (amt > EMU_MAXIO) {
+				amt = EMU_MAXIO;
+			}
+			result = emu_write(sc, ev->ev_handle, amt, pos + done,
+					   buf + done);
+			if (result) {
+				break;
+			}
+		}
 		if (result) {
-			return result;
+			/* who knows how much of it got written */
+			ev->ev_sizegen = 0;
 		}
+		emufs_sizechanged(ev, ev->ev_size > pos + done ?
+				  ev->ev_size : pos + (off_t)done);
+		lock_release(sc->e_lock);
 
-		if (uio->uio_resid == oldresid) {
-			/* nothing written...? */
+		if (result) {
 			break;
 		}
 	}
 
-	return 0;
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -631,20 +743,30 @@ emufs_ioctl(struct vnode *v, int op, userptr_t data)
 
 /*
  * VOP_STAT
+ *
+ * Only asks the host for the size if the cached one isn't current.
  */
 static
 int
 emufs_stat(struct vnode *v, struct stat *statbuf)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 	int result;
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
-	if (result) {
-		return result;
+	lock_acquire(ev->ev_emu->e_lock);
+	if (ev->ev_sizegen != ef->ef_sizegen) {
+		result = emu_getsize(ev->ev_emu, ev->ev_handle, &ev->ev_size);
+		if (result) {
+			lock_release(ev->ev_emu->e_lock);
+			return result;
+		}
+		ev->ev_sizegen = ef->ef_sizegen;
 	}
+	statbuf->st_size = ev->ev_size;
+	lock_release(ev->ev_emu->e_lock);
 
 	result = VOP_GETTYPE(v, &statbuf->st_mode);
 	if (result) {
@@ -717,7 +839,15 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	lock_acquire(ev->ev_emu->e_lock);
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	if (result == 0) {
+		emufs_sizechanged(ev, len);
+	}
+	lock_release(ev->ev_emu->e_lock);
+	return result;
 }
 
 /*
@@ -842,8 +972,9 @@ static
 int
 emufs_mmap(struct vnode *v)
 {
+	/* Mappable; pages are moved with VOP_READ and VOP_WRITE. */
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 //////////////////////////////
@@ -1182,6 +1313,8 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_size = 0;
+	ev->ev_sizegen = 0;
 
 	result = VOP_INIT(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			   &ef->ef_fs, ev);
@@ -1299,6 +1432,7 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 
 	ef->ef_emu = sc;
 	ef->ef_root = NULL;
+	ef->ef_sizegen = 1;
 	ef->ef_vnodes = vnodearray_create();
 	if (ef->ef_vnodes == NULL) {
 		kfree(ef);
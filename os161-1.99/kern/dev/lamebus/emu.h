@@ -32,6 +32,7 @@
 
 
 #define EMU_MAXIO       16384
+#define EMU_MAXBATCH    (4*EMU_MAXIO)	/* most moved per hold of e_lock */
 #define EMU_ROOTHANDLE  0
 
 /*
@@ -35,9 +35,9 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
-#include <synch.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <trace.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -95,15 +95,79 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the next sector of the request at the head of the queue. For
+ * a write, its data goes to the on-card buffer first. The lock must
+ * be held and the device idle.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct uio *uio = lh->lh_head->dr_uio;
+	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
+	uint32_t statval = LHD_WORKING;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (uio->uio_rw == UIO_WRITE) {
+		/* can't fail; the request is in kernel space */
+		result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		KASSERT(result == 0);
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, sector);
+
+	/* and start the operation. */
+	TRACE(uio->uio_rw == UIO_READ ? TRACE_DISKREAD : TRACE_DISKWRITE,
+	      sector, lh->lh_unit);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Record that a sector has completed. If it was read, copy it out of
+ * the on-card buffer. Then go on to the next sector of the request,
+ * or if the request is finished (or failed), take it off the queue,
+ * start the next one, and tell whoever submitted it. Called with the
+ * lock held; it's dropped while the submitter is told, so dr_done can
+ * submit more requests.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct devreq *dr = lh->lh_head;
+	struct uio *uio;
+
+	TRACE(TRACE_DISKDONE, err, lh->lh_unit);
+
+	if (dr == NULL) {
+		/* Nothing was running; ignore it */
+		return;
+	}
+	uio = dr->dr_uio;
+
+	if (err == 0 && uio->uio_rw == UIO_READ) {
+		err = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+	}
+	if (err == 0 && uio->uio_resid > 0) {
+		lhd_start(lh);
+		return;
+	}
+
+	lh->lh_head = dr->dr_next;
+	if (lh->lh_head == NULL) {
+		lh->lh_tail = NULL;
+	}
+	else {
+		lhd_start(lh);
+	}
+
+	spinlock_release(&lh->lh_lock);
+	dr->dr_done(dr, err);
+	spinlock_acquire(&lh->lh_lock);
 }
 
 /*
@@ -116,7 +180,9 @@ lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
 	uint32_t val;
-	
+
+	spinlock_acquire(&lh->lh_lock);
+
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -130,6 +196,8 @@ lhd_irq(void *vlh)
 		lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
 }
 
 /*
@@ -194,83 +262,54 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * Queue a chain of requests (for both reads and writes). The disk
+ * does one sector at a time; the interrupt handler starts each next
+ * sector, and each next request, as soon as the last one finishes.
  */
 static
 int
-lhd_io(struct device *d, struct uio *uio)
+lhd_submit(struct device *d, struct devreq *batch)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct devreq *dr, *last = NULL;
+	struct uio *uio;
+	uint32_t sector, len;
+
+	/* Check the whole batch before queueing any of it */
+	for (dr = batch; dr != NULL; dr = dr->dr_next) {
+		uio = dr->dr_uio;
+		KASSERT(uio->uio_segflg == UIO_SYSSPACE);
+
+		sector = uio->uio_offset / LHD_SECTSIZE;
+		len = uio->uio_resid / LHD_SECTSIZE;
+
+		/* Don't allow I/O that isn't sector-aligned, or is empty. */
+		if (uio->uio_offset % LHD_SECTSIZE != 0 ||
+		    uio->uio_resid % LHD_SECTSIZE != 0 || len == 0) {
+			return EINVAL;
+		}
 
-	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
-	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
-	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
-	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
-
-	/* Don't allow I/O that isn't sector-aligned. */
-	if (sectoff != 0 || lenoff != 0) {
-		return EINVAL;
+		/* Don't allow I/O past the end of the disk. */
+		if (sector+len > lh->lh_dev.d_blocks) {
+			return EINVAL;
+		}
+		last = dr;
 	}
-
-	/* Don't allow I/O past the end of the disk. */
-	if (sector+len > lh->lh_dev.d_blocks) {
-		return EINVAL;
+	if (last == NULL) {
+		return 0;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	spinlock_acquire(&lh->lh_lock);
+	if (lh->lh_head == NULL) {
+		lh->lh_head = batch;
+		lh->lh_tail = last;
+		lhd_start(lh);
 	}
-
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
-		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
+	else {
+		lh->lh_tail->dr_next = batch;
+		lh->lh_tail = last;
 	}
+	spinlock_release(&lh->lh_lock);
 
 	return 0;
 }
@@ -289,22 +328,15 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	spinlock_init(&lh->lh_lock);
+	lh->lh_head = NULL;
+	lh->lh_tail = NULL;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
 	lh->lh_dev.d_close = lhd_close;
-	lh->lh_dev.d_io = lhd_io;
+	lh->lh_dev.d_io = dev_syncio;
+	lh->lh_dev.d_submit = lhd_submit;
 	lh->lh_dev.d_ioctl = lhd_ioctl;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
@@ -148,6 +148,16 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
+	/*
+	 * With a journal, committing everything that's changed is
+	 * all it takes; it goes in one write.
+	 */
+	if (sfs->sfs_journal != NULL) {
+		result = sfs_jcommit(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Go over the array of loaded vnodes, syncing as we go. */
 	num = vnodearray_num(sfs->sfs_vnodes);
 	for (i=0; i<num; i++) {
@@ -208,6 +218,7 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
 	vfs_biglock_acquire();
 	
@@ -217,11 +228,19 @@ sfs_unmount(struct fs *fs)
 		return EBUSY;
 	}
 
+	/* Leave nothing in the journal that has to be replayed. */
+	result = sfs_jflush(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
 	/* Once we start nuking stuff we can't fail. */
+	sfs_junmount(sfs);
 	vnodearray_destroy(sfs->sfs_vnodes);
 	bitmap_destroy(sfs->sfs_freemap);
 	
@@ -256,6 +275,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
+	uint32_t i;
 
 	vfs_biglock_acquire();
 
@@ -299,6 +319,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
+	sfs->sfs_journal = NULL;
 
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
@@ -330,9 +351,21 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
+	/* Replay the journal, if any, before reading anything else */
+	result = sfs_jmount(sfs);
+	if (result) {
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+	/* (replaying may have reloaded the superblock) */
+	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
+
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		sfs_junmount(sfs);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
@@ -341,11 +374,20 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
+		sfs_junmount(sfs);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
 		return result;
 	}
+	bitmap_rescan(sfs->sfs_freemap);
+	sfs->sfs_nfree = 0;
+	for (i=0; i<sfs->sfs_super.sp_nblocks; i++) {
+		if (!bitmap_isset(sfs->sfs_freemap, i)) {
+			sfs->sfs_nfree++;
+		}
+	}
+	sfs->sfs_reserved = 0;
 
 	/* Set up abstract fs calls */
 	sfs->sfs_absfs.fs_sync = sfs_sync;
@@ -30,6 +30,8 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
@@ -42,7 +44,12 @@
 // Note: sfs_rblock is used to read the superblock
 // early in mount, before sfs is fully (or even mostly)
 // initialized, and so may not use anything from sfs
-// except sfs_device.
+// except sfs_device and sfs_journal.
+//
+// Metadata blocks written since the last journal
+// checkpoint may not be on disk yet, so sfs_rblock
+// looks in the journal first. sfs_wblock always writes
+// in place; metadata goes through sfs_jwrite.
 
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
@@ -92,6 +99,10 @@ sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block)
 	struct iovec iov;
 	struct uio ku;
 
+	if (sfs->sfs_journal != NULL && sfs_jread(sfs, data, block)) {
+		return 0;
+	}
+
 	SFSUIO(&iov, &ku, data, block, UIO_READ);
 	return sfs_rwblock(sfs, &ku);
 }
@@ -105,3 +116,152 @@ sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block)
 	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
 	return sfs_rwblock(sfs, &ku);
 }
+
+/*
+ * Write N blocks, one from each of IOVS, to consecutive blocks
+ * starting at BLOCK in a single transfer.
+ */
+int
+sfs_wblocks(struct sfs_fs *sfs, struct iovec *iovs, unsigned n,
+	    uint32_t block)
+{
+	struct uio ku;
+
+	ku.uio_iov = iovs;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = ((off_t)block) * SFS_BLOCKSIZE;
+	ku.uio_resid = n * SFS_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Batched writeback.
+ *
+ * sfs_wbatch hands a whole set of block writes to the device's queue
+ * at once, so the disk goes straight from each block to the next
+ * instead of waiting for us to wake up and submit another. The
+ * device calls sfs_wbatchdone for each request from its interrupt
+ * handler; the last one to finish wakes us.
+ */
+
+struct sfs_wbatch {
+	struct spinlock wb_lock;	/* protects wb_pending */
+	unsigned wb_pending;		/* requests not finished yet */
+	struct semaphore *wb_sem;	/* V'd when wb_pending hits 0 */
+};
+
+struct sfs_wbreq {
+	struct devreq br_dr;
+	struct iovec br_iov;
+	struct uio br_uio;
+	int br_result;
+	struct sfs_wbatch *br_batch;
+};
+
+static
+void
+sfs_wbatchdone(struct devreq *dr, int result)
+{
+	struct sfs_wbreq *br = dr->dr_data;
+	struct sfs_wbatch *wb = br->br_batch;
+	bool last;
+
+	br->br_result = result;
+
+	spinlock_acquire(&wb->wb_lock);
+	KASSERT(wb->wb_pending > 0);
+	wb->wb_pending--;
+	last = (wb->wb_pending == 0);
+	spinlock_release(&wb->wb_lock);
+
+	if (last) {
+		V(wb->wb_sem);
+	}
+}
+
+/*
+ * Write REQS[i].wr_data to block REQS[i].wr_block for each of the N
+ * requests, in no particular order. Blocks the device fails to write
+ * are tried again with sfs_wblock, which knows how to retry. If the
+ * device can't queue requests, or there's no memory to describe
+ * them, the blocks are just written one at a time.
+ */
+int
+sfs_wbatch(struct sfs_fs *sfs, struct sfs_wreq *reqs, unsigned n)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_wbatch wb;
+	struct sfs_wbreq *brs = NULL;
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (n == 0) {
+		return 0;
+	}
+
+	wb.wb_sem = NULL;
+	if (dev->d_submit != NULL) {
+		brs = kmalloc(n * sizeof(*brs));
+		wb.wb_sem = sem_create("sfs_wbatch", 0);
+	}
+	if (brs == NULL || wb.wb_sem == NULL) {
+		goto onebyone;
+	}
+	spinlock_init(&wb.wb_lock);
+	wb.wb_pending = n;
+
+	for (i=0; i<n; i++) {
+		SFSUIO(&brs[i].br_iov, &brs[i].br_uio, reqs[i].wr_data,
+		       reqs[i].wr_block, UIO_WRITE);
+		brs[i].br_dr.dr_uio = &brs[i].br_uio;
+		brs[i].br_dr.dr_done = sfs_wbatchdone;
+		brs[i].br_dr.dr_data = &brs[i];
+		brs[i].br_dr.dr_next = (i+1 < n) ? &brs[i+1].br_dr : NULL;
+		brs[i].br_result = 0;
+		brs[i].br_batch = &wb;
+	}
+
+	DEBUG(DB_SFS, "sfs: batch of %u writes\n", n);
+
+	result = dev->d_submit(dev, &brs[0].br_dr);
+	if (result) {
+		/* nothing was queued; let sfs_wblock sort it out */
+		spinlock_cleanup(&wb.wb_lock);
+		goto onebyone;
+	}
+	P(wb.wb_sem);
+	spinlock_cleanup(&wb.wb_lock);
+
+	for (i=0; i<n; i++) {
+		if (brs[i].br_result != 0) {
+			result = sfs_wblock(sfs, reqs[i].wr_data,
+					    reqs[i].wr_block);
+			if (result) {
+				break;
+			}
+		}
+	}
+	kfree(brs);
+	sem_destroy(wb.wb_sem);
+	return result;
+
+ onebyone:
+	if (brs != NULL) {
+		kfree(brs);
+	}
+	if (wb.wb_sem != NULL) {
+		sem_destroy(wb.wb_sem);
+	}
+	for (i=0; i<n; i++) {
+		result = sfs_wblock(sfs, reqs[i].wr_data, reqs[i].wr_block);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,944 @@
+/*
+ * SFS filesystem
+ *
+ * Write-ahead metadata journal. See <kern/sfs.h> for the on-disk
+ * format.
+ *
+ * Metadata writes (inodes, bitmap blocks, the superblock, directory
+ * and indirect blocks) don't go to disk when they're made; the block
+ * image is kept in a table here and becomes part of the running
+ * transaction. sfs_jcommit writes the whole running transaction to
+ * the log in one sequential transfer, which is all fsync and sync
+ * have to wait for. The images stay in the table, and reads are
+ * answered from it, until a checkpoint writes them to their home
+ * locations and empties the log. Checkpoints happen when the log is
+ * half full and on unmount. File data is written in place as before;
+ * each commit flushes the files' buffered data first, so it's always
+ * on disk before the metadata that points to it.
+ *
+ * Commits are only made between operations (or at the start of one),
+ * so every committed state is one the filesystem passed through; a
+ * crash loses at most the operations since the last commit and
+ * replaying the log at mount brings the volume back to a consistent
+ * state.
+ *
+ * A block that's freed mustn't be reused until the free is committed
+ * (or a crash could leave its old owner pointing at new contents),
+ * nor while an image of it is in the log (or a checkpoint or replay
+ * would write the old image over its new contents). So sfs_bfree
+ * just notes the block here; it's given back to the bitmap after the
+ * next commit, or after the next checkpoint if it has an image.
+ *
+ * Everything is covered by vfs_biglock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <array.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <sfs.h>
+
+/* Size of the block table's hash */
+#define SFS_JHASHSIZE 64
+
+/*
+ * A metadata block that's been written since the last checkpoint, or
+ * a freed block that can't be reused yet. JB_DATA is NULL for freed
+ * blocks that were never logged.
+ */
+struct sfs_jbuf {
+	uint32_t jb_block;		/* home location */
+	bool jb_running;		/* changed since the last commit */
+	bool jb_freed;			/* freed; give back to the bitmap */
+	char *jb_data;			/* latest image, or NULL */
+	struct sfs_jbuf *jb_next;	/* hash chain */
+};
+
+struct sfs_journal {
+	uint32_t j_start;		/* header block */
+	uint32_t j_size;		/* log blocks after the header */
+	uint32_t j_head;		/* next free log block */
+	uint32_t j_seq;			/* number of the next transaction */
+	unsigned j_nrunning;		/* images in the running transaction */
+	bool *j_mapdirty;		/* bitmap blocks changed */
+	struct sfs_jbuf *j_hash[SFS_JHASHSIZE];
+};
+
+////////////////////////////////////////////////////////////
+//
+// Block table
+
+static
+struct sfs_jbuf **
+sfs_jbucket(struct sfs_journal *j, uint32_t block)
+{
+	return &j->j_hash[block % SFS_JHASHSIZE];
+}
+
+static
+struct sfs_jbuf *
+sfs_jfind(struct sfs_journal *j, uint32_t block)
+{
+	struct sfs_jbuf *jb;
+
+	for (jb = *sfs_jbucket(j, block); jb != NULL; jb = jb->jb_next) {
+		if (jb->jb_block == block) {
+			return jb;
+		}
+	}
+	return NULL;
+}
+
+static
+struct sfs_jbuf *
+sfs_jadd(struct sfs_journal *j, uint32_t block)
+{
+	struct sfs_jbuf **bucket = sfs_jbucket(j, block);
+	struct sfs_jbuf *jb;
+
+	jb = kmalloc(sizeof(struct sfs_jbuf));
+	if (jb == NULL) {
+		return NULL;
+	}
+	jb->jb_block = block;
+	jb->jb_running = false;
+	jb->jb_freed = false;
+	jb->jb_data = NULL;
+	jb->jb_next = *bucket;
+	*bucket = jb;
+	return jb;
+}
+
+/*
+ * Give a freed block back to the bitmap. The change to the bitmap
+ * goes in the running transaction like any other.
+ */
+static
+void
+sfs_jrelease(struct sfs_fs *sfs, struct sfs_jbuf *jb)
+{
+	KASSERT(jb->jb_freed);
+	bitmap_unmark(sfs->sfs_freemap, jb->jb_block);
+	sfs->sfs_nfree++;
+	sfs->sfs_freemapdirty = true;
+	sfs_jmarkmap(sfs, jb->jb_block);
+}
+
+/*
+ * Drop entries from the table: all of them, or just the freed blocks
+ * that were never logged. Freed blocks go back to the bitmap.
+ */
+static
+void
+sfs_jdrop(struct sfs_fs *sfs, bool all)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf **p, *jb;
+	unsigned i;
+
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		p = &j->j_hash[i];
+		while ((jb = *p) != NULL) {
+			if (!all && jb->jb_data != NULL) {
+				p = &jb->jb_next;
+				continue;
+			}
+			KASSERT(!jb->jb_running);
+			if (jb->jb_freed) {
+				sfs_jrelease(sfs, jb);
+			}
+			*p = jb->jb_next;
+			if (jb->jb_data != NULL) {
+				kfree(jb->jb_data);
+			}
+			kfree(jb);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface for the rest of sfs
+
+/*
+ * If BLOCK has an image in the table, copy it to DATA and return
+ * true. Called by sfs_rblock.
+ */
+bool
+sfs_jread(struct sfs_fs *sfs, void *data, uint32_t block)
+{
+	struct sfs_jbuf *jb;
+
+	jb = sfs_jfind(sfs->sfs_journal, block);
+	if (jb == NULL || jb->jb_data == NULL) {
+		return false;
+	}
+	memcpy(data, jb->jb_data, SFS_BLOCKSIZE);
+	return true;
+}
+
+/*
+ * Write a metadata block. Without a journal, this is just sfs_wblock.
+ */
+int
+sfs_jwrite(struct sfs_fs *sfs, const void *data, uint32_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+
+	if (j == NULL) {
+		return sfs_wblock(sfs, (void *)data, block);
+	}
+
+	jb = sfs_jfind(j, block);
+	if (jb == NULL) {
+		jb = sfs_jadd(j, block);
+		if (jb == NULL) {
+			return ENOMEM;
+		}
+	}
+	/* freed blocks are never reused while they're in the table */
+	KASSERT(!jb->jb_freed);
+	if (jb->jb_data == NULL) {
+		jb->jb_data = kmalloc(SFS_BLOCKSIZE);
+		if (jb->jb_data == NULL) {
+			return ENOMEM;
+		}
+	}
+	memcpy(jb->jb_data, data, SFS_BLOCKSIZE);
+	if (!jb->jb_running) {
+		jb->jb_running = true;
+		j->j_nrunning++;
+	}
+	return 0;
+}
+
+/*
+ * Note that a block has been freed. Returns false if there's no
+ * journal, or no memory to remember it with, in which case the caller
+ * frees it right away.
+ */
+bool
+sfs_jfree(struct sfs_fs *sfs, uint32_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+
+	if (j == NULL) {
+		return false;
+	}
+	jb = sfs_jfind(j, block);
+	if (jb == NULL) {
+		jb = sfs_jadd(j, block);
+		if (jb == NULL) {
+			return false;
+		}
+	}
+	KASSERT(!jb->jb_freed);
+	jb->jb_freed = true;
+	return true;
+}
+
+/*
+ * Give back freed blocks that were never logged without waiting for
+ * the commit. Only used when the disk is otherwise full. Returns
+ * true if there were any.
+ */
+bool
+sfs_jreclaim(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	unsigned i;
+	bool any = false;
+
+	if (j == NULL) {
+		return false;
+	}
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		for (jb = j->j_hash[i]; jb != NULL; jb = jb->jb_next) {
+			if (jb->jb_freed && jb->jb_data == NULL) {
+				any = true;
+			}
+		}
+	}
+	if (any) {
+		sfs_jdrop(sfs, false);
+	}
+	return any;
+}
+
+/*
+ * Note that the bitmap bit for BLOCK has changed.
+ */
+void
+sfs_jmarkmap(struct sfs_fs *sfs, uint32_t block)
+{
+	if (sfs->sfs_journal != NULL) {
+		sfs->sfs_journal->j_mapdirty[block / SFS_BLOCKBITS] = true;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Commit and checkpoint
+
+/* Log blocks needed to commit N images */
+static
+uint32_t
+sfs_jtxblocks(uint32_t n)
+{
+	return n + DIVROUNDUP(n, SFS_JDESC_MAX) + 1;
+}
+
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jheader jh;
+
+	bzero(&jh, sizeof(jh));
+	jh.jh_magic = SFS_JMAGIC_HEADER;
+	jh.jh_seq = j->j_seq;
+	return sfs_wblock(sfs, &jh, j->j_start);
+}
+
+/*
+ * Write every image in the table to its home location, then empty
+ * the log. There must be no running transaction. The images are
+ * written as one batch, so the disk isn't left idle between them.
+ */
+static
+int
+sfs_jcheckpoint(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	struct sfs_wreq *reqs;
+	unsigned i, n;
+	int result;
+
+	KASSERT(j->j_nrunning == 0);
+
+	n = 0;
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		for (jb = j->j_hash[i]; jb != NULL; jb = jb->jb_next) {
+			if (jb->jb_data != NULL) {
+				n++;
+			}
+		}
+	}
+
+	reqs = (n > 0) ? kmalloc(n * sizeof(*reqs)) : NULL;
+	if (reqs != NULL) {
+		n = 0;
+		for (i=0; i<SFS_JHASHSIZE; i++) {
+			for (jb = j->j_hash[i]; jb != NULL; jb = jb->jb_next) {
+				if (jb->jb_data == NULL) {
+					continue;
+				}
+				reqs[n].wr_data = jb->jb_data;
+				reqs[n].wr_block = jb->jb_block;
+				n++;
+			}
+		}
+		result = sfs_wbatch(sfs, reqs, n);
+		kfree(reqs);
+		if (result) {
+			return result;
+		}
+	}
+	else {
+		/* nothing to write, or no memory to batch it */
+		for (i=0; i<SFS_JHASHSIZE; i++) {
+			for (jb = j->j_hash[i]; jb != NULL;
+			     jb = jb->jb_next) {
+				if (jb->jb_data == NULL) {
+					continue;
+				}
+				result = sfs_wblock(sfs, jb->jb_data,
+						    jb->jb_block);
+				if (result) {
+					return result;
+				}
+			}
+		}
+	}
+
+	/* Only now is it safe to forget what's in the log. */
+	result = sfs_jwriteheader(sfs);
+	if (result) {
+		return result;
+	}
+	j->j_head = 0;
+
+	sfs_jdrop(sfs, true);
+	return 0;
+}
+
+/*
+ * Put the running transaction's images into the log as one write:
+ * descriptors, each followed by the images it lists, then the commit
+ * record.
+ */
+static
+int
+sfs_jlog(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *descs;
+	struct sfs_jcommit *jc;
+	struct sfs_jbuf *jb;
+	struct iovec *iovs;
+	uint32_t nblocks, ndescs, sum, k;
+	unsigned i, d, n, w;
+	const uint32_t *words;
+	int result;
+
+	n = j->j_nrunning;
+	ndescs = DIVROUNDUP(n, SFS_JDESC_MAX);
+	nblocks = sfs_jtxblocks(n);
+	KASSERT(j->j_head + nblocks <= j->j_size);
+
+	descs = kmalloc(ndescs * sizeof(struct sfs_jdesc));
+	jc = kmalloc(sizeof(struct sfs_jcommit));
+	iovs = kmalloc(nblocks * sizeof(struct iovec));
+	if (descs == NULL || jc == NULL || iovs == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	/* Lay out the transaction and add up its checksum. */
+	sum = 0;
+	d = 0;
+	k = 0;
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		for (jb = j->j_hash[i]; jb != NULL; jb = jb->jb_next) {
+			if (!jb->jb_running) {
+				continue;
+			}
+			if (d == 0 || descs[d-1].jd_count == SFS_JDESC_MAX) {
+				bzero(&descs[d], sizeof(descs[d]));
+				descs[d].jd_magic = SFS_JMAGIC_DESC;
+				descs[d].jd_seq = j->j_seq;
+				iovs[k].iov_kbase = &descs[d];
+				iovs[k].iov_len = SFS_BLOCKSIZE;
+				k++;
+				d++;
+			}
+			descs[d-1].jd_blocks[descs[d-1].jd_count++] =
+				jb->jb_block;
+			iovs[k].iov_kbase = jb->jb_data;
+			iovs[k].iov_len = SFS_BLOCKSIZE;
+			k++;
+		}
+	}
+	KASSERT(d == ndescs && k == nblocks - 1);
+	for (i=0; i<k; i++) {
+		words = iovs[i].iov_kbase;
+		for (w=0; w<SFS_BLOCKSIZE/sizeof(uint32_t); w++) {
+			sum = SFS_JSUM(sum, words[w]);
+		}
+	}
+
+	bzero(jc, sizeof(*jc));
+	jc->jc_magic = SFS_JMAGIC_COMMIT;
+	jc->jc_seq = j->j_seq;
+	jc->jc_nblocks = k;
+	jc->jc_sum = sum;
+	iovs[k].iov_kbase = jc;
+	iovs[k].iov_len = SFS_BLOCKSIZE;
+
+	result = sfs_wblocks(sfs, iovs, nblocks, j->j_start + 1 + j->j_head);
+	if (result) {
+		goto out;
+	}
+
+	DEBUG(DB_SFS, "sfs: journal commit %u: %u blocks at %u\n",
+	      j->j_seq, n, j->j_head);
+
+	j->j_head += nblocks;
+	j->j_seq++;
+
+ out:
+	if (descs != NULL) {
+		kfree(descs);
+	}
+	if (jc != NULL) {
+		kfree(jc);
+	}
+	if (iovs != NULL) {
+		kfree(iovs);
+	}
+	return result;
+}
+
+/*
+ * Write out buffered file data, and put the dirty inodes, bitmap
+ * blocks, and superblock in the running transaction.
+ */
+static
+int
+sfs_jgather(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_vnode *sv;
+	char *bitdata;
+	unsigned i, num;
+	int result;
+
+	/* File data first; flushing it allocates blocks. */
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		result = sfs_flushdata(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	for (i=0; i<num; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		if (sv->sv_dirty) {
+			result = sfs_jwrite(sfs, &sv->sv_i, sv->sv_ino);
+			if (result) {
+				return result;
+			}
+			sv->sv_dirty = false;
+		}
+	}
+
+	if (sfs->sfs_freemapdirty) {
+		bitdata = bitmap_getdata(sfs->sfs_freemap);
+		num = SFS_BITBLOCKS(sfs->sfs_super.sp_nblocks);
+		for (i=0; i<num; i++) {
+			if (!j->j_mapdirty[i]) {
+				continue;
+			}
+			result = sfs_jwrite(sfs, bitdata + i*SFS_BLOCKSIZE,
+					    SFS_MAP_LOCATION + i);
+			if (result) {
+				return result;
+			}
+			j->j_mapdirty[i] = false;
+		}
+		sfs->sfs_freemapdirty = false;
+	}
+
+	if (sfs->sfs_superdirty) {
+		result = sfs_jwrite(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+		if (result) {
+			return result;
+		}
+		sfs->sfs_superdirty = false;
+	}
+	return 0;
+}
+
+/*
+ * Commit everything that's changed: the group commit that fsync,
+ * sync, and close all come down to.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	unsigned i;
+	bool inplace = false;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(j != NULL);
+
+	result = sfs_jgather(sfs);
+	if (result) {
+		return result;
+	}
+
+	if (j->j_nrunning > 0) {
+		if (j->j_head + sfs_jtxblocks(j->j_nrunning) <= j->j_size) {
+			result = sfs_jlog(sfs);
+			if (result) {
+				return result;
+			}
+		}
+		else {
+			/*
+			 * sfs_jbegin leaves room for the worst case the
+			 * operation declares, and operations are kept
+			 * within sfs_jmaxop, so this only happens if one
+			 * operation is bigger than the whole log anyway.
+			 * All we can do then is write everything in
+			 * place, which isn't atomic.
+			 */
+			kprintf("sfs: %s: transaction of %u blocks doesn't "
+				"fit in the journal; writing in place\n",
+				sfs->sfs_super.sp_volname, j->j_nrunning);
+			inplace = true;
+		}
+
+		for (i=0; i<SFS_JHASHSIZE; i++) {
+			for (jb = j->j_hash[i]; jb != NULL;
+			     jb = jb->jb_next) {
+				jb->jb_running = false;
+			}
+		}
+		j->j_nrunning = 0;
+	}
+
+	/* Blocks freed before this commit can be reused now. */
+	sfs_jdrop(sfs, false);
+
+	if (inplace || j->j_head > j->j_size / 2) {
+		return sfs_jcheckpoint(sfs);
+	}
+	return 0;
+}
+
+/*
+ * The most images the running transaction can hold when it's next
+ * committed, if one more operation that adds NBLOCKS of its own runs
+ * first: what's in it now; for each vnode, its inode, and if it has
+ * buffered data, the indirect block that flushing it may allocate;
+ * every bitmap block; the superblock; and the operation's blocks.
+ */
+static
+uint32_t
+sfs_jworstcase(struct sfs_fs *sfs, uint32_t nblocks)
+{
+	struct sfs_vnode *sv;
+	uint32_t n;
+	unsigned i, k, num;
+
+	n = sfs->sfs_journal->j_nrunning + 1 +
+		SFS_BITBLOCKS(sfs->sfs_super.sp_nblocks) + nblocks;
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		for (k=0; k<SFS_NDBUFS; k++) {
+			if (sv->sv_dbufs[k] != NULL &&
+			    sv->sv_dbufs[k]->db_dirty) {
+				break;
+			}
+		}
+		if (k < SFS_NDBUFS) {
+			n += 2;
+		}
+		else if (sv->sv_dirty) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Called at the start of operations that change metadata, writes
+ * included: make sure the running transaction will still fit in the
+ * log after this operation adds up to NBLOCKS images to it (besides
+ * inodes of loaded vnodes and bitmap blocks), by committing now and
+ * if need be checkpointing to empty the log. Must not be called from
+ * inside another operation, or the commit wouldn't be atomic.
+ */
+int
+sfs_jbegin(struct sfs_fs *sfs, uint32_t nblocks)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+	if (j->j_head + sfs_jtxblocks(sfs_jworstcase(sfs, nblocks))
+	    <= j->j_size) {
+		return 0;
+	}
+	result = sfs_jcommit(sfs);
+	if (result) {
+		return result;
+	}
+	if (j->j_head > 0 &&
+	    j->j_head + sfs_jtxblocks(sfs_jworstcase(sfs, nblocks))
+	    > j->j_size) {
+		return sfs_jcheckpoint(sfs);
+	}
+	return 0;
+}
+
+/*
+ * The largest NBLOCKS an operation can pass to sfs_jbegin and still
+ * be sure to fit: what's left of an empty log after the bitmap and
+ * the superblock. Without a journal there's no limit.
+ */
+uint32_t
+sfs_jmaxop(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	uint32_t fixed, n;
+
+	if (j == NULL) {
+		return (uint32_t)-1;
+	}
+	fixed = 1 + SFS_BITBLOCKS(sfs->sfs_super.sp_nblocks);
+	n = j->j_size;
+	while (n > 0 && sfs_jtxblocks(n) > j->j_size) {
+		n--;
+	}
+	return n > fixed ? n - fixed : 0;
+}
+
+/*
+ * Get everything to its home location and empty the log, as for
+ * unmount. Releasing freed blocks at the checkpoint dirties the
+ * bitmap, so it can take a second round.
+ */
+int
+sfs_jflush(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+	do {
+		result = sfs_jcommit(sfs);
+		if (result) {
+			return result;
+		}
+		if (j->j_head > 0) {
+			result = sfs_jcheckpoint(sfs);
+			if (result) {
+				return result;
+			}
+		}
+	} while (sfs->sfs_freemapdirty);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Mount, replay, and unmount
+
+/*
+ * Check the transaction whose first descriptor is at log block POS.
+ * If it's complete, hand back the log block after its commit record.
+ */
+static
+bool
+sfs_jscan(struct sfs_fs *sfs, uint32_t pos, uint32_t seq, uint32_t *next)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	union {
+		struct sfs_jdesc jd;
+		struct sfs_jcommit jc;
+		uint32_t words[SFS_BLOCKSIZE/sizeof(uint32_t)];
+	} buf;
+	uint32_t sum = 0, first = pos, count, i, w;
+
+	while (pos < j->j_size) {
+		if (sfs_rblock(sfs, &buf, j->j_start + 1 + pos)) {
+			return false;
+		}
+		if (buf.jc.jc_magic == SFS_JMAGIC_COMMIT &&
+		    buf.jc.jc_seq == seq && pos > first) {
+			if (buf.jc.jc_nblocks != pos - first ||
+			    buf.jc.jc_sum != sum) {
+				return false;
+			}
+			*next = pos + 1;
+			return true;
+		}
+		if (buf.jd.jd_magic != SFS_JMAGIC_DESC ||
+		    buf.jd.jd_seq != seq ||
+		    buf.jd.jd_count == 0 || buf.jd.jd_count > SFS_JDESC_MAX) {
+			return false;
+		}
+		for (i=0; i<buf.jd.jd_count; i++) {
+			if (buf.jd.jd_blocks[i] >= sfs->sfs_super.sp_nblocks) {
+				return false;
+			}
+		}
+		count = buf.jd.jd_count;
+		for (w=0; w<SFS_BLOCKSIZE/sizeof(uint32_t); w++) {
+			sum = SFS_JSUM(sum, buf.words[w]);
+		}
+		pos++;
+		for (i=0; i<count && pos < j->j_size; i++, pos++) {
+			if (sfs_rblock(sfs, &buf, j->j_start + 1 + pos)) {
+				return false;
+			}
+			for (w=0; w<SFS_BLOCKSIZE/sizeof(uint32_t); w++) {
+				sum = SFS_JSUM(sum, buf.words[w]);
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Write the images of the (already checked) transaction at log block
+ * POS to their home locations.
+ */
+static
+int
+sfs_japply(struct sfs_fs *sfs, uint32_t pos, uint32_t end)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc jd;
+	char buf[SFS_BLOCKSIZE];
+	uint32_t i;
+	int result;
+
+	/* the last block is the commit record */
+	while (pos < end - 1) {
+		result = sfs_rblock(sfs, &jd, j->j_start + 1 + pos);
+		if (result) {
+			return result;
+		}
+		pos++;
+		for (i=0; i<jd.jd_count; i++, pos++) {
+			result = sfs_rblock(sfs, buf, j->j_start + 1 + pos);
+			if (result) {
+				return result;
+			}
+			result = sfs_wblock(sfs, buf, jd.jd_blocks[i]);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Replay every complete transaction in the log, then empty it.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	uint32_t pos = 0, next, count = 0;
+	int result;
+
+	while (sfs_jscan(sfs, pos, j->j_seq, &next)) {
+		result = sfs_japply(sfs, pos, next);
+		if (result) {
+			return result;
+		}
+		pos = next;
+		j->j_seq++;
+		count++;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	kprintf("sfs: %s: replayed %u journal transaction%s\n",
+		sfs->sfs_super.sp_volname, count, count == 1 ? "" : "s");
+	result = sfs_jwriteheader(sfs);
+	if (result) {
+		return result;
+	}
+	/* In case the superblock was in there */
+	return sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+}
+
+/*
+ * Set up the journal, if the volume has one, and replay it. Must be
+ * called after the superblock is loaded and before anything else is
+ * read.
+ */
+int
+sfs_jmount(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_journal *j;
+	struct sfs_jheader jh;
+	unsigned i;
+	int result;
+
+	sfs->sfs_journal = NULL;
+	if (sp->sp_journalblocks == 0) {
+		return 0;
+	}
+	if (sp->sp_journalstart <= SFS_MAP_LOCATION ||
+	    sp->sp_journalblocks < 2 ||
+	    sp->sp_journalstart + sp->sp_journalblocks > sp->sp_nblocks) {
+		kprintf("sfs: %s: Bad journal location\n", sp->sp_volname);
+		return EINVAL;
+	}
+
+	result = sfs_rblock(sfs, &jh, sp->sp_journalstart);
+	if (result) {
+		return result;
+	}
+	if (jh.jh_magic != SFS_JMAGIC_HEADER) {
+		kprintf("sfs: %s: Wrong magic number in journal header\n",
+			sp->sp_volname);
+		return EINVAL;
+	}
+
+	j = kmalloc(sizeof(struct sfs_journal));
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	j->j_mapdirty = kmalloc(SFS_BITBLOCKS(sp->sp_nblocks) * sizeof(bool));
+	if (j->j_mapdirty == NULL) {
+		kfree(j);
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_BITBLOCKS(sp->sp_nblocks); i++) {
+		j->j_mapdirty[i] = false;
+	}
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		j->j_hash[i] = NULL;
+	}
+	j->j_start = sp->sp_journalstart;
+	j->j_size = sp->sp_journalblocks - 1;
+	j->j_head = 0;
+	j->j_seq = jh.jh_seq;
+	j->j_nrunning = 0;
+	sfs->sfs_journal = j;
+
+	result = sfs_jreplay(sfs);
+	if (result) {
+		sfs_junmount(sfs);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Get rid of the journal structure. Anything still in it is lost;
+ * call sfs_jflush first.
+ */
+void
+sfs_junmount(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	unsigned i;
+
+	if (j == NULL) {
+		return;
+	}
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		while ((jb = j->j_hash[i]) != NULL) {
+			j->j_hash[i] = jb->jb_next;
+			if (jb->jb_data != NULL) {
+				kfree(jb->jb_data);
+			}
+			kfree(jb);
+		}
+	}
+	kfree(j->j_mapdirty);
+	kfree(j);
+	sfs->sfs_journal = NULL;
+}
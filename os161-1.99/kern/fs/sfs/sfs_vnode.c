@@ -49,6 +49,9 @@
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/* Further down */
+static int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -63,14 +66,14 @@ sfs_clearblock(struct sfs_fs *sfs, uint32_t block)
 	return sfs_wblock(sfs, zeros, block);
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/* Write an on-disk inode structure back out (to the journal, if any). */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		int result = sfs_jwrite(sfs, &sv->sv_i, sv->sv_ino);
 		if (result) {
 			return result;
 		}
@@ -84,39 +87,86 @@ sfs_sync_inode(struct sfs_vnode *sv)
 // Space allocation
 
 /*
- * Allocate a block.
+ * Allocate a block. It's zeroed unless CLEAR is false, for when the
+ * caller is about to write the whole block anyway.
  */
 static
 int
-sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock, bool clear)
 {
 	int result;
 
+	/*
+	 * Blocks reserved for buffered file data aren't ours to take.
+	 * If that leaves none, use blocks freed since the last commit;
+	 * better than failing.
+	 */
+	while (sfs->sfs_nfree <= sfs->sfs_reserved) {
+		if (!sfs_jreclaim(sfs)) {
+			return ENOSPC;
+		}
+	}
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
 		return result;
 	}
+	sfs->sfs_nfree--;
 	sfs->sfs_freemapdirty = true;
+	sfs_jmarkmap(sfs, *diskblock);
 
 	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
 
 	/* Clear block before returning it */
+	if (!clear) {
+		return 0;
+	}
 	return sfs_clearblock(sfs, *diskblock);
 }
 
 /*
- * Free a block.
+ * Free a block. With a journal, the block isn't actually released
+ * until it's safe to reuse it; see sfs_journal.c.
  */
 static
 void
 sfs_bfree(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	if (sfs_jfree(sfs, diskblock)) {
+		return;
+	}
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
+	sfs->sfs_nfree++;
 	sfs->sfs_freemapdirty = true;
 }
 
+/*
+ * Set aside N free blocks, so they can be allocated later without
+ * running out. Fails with ENOSPC rather than promise blocks that
+ * aren't there.
+ */
+static
+int
+sfs_reserve(struct sfs_fs *sfs, uint32_t n)
+{
+	while (sfs->sfs_nfree < sfs->sfs_reserved + n) {
+		if (!sfs_jreclaim(sfs)) {
+			return ENOSPC;
+		}
+	}
+	sfs->sfs_reserved += n;
+	return 0;
+}
+
+static
+void
+sfs_unreserve(struct sfs_fs *sfs, uint32_t n)
+{
+	KASSERT(sfs->sfs_reserved >= n);
+	sfs->sfs_reserved -= n;
+}
+
 /*
  * Check if a block is in use.
  */
@@ -139,8 +189,11 @@ sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated. If DOALLOC is SFS_BMAP_NOCLEAR, a new data block isn't
+ * zeroed, because the caller is going to write all of it.
  */
+#define SFS_BMAP_NOCLEAR 2
+
 static
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
@@ -176,7 +229,8 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc(sfs, &block,
+					    doalloc != SFS_BMAP_NOCLEAR);
 			if (result) {
 				return result;
 			}
@@ -236,7 +290,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		 * the indirect block. Thus, we need to allocate an
 		 * indirect block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc(sfs, &idblock, true);
 		if (result) {
 			return result;
 		}
@@ -265,7 +319,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		result = sfs_balloc(sfs, &block, doalloc != SFS_BMAP_NOCLEAR);
 		if (result) {
 			return result;
 		}
@@ -274,7 +328,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		idbuf[idoff] = block;
 
 		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
+		result = sfs_jwrite(sfs, idbuf, idblock);
 		if (result) {
 			return result;
 		}
@@ -289,6 +343,396 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// File data buffers
+//
+// Writes to regular files go into blocks held in memory in the vnode
+// (sv_dbufs), and no disk blocks are allocated for them until they're
+// flushed. Flushing allocates a file's new blocks in file order, so
+// they come out contiguous, and writes each run of consecutive disk
+// blocks in one transfer. Data is flushed when a vnode runs out of
+// buffers, on fsync, close, and reclaim, and (with a journal) before
+// the inodes that point to it are committed. Directories don't use
+// this.
+//
+// So that a full disk is still reported by write, a buffer for a
+// block that isn't on disk yet reserves a free block when it's
+// created (db_reserved), plus one for the indirect block if it needs
+// that and nothing else has reserved it (sv_idreserved). Flushing
+// turns reservations into real blocks; truncating drops them.
+
+/*
+ * Find the buffer holding FILEBLOCK, if any.
+ */
+static
+struct sfs_dbuf *
+sfs_dfind(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_NDBUFS; i++) {
+		if (sv->sv_dbufs[i] != NULL &&
+		    sv->sv_dbufs[i]->db_fileblock == fileblock) {
+			return sv->sv_dbufs[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * After a partial flush or a truncate, make sv_idreserved say whether
+ * the indirect block still needs a reservation: it isn't allocated,
+ * and some reserved buffer is past the direct blocks. Adding it back
+ * doesn't check for space; the block was reserved already.
+ */
+static
+void
+sfs_idreserve_fix(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_dbuf *db;
+	bool need = false;
+	unsigned i;
+
+	for (i=0; i<SFS_NDBUFS && sv->sv_i.sfi_indirect == 0; i++) {
+		db = sv->sv_dbufs[i];
+		if (db != NULL && db->db_reserved &&
+		    db->db_fileblock >= SFS_NDIRECT) {
+			need = true;
+		}
+	}
+	if (need && !sv->sv_idreserved) {
+		sfs->sfs_reserved++;
+		sv->sv_idreserved = true;
+	}
+	else if (!need && sv->sv_idreserved) {
+		sfs_unreserve(sfs, 1);
+		sv->sv_idreserved = false;
+	}
+}
+
+/*
+ * Write out all of a file's dirty buffers.
+ */
+int
+sfs_flushdata(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_dbuf *dirty[SFS_NDBUFS];
+	uint32_t diskblocks[SFS_NDBUFS];
+	struct iovec iovs[SFS_NDBUFS];
+	struct sfs_dbuf *db;
+	unsigned ndirty, nmapped, i, j, run;
+	int result, result2;
+
+	/* Collect the dirty buffers, sorted by block number in the file */
+	ndirty = 0;
+	for (i=0; i<SFS_NDBUFS; i++) {
+		db = sv->sv_dbufs[i];
+		if (db == NULL || !db->db_dirty) {
+			continue;
+		}
+		for (j=ndirty; j>0 && dirty[j-1]->db_fileblock >
+			     db->db_fileblock; j--) {
+			dirty[j] = dirty[j-1];
+		}
+		dirty[j] = db;
+		ndirty++;
+	}
+
+	/*
+	 * Map them, allocating in file order. New blocks aren't
+	 * zeroed; they're about to be written. Each buffer's reserved
+	 * block is released just before it's allocated, so the
+	 * allocation can't fail for lack of space. If we fail partway
+	 * anyway, still write what got mapped, so no allocated block
+	 * is left holding garbage.
+	 */
+	result = 0;
+	if (sv->sv_idreserved) {
+		sfs_unreserve(sfs, 1);
+		sv->sv_idreserved = false;
+	}
+	for (nmapped=0; nmapped<ndirty; nmapped++) {
+		db = dirty[nmapped];
+		if (db->db_reserved) {
+			sfs_unreserve(sfs, 1);
+			db->db_reserved = false;
+		}
+		result = sfs_bmap(sv, db->db_fileblock, SFS_BMAP_NOCLEAR,
+				  &diskblocks[nmapped]);
+		if (result) {
+			/* the block wasn't allocated; hold on to it */
+			sfs->sfs_reserved++;
+			db->db_reserved = true;
+			break;
+		}
+	}
+	if (result) {
+		sfs_idreserve_fix(sv);
+	}
+
+	/* Write each run of consecutive disk blocks in one transfer */
+	for (i=0; i<nmapped; i+=run) {
+		for (run=1; i+run<nmapped &&
+			     diskblocks[i+run] == diskblocks[i]+run; run++);
+		for (j=0; j<run; j++) {
+			iovs[j].iov_kbase = dirty[i+j]->db_data;
+			iovs[j].iov_len = SFS_BLOCKSIZE;
+		}
+		result2 = sfs_wblocks(sfs, iovs, run, diskblocks[i]);
+		if (result2) {
+			return result2;
+		}
+		for (j=0; j<run; j++) {
+			dirty[i+j]->db_dirty = false;
+		}
+	}
+	return result;
+}
+
+/*
+ * Drop the buffers for blocks past LEN (without writing them), and
+ * clear the part of the last one that's past LEN, so it reads back
+ * as zeros if the file grows again.
+ */
+static
+void
+sfs_dtrunc(struct sfs_vnode *sv, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+	uint32_t tail = len % SFS_BLOCKSIZE;
+	struct sfs_dbuf *db;
+	unsigned i;
+
+	for (i=0; i<SFS_NDBUFS; i++) {
+		db = sv->sv_dbufs[i];
+		if (db == NULL) {
+			continue;
+		}
+		if (db->db_fileblock >= blocklen) {
+			if (db->db_reserved) {
+				sfs_unreserve(sfs, 1);
+			}
+			kfree(db);
+			sv->sv_dbufs[i] = NULL;
+		}
+		else if (tail > 0 && db->db_fileblock == blocklen-1) {
+			bzero(db->db_data + tail, SFS_BLOCKSIZE - tail);
+		}
+	}
+	sfs_idreserve_fix(sv);
+}
+
+/*
+ * Get the buffer for FILEBLOCK. A new one is read in from disk, unless
+ * WHOLE is set because the caller is about to overwrite all of it. If
+ * every buffer is in use, the file's data is flushed and the clean
+ * buffer for the earliest block is reused; for a file written
+ * sequentially that's the one least likely to be touched again.
+ */
+static
+int
+sfs_dget(struct sfs_vnode *sv, uint32_t fileblock, bool whole,
+	 struct sfs_dbuf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_dbuf *db;
+	uint32_t diskblock, need;
+	unsigned i, slot;
+	int result;
+
+	db = sfs_dfind(sv, fileblock);
+	if (db != NULL) {
+		*ret = db;
+		return 0;
+	}
+
+	for (slot=0; slot<SFS_NDBUFS; slot++) {
+		if (sv->sv_dbufs[slot] == NULL) {
+			break;
+		}
+	}
+	if (slot == SFS_NDBUFS) {
+		for (i=0; i<SFS_NDBUFS && sv->sv_dbufs[i]->db_dirty; i++);
+		if (i == SFS_NDBUFS) {
+			result = sfs_flushdata(sv);
+			if (result) {
+				return result;
+			}
+		}
+		slot = 0;
+		for (i=0; i<SFS_NDBUFS; i++) {
+			db = sv->sv_dbufs[i];
+			if (db->db_dirty) {
+				continue;
+			}
+			if (sv->sv_dbufs[slot]->db_dirty ||
+			    db->db_fileblock <
+			    sv->sv_dbufs[slot]->db_fileblock) {
+				slot = i;
+			}
+		}
+		db = sv->sv_dbufs[slot];
+		sv->sv_dbufs[slot] = NULL;
+	}
+	else {
+		db = kmalloc(sizeof(struct sfs_dbuf));
+		if (db == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	/*
+	 * Blocks past EOF are never mapped, so don't bother looking.
+	 * (Even when overwriting all of it, we need to know whether
+	 * the block is on disk.)
+	 */
+	diskblock = 0;
+	if ((off_t)fileblock * SFS_BLOCKSIZE < sv->sv_i.sfi_size) {
+		result = sfs_bmap(sv, fileblock, 0, &diskblock);
+		if (result) {
+			kfree(db);
+			return result;
+		}
+	}
+
+	/* A new block needs space when it's flushed; promise it now. */
+	need = 0;
+	if (diskblock == 0) {
+		need = 1;
+		if (fileblock >= SFS_NDIRECT && sv->sv_i.sfi_indirect == 0 &&
+		    !sv->sv_idreserved) {
+			need++;
+		}
+		result = sfs_reserve(sfs, need);
+		if (result) {
+			kfree(db);
+			return result;
+		}
+	}
+	db->db_reserved = need > 0;
+	if (need > 1) {
+		sv->sv_idreserved = true;
+	}
+
+	if (whole || diskblock == 0) {
+		bzero(db->db_data, sizeof(db->db_data));
+	}
+	else {
+		result = sfs_rblock(sfs, db->db_data, diskblock);
+		if (result) {
+			kfree(db);
+			return result;
+		}
+	}
+
+	db->db_fileblock = fileblock;
+	db->db_dirty = false;
+	sv->sv_dbufs[slot] = db;
+	*ret = db;
+	return 0;
+}
+
+/*
+ * Do I/O to part or all of a block of a regular file through its
+ * buffer. Reads only come here if the block is already buffered.
+ */
+static
+int
+sfs_dataio(struct sfs_vnode *sv, struct uio *uio,
+	   uint32_t skipstart, uint32_t len)
+{
+	uint32_t fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	struct sfs_dbuf *db;
+	int result;
+
+	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
+
+	if (uio->uio_rw == UIO_READ) {
+		db = sfs_dfind(sv, fileblock);
+		KASSERT(db != NULL);
+		return uiomove(db->db_data + skipstart, len, uio);
+	}
+
+	result = sfs_dget(sv, fileblock, len == SFS_BLOCKSIZE, &db);
+	if (result) {
+		return result;
+	}
+	/* Even a failed uiomove may have changed some of it */
+	db->db_dirty = true;
+	return uiomove(db->db_data + skipstart, len, uio);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Inline data
+//
+// A small file or directory keeps its contents in the inode (see
+// <kern/sfs.h>), so reading or writing it costs no I/O beyond the
+// inode itself. Once it would grow past SFS_INLINESIZE its contents
+// are moved to a real first block.
+
+/*
+ * Check if a file's contents are in its inode.
+ */
+static
+bool
+sfs_isinline(struct sfs_vnode *sv)
+{
+	return sv->sv_i.sfi_size <= SFS_INLINESIZE &&
+		sv->sv_i.sfi_direct[0] == 0 &&
+		sv->sv_i.sfi_indirect == 0 &&
+		sfs_dfind(sv, 0) == NULL;
+}
+
+/*
+ * Move a file's inline contents to block 0. For a regular file that's
+ * just its buffer; a directory's block is metadata and is written via
+ * the journal right away.
+ */
+static
+int
+sfs_promote(struct sfs_vnode *sv)
+{
+	static char iobuf[SFS_BLOCKSIZE];
+
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t size = sv->sv_i.sfi_size;
+	struct sfs_dbuf *db;
+	uint32_t diskblock;
+	int result;
+
+	KASSERT(sfs_isinline(sv));
+
+	if (sv->sv_i.sfi_type == SFS_TYPE_FILE) {
+		result = sfs_dget(sv, 0, true, &db);
+		if (result) {
+			return result;
+		}
+		memcpy(db->db_data, sv->sv_i.sfi_inline, size);
+		db->db_dirty = true;
+	}
+	else {
+		result = sfs_bmap(sv, 0, SFS_BMAP_NOCLEAR, &diskblock);
+		if (result) {
+			return result;
+		}
+		bzero(iobuf, sizeof(iobuf));
+		memcpy(iobuf, sv->sv_i.sfi_inline, size);
+		result = sfs_jwrite(sfs, iobuf, diskblock);
+		if (result) {
+			return result;
+		}
+	}
+
+	bzero(sv->sv_i.sfi_inline, sizeof(sv->sv_i.sfi_inline));
+	sv->sv_dirty = true;
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
@@ -330,6 +774,12 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	/* File data that's being written or is buffered goes via the buffer */
+	if (sv->sv_i.sfi_type == SFS_TYPE_FILE &&
+	    (doalloc || sfs_dfind(sv, fileblock) != NULL)) {
+		return sfs_dataio(sv, uio, skipstart, len);
+	}
+
 	/* Get the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
 	if (result) {
@@ -363,10 +813,12 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, write back the modified block. Only
+	 * directories get here; their blocks are metadata and go
+	 * through the journal.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
+		result = sfs_jwrite(sfs, iobuf, diskblock);
 		if (result) {
 			return result;
 		}
@@ -395,6 +847,11 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	if (sv->sv_i.sfi_type == SFS_TYPE_FILE &&
+	    (doalloc || sfs_dfind(sv, fileblock) != NULL)) {
+		return sfs_dataio(sv, uio, 0, SFS_BLOCKSIZE);
+	}
+
 	/* Look up the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
 	if (result) {
@@ -473,6 +930,28 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		}
 	}
 
+	/*
+	 * Use the inline contents if there are any and they'll still
+	 * do; otherwise move them out first.
+	 */
+	if (sfs_isinline(sv)) {
+		if (uio->uio_rw == UIO_READ ||
+		    uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE) {
+			if (uio->uio_rw == UIO_WRITE) {
+				sv->sv_dirty = true;
+			}
+			result = uiomove(sv->sv_i.sfi_inline + uio->uio_offset,
+					 uio->uio_resid, uio);
+			goto out;
+		}
+		if (sv->sv_i.sfi_size > 0) {
+			result = sfs_promote(sv);
+			if (result) {
+				goto out;
+			}
+		}
+	}
+
 	/*
 	 * First, do any leading partial block.
 	 */
@@ -636,6 +1115,379 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+/*
+ * Hashed directories (see <kern/sfs.h>). A plain directory is turned
+ * into a hashed one when it fills its first SFS_DIRHASH_MIN blocks,
+ * and a hashed one is rebuilt with twice the buckets when an insert
+ * finds no room within SFS_DIRPROBE buckets of the name's home. Both
+ * lookup and insert then usually read a single block.
+ */
+#define SFS_DIRHASH_MIN 1
+#define SFS_DIRPROBE    3
+
+/* Most blocks a directory (or any file) can have */
+#define SFS_MAXBLOCKS   (SFS_NDIRECT + SFS_DBPERIDB)
+
+/*
+ * The most buckets a rehash may give SV. Rehashing rewrites every
+ * bucket in one operation, so besides SFS_MAXBLOCKS the limit is
+ * what fits in one journal transaction next to the operation's own
+ * blocks and the indirect block.
+ */
+static
+uint32_t
+sfs_dir_maxbuckets(struct sfs_vnode *sv)
+{
+	uint32_t maxop;
+
+	maxop = sfs_jmaxop(sv->sv_v.vn_fs->fs_data);
+	if (maxop < SFS_JOPBLOCKS + 1 + 2*SFS_DIRHASH_MIN+1) {
+		/* log too small to hash anything in */
+		return 0;
+	}
+	maxop -= SFS_JOPBLOCKS + 1;
+	return maxop < SFS_MAXBLOCKS ? maxop : SFS_MAXBLOCKS;
+}
+
+/*
+ * The number of blocks to pass to sfs_jbegin for an operation that
+ * links or unlinks names in SV (or both, for rename). A link may
+ * rehash, which doubles the buckets (plus one for rounding) and may
+ * allocate the indirect block; an unlink's backward shift writes at
+ * most every bucket once.
+ */
+static
+uint32_t
+sfs_dir_jblocks(struct sfs_vnode *sv)
+{
+	uint32_t nb, n, max;
+
+	nb = sv->sv_i.sfi_dirbuckets;
+	if (nb == 0) {
+		n = DIVROUNDUP(sfs_dir_nentries(sv), SFS_DIRPERBLOCK);
+	}
+	else {
+		n = nb;
+	}
+	n = 2*n + 1;
+	max = sfs_dir_maxbuckets(sv);
+	if (n > max) {
+		n = max;
+	}
+	if (n < nb) {
+		n = nb;
+	}
+	return SFS_JOPBLOCKS + n + 1;
+}
+
+/*
+ * Compute the home bucket of NAME in a directory with NB buckets.
+ */
+static
+uint32_t
+sfs_dir_home(const char *name, uint32_t nb)
+{
+	uint32_t h = SFS_NAMEHASH_INIT;
+
+	for (; *name; name++) {
+		h = SFS_NAMEHASH(h, *name);
+	}
+	return h % nb;
+}
+
+/*
+ * Read block BLOCK of a directory, which is one bucket's entries.
+ */
+static
+int
+sfs_dir_rblock(struct sfs_vnode *sv, uint32_t block, struct sfs_dir *sd)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t diskblock;
+	int result;
+
+	result = sfs_bmap(sv, block, 0, &diskblock);
+	if (result) {
+		return result;
+	}
+	if (diskblock == 0) {
+		bzero(sd, SFS_BLOCKSIZE);
+		return 0;
+	}
+	return sfs_rblock(sfs, sd, diskblock);
+}
+
+/*
+ * Write block BLOCK of a directory, allocating it if need be.
+ */
+static
+int
+sfs_dir_wblock(struct sfs_vnode *sv, uint32_t block, struct sfs_dir *sd)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t diskblock;
+	int result;
+
+	result = sfs_bmap(sv, block, SFS_BMAP_NOCLEAR, &diskblock);
+	if (result) {
+		return result;
+	}
+	return sfs_jwrite(sfs, sd, diskblock);
+}
+
+/*
+ * Return the index of the first free entry in a bucket, or -1 if the
+ * bucket is full.
+ */
+static
+int
+sfs_dir_freeentry(const struct sfs_dir *bucket)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_DIRPERBLOCK; i++) {
+		if (bucket[i].sfd_ino == SFS_NOINO) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * sfs_dir_findname for a hashed directory. If the name isn't found,
+ * EMPTYSLOT gets the slot it should go in (-1 if there's no room) and
+ * PROBES the number of buckets that were looked at.
+ */
+static
+int
+sfs_dir_hfind(struct sfs_vnode *sv, const char *name,
+	      uint32_t *ino, int *slot, int *emptyslot, unsigned *probes)
+{
+	static struct sfs_dir bucket[SFS_DIRPERBLOCK];
+	uint32_t nb = sv->sv_i.sfi_dirbuckets;
+	uint32_t b, k;
+	unsigned i;
+	int freeix, result;
+
+	KASSERT(sizeof(bucket)==SFS_BLOCKSIZE);
+
+	b = sfs_dir_home(name, nb);
+	for (k=0; k<nb; k++) {
+		result = sfs_dir_rblock(sv, b, bucket);
+		if (result) {
+			return result;
+		}
+		for (i=0; i<SFS_DIRPERBLOCK; i++) {
+			if (bucket[i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			bucket[i].sfd_name[sizeof(bucket[i].sfd_name)-1] = 0;
+			if (!strcmp(bucket[i].sfd_name, name)) {
+				if (slot != NULL) {
+					*slot = b*SFS_DIRPERBLOCK + i;
+				}
+				if (ino != NULL) {
+					*ino = bucket[i].sfd_ino;
+				}
+				return 0;
+			}
+		}
+
+		/* A bucket with room ends the search */
+		freeix = sfs_dir_freeentry(bucket);
+		if (freeix >= 0) {
+			if (emptyslot != NULL) {
+				*emptyslot = b*SFS_DIRPERBLOCK + freeix;
+			}
+			if (probes != NULL) {
+				*probes = k+1;
+			}
+			return ENOENT;
+		}
+		b = (b+1) % nb;
+	}
+
+	if (emptyslot != NULL) {
+		*emptyslot = -1;
+	}
+	if (probes != NULL) {
+		*probes = nb;
+	}
+	return ENOENT;
+}
+
+/*
+ * Rebuild a directory as a hash table with at least MINBUCKETS
+ * buckets, and enough that it's no more than half full. The new table
+ * is built in memory, then written over the old blocks (and new ones
+ * after them), so the directory never has to shrink.
+ */
+static
+int
+sfs_dir_rehash(struct sfs_vnode *sv, uint32_t minbuckets)
+{
+	static struct sfs_dir bucket[SFS_DIRPERBLOCK];
+	struct sfs_dir *table, *sd;
+	uint32_t nentries, oldblocks, nb, live, b, i, j;
+	uint32_t diskblock;
+	int freeix, result;
+
+	nentries = sfs_dir_nentries(sv);
+	oldblocks = DIVROUNDUP(nentries, SFS_DIRPERBLOCK);
+
+	/* Count the entries */
+	live = 0;
+	for (b=0; b<oldblocks; b++) {
+		result = sfs_dir_rblock(sv, b, bucket);
+		if (result) {
+			return result;
+		}
+		for (j=0; j<SFS_DIRPERBLOCK && b*SFS_DIRPERBLOCK+j<nentries;
+		     j++) {
+			if (bucket[j].sfd_ino != SFS_NOINO) {
+				live++;
+			}
+		}
+	}
+
+	nb = DIVROUNDUP(2*(live+1), SFS_DIRPERBLOCK);
+	if (nb < minbuckets) {
+		nb = minbuckets;
+	}
+	if (nb < oldblocks) {
+		nb = oldblocks;
+	}
+	if (nb > sfs_dir_maxbuckets(sv)) {
+		nb = sfs_dir_maxbuckets(sv);
+	}
+	if (nb < oldblocks || live+1 > nb*SFS_DIRPERBLOCK) {
+		return ENOSPC;
+	}
+
+	table = kmalloc(nb * SFS_BLOCKSIZE);
+	if (table == NULL) {
+		return ENOMEM;
+	}
+	bzero(table, nb * SFS_BLOCKSIZE);
+
+	/* Put each entry in the first bucket with room from its home */
+	for (b=0; b<oldblocks; b++) {
+		result = sfs_dir_rblock(sv, b, bucket);
+		if (result) {
+			kfree(table);
+			return result;
+		}
+		for (j=0; j<SFS_DIRPERBLOCK && b*SFS_DIRPERBLOCK+j<nentries;
+		     j++) {
+			sd = &bucket[j];
+			if (sd->sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			sd->sfd_name[sizeof(sd->sfd_name)-1] = 0;
+			i = sfs_dir_home(sd->sfd_name, nb);
+			while ((freeix = sfs_dir_freeentry(
+					&table[i*SFS_DIRPERBLOCK])) < 0) {
+				i = (i+1) % nb;
+			}
+			table[i*SFS_DIRPERBLOCK + freeix] = *sd;
+		}
+	}
+
+	/* Allocate any new blocks before overwriting anything */
+	for (b=oldblocks; b<nb; b++) {
+		result = sfs_bmap(sv, b, SFS_BMAP_NOCLEAR, &diskblock);
+		if (result) {
+			kfree(table);
+			return result;
+		}
+	}
+
+	for (b=0; b<nb; b++) {
+		result = sfs_dir_wblock(sv, b, &table[b*SFS_DIRPERBLOCK]);
+		if (result) {
+			kfree(table);
+			return result;
+		}
+	}
+	kfree(table);
+
+	sv->sv_i.sfi_size = nb * SFS_BLOCKSIZE;
+	sv->sv_i.sfi_dirbuckets = nb;
+	sv->sv_dirty = true;
+	return 0;
+}
+
+/*
+ * Remove the entry in slot SLOT of a hashed directory. If its bucket
+ * was full, entries further on may have been put past it only because
+ * it was; move the first such entry back into the hole, which leaves
+ * a hole in its bucket in turn, and repeat.
+ */
+static
+int
+sfs_dir_hunlink(struct sfs_vnode *sv, int slot)
+{
+	static struct sfs_dir bucket[SFS_DIRPERBLOCK];
+	static struct sfs_dir next[SFS_DIRPERBLOCK];
+	uint32_t nb = sv->sv_i.sfi_dirbuckets;
+	uint32_t b, k, home;
+	unsigned hole, i;
+	bool wasfull, moved;
+	int result;
+
+	b = slot / SFS_DIRPERBLOCK;
+	hole = slot % SFS_DIRPERBLOCK;
+	result = sfs_dir_rblock(sv, b, bucket);
+	if (result) {
+		return result;
+	}
+	wasfull = sfs_dir_freeentry(bucket) < 0;
+	bzero(&bucket[hole], sizeof(bucket[hole]));
+
+	while (wasfull) {
+		/* Look for an entry whose path from home crosses bucket b */
+		moved = false;
+		for (k=(b+1)%nb; k!=b && !moved; k=(k+1)%nb) {
+			result = sfs_dir_rblock(sv, k, next);
+			if (result) {
+				return result;
+			}
+			wasfull = sfs_dir_freeentry(next) < 0;
+			for (i=0; i<SFS_DIRPERBLOCK; i++) {
+				if (next[i].sfd_ino == SFS_NOINO) {
+					continue;
+				}
+				next[i].sfd_name[sizeof(next[i].sfd_name)-1] = 0;
+				home = sfs_dir_home(next[i].sfd_name, nb);
+				if ((b+nb-home) % nb < (k+nb-home) % nb) {
+					break;
+				}
+			}
+			if (i < SFS_DIRPERBLOCK) {
+				bucket[hole] = next[i];
+				result = sfs_dir_wblock(sv, b, bucket);
+				if (result) {
+					return result;
+				}
+				bzero(&next[i], sizeof(next[i]));
+				memcpy(bucket, next, sizeof(bucket));
+				b = k;
+				hole = i;
+				moved = true;
+			}
+			else if (!wasfull) {
+				/* Nothing past a bucket with room depends on b */
+				break;
+			}
+		}
+		if (!moved) {
+			break;
+		}
+	}
+
+	return sfs_dir_wblock(sv, b, bucket);
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -652,6 +1504,10 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	int nentries = sfs_dir_nentries(sv);
 	int i, result;
 
+	if (sv->sv_i.sfi_dirbuckets != 0) {
+		return sfs_dir_hfind(sv, name, ino, slot, emptyslot, NULL);
+	}
+
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
 
@@ -697,11 +1553,19 @@ int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
 	int emptyslot = -1;
+	uint32_t nb = sv->sv_i.sfi_dirbuckets;
+	unsigned probes = 0;
 	int result;
 	struct sfs_dir sd;
 
 	/* Look up the name. We want to make sure it *doesn't* exist. */
-	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
+	if (nb != 0) {
+		result = sfs_dir_hfind(sv, name, NULL, NULL, &emptyslot,
+				       &probes);
+	}
+	else {
+		result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
+	}
 	if (result!=0 && result!=ENOENT) {
 		return result;
 	}
@@ -713,8 +1577,42 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
+	/*
+	 * Hash a plain directory that's about to grow past its first
+	 * blocks, or rebuild a hashed one that's getting crowded. If
+	 * that fails, the old slot is still good if there was one.
+	 */
+	result = 0;
+	if (nb == 0 && emptyslot < 0 &&
+	    (unsigned)sfs_dir_nentries(sv) >=
+	    SFS_DIRHASH_MIN*SFS_DIRPERBLOCK &&
+	    DIVROUNDUP(sfs_dir_nentries(sv), SFS_DIRPERBLOCK) <
+	    sfs_dir_maxbuckets(sv)) {
+		result = sfs_dir_rehash(sv, 0);
+	}
+	else if (nb != 0 && nb < sfs_dir_maxbuckets(sv) &&
+		 (emptyslot < 0 || probes > SFS_DIRPROBE)) {
+		result = sfs_dir_rehash(sv, 2*nb);
+	}
+	if (result == 0 && sv->sv_i.sfi_dirbuckets != nb) {
+		nb = sv->sv_i.sfi_dirbuckets;
+		result = sfs_dir_hfind(sv, name, NULL, NULL, &emptyslot,
+				       NULL);
+		KASSERT(result != 0);
+		if (result != ENOENT) {
+			return result;
+		}
+	}
+	else if (result != 0 && emptyslot < 0) {
+		return result;
+	}
+
 	/* If we didn't get an empty slot, add the entry at the end. */
 	if (emptyslot < 0) {
+		if (nb != 0) {
+			/* Hashed, at its largest, and full */
+			return ENOSPC;
+		}
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -742,6 +1640,10 @@ sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_dir sd;
 
+	if (sv->sv_i.sfi_dirbuckets != 0) {
+		return sfs_dir_hunlink(sv, slot);
+	}
+
 	/* Initialize a suitable directory entry... */ 
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
@@ -801,7 +1703,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, &ino, true);
 	if (result) {
 		return result;
 	}
@@ -900,25 +1802,39 @@ sfs_reclaim(struct vnode *v)
 	 * decision was made to reclaim it. (You must also synchronize
 	 * this with sfs_loadvnode.)
 	 */
+	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
 
 		/* consume the reference VOP_DECREF gave us */
 		KASSERT(v->vn_refcount>1);
 		v->vn_refcount--;
 
+		spinlock_release(&v->vn_countlock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	spinlock_release(&v->vn_countlock);
 
-	/* If there are no on-disk references to the file either, erase it. */
+	/*
+	 * If there are no on-disk references to the file either, erase it.
+	 * (Not through VOP_TRUNCATE; we may be inside another operation,
+	 * which mustn't be split across journal commits.)
+	 */
 	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+		result = sfs_itrunc(sv, 0);
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
 	}
 
+	/* Write out buffered data; this may allocate blocks */
+	result = sfs_flushdata(sv);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
@@ -953,6 +1869,11 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
+	for (i=0; i<SFS_NDBUFS; i++) {
+		if (sv->sv_dbufs[i] != NULL) {
+			kfree(sv->sv_dbufs[i]);
+		}
+	}
 	kfree(sv);
 
 	/* Done */
@@ -991,7 +1912,11 @@ sfs_write(struct vnode *v, struct uio *uio)
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
 	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
+	/* Flushing buffers mid-write allocates blocks, so it's metadata too */
+	result = sfs_jbegin(sv->sv_v.vn_fs->fs_data, SFS_JOPBLOCKS);
+	if (result == 0) {
+		result = sfs_io(sv, uio);
+	}
 	vfs_biglock_release();
 
 	return result;
@@ -1100,32 +2025,43 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
+	if (sfs->sfs_journal != NULL) {
+		/* Commit everything pending; it's one sequential write. */
+		result = sfs_jcommit(sfs);
+	}
+	else {
+		result = sfs_flushdata(sv);
+		if (result == 0) {
+			result = sfs_sync_inode(sv);
+		}
+	}
 	vfs_biglock_release();
 
 	return result;
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Regular files can be mapped; the VM system
+ * moves pages in and out with VOP_READ and VOP_WRITE.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Truncate a file. Used by sfs_truncate and sfs_reclaim.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
 	/*
 	 * I/O buffer for handling the indirect block.
@@ -1136,7 +2072,6 @@ sfs_truncate(struct vnode *v, off_t len)
 	 */
 	static uint32_t idbuf[SFS_DBPERIDB];
 
-	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
@@ -1151,6 +2086,27 @@ sfs_truncate(struct vnode *v, off_t len)
 
 	vfs_biglock_acquire();
 
+	/*
+	 * Inline contents that won't fit any more are moved out;
+	 * otherwise clear whatever is past the new end, so it reads
+	 * back as zeros if the file grows again.
+	 */
+	if (sfs_isinline(sv)) {
+		if (len > SFS_INLINESIZE && sv->sv_i.sfi_size > 0) {
+			result = sfs_promote(sv);
+			if (result) {
+				vfs_biglock_release();
+				return result;
+			}
+		}
+		else if (len < SFS_INLINESIZE) {
+			bzero(sv->sv_i.sfi_inline + len, SFS_INLINESIZE - len);
+		}
+	}
+
+	/* Buffered data past the new end is never written. */
+	sfs_dtrunc(sv, len);
+
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -1206,7 +2162,7 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 		else if (iddirty) {
 			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
+			result = sfs_jwrite(sfs, idbuf, idblock);
 			if (result) {
 				vfs_biglock_release();
 				return result;
@@ -1224,6 +2180,27 @@ sfs_truncate(struct vnode *v, off_t len)
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	vfs_biglock_acquire();
+	result = sfs_jbegin(sfs, SFS_JOPBLOCKS);
+	if (result == 0) {
+		result = sfs_itrunc(sv, len);
+	}
+	vfs_biglock_release();
+
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1261,6 +2238,12 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 
 	vfs_biglock_acquire();
 
+	result = sfs_jbegin(sfs, sfs_dir_jblocks(sv));
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
@@ -1333,6 +2316,12 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	vfs_biglock_acquire();
 
+	result = sfs_jbegin(dir->vn_fs->fs_data, sfs_dir_jblocks(sv));
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Just create a link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
@@ -1362,6 +2351,12 @@ sfs_remove(struct vnode *dir, const char *name)
 
 	vfs_biglock_acquire();
 
+	result = sfs_jbegin(dir->vn_fs->fs_data, sfs_dir_jblocks(sv));
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
@@ -1406,6 +2401,13 @@ sfs_rename(struct vnode *d1, const char *n1,
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	/* both names are in SV, so its blocks only count once */
+	result = sfs_jbegin(d1->vn_fs->fs_data, sfs_dir_jblocks(sv));
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
@@ -1433,8 +2435,14 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
 
-	/* Unlink the old slot */
-	result = sfs_dir_unlink(sv, slot1);
+	/*
+	 * Unlink the old slot. Adding the new name may have moved it
+	 * (if the directory was rehashed), so look it up again.
+	 */
+	result = sfs_dir_findname(sv, n1, NULL, &slot1, NULL);
+	if (result == 0) {
+		result = sfs_dir_unlink(sv, slot1);
+	}
 	if (result) {
 		goto puke_harder;
 	}
@@ -1457,7 +2465,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/*
 	 * Error recovery: try to undo what we already did
 	 */
-	result2 = sfs_dir_unlink(sv, slot2);
+	result2 = sfs_dir_findname(sv, n2, NULL, &slot2, NULL);
+	if (result2 == 0) {
+		result2 = sfs_dir_unlink(sv, slot2);
+	}
 	if (result2) {
 		kprintf("sfs: rename: %s\n", strerror(result));
 		kprintf("sfs: rename: while cleaning up: %s\n", 
@@ -1742,6 +2753,10 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	for (i=0; i<SFS_NDBUFS; i++) {
+		sv->sv_dbufs[i] = NULL;
+	}
+	sv->sv_idreserved = false;
 
 	/* Add it to our table */
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
@@ -38,6 +38,10 @@
 #include <vm.h>
 
 struct vnode;
+struct mmapping;
+
+/* under dumbvm, at most this many extra user threads per address space */
+#define DUMBVM_MAXTHREADS 8
 
 
 /* 
@@ -51,11 +55,15 @@ struct addrspace {
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
   size_t as_npages1;
+  bool as_writeable1;
   vaddr_t as_vbase2;
   paddr_t as_pbase2;
   size_t as_npages2;
+  bool as_writeable2;
   paddr_t as_stackpbase;
+  paddr_t as_threadstackpbase[DUMBVM_MAXTHREADS]; // 0 if slot unused
   bool loadedElf;
+  struct mmapping *as_mmaps; // file mappings, see mmap.h
 };
 
 /*
@@ -83,6 +91,11 @@ struct addrspace {
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_define_text - set up a read-only region backed directly by
+ *                the executable, whose pages are shared with every
+ *                other process running the same file. Nothing needs
+ *                to be loaded into it.
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
@@ -92,6 +105,17 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_thread_stack - set up a stack for an additional user
+ *                thread. Hands back the slot it was placed in (for
+ *                as_release_thread_stack) and its initial stack pointer.
+ *
+ *    as_release_thread_stack - free a stack from as_define_thread_stack
+ *                and shoot down any TLB mappings for it.
+ *
+ *    as_overlaps - check whether a range of addresses intersects a
+ *                region or the stack area, for placing mappings at
+ *                a fixed address.
  */
 
 struct addrspace *as_create(void);
@@ -105,9 +129,16 @@ int               as_define_region(struct addrspace *as,
                                    int readable, 
                                    int writeable,
                                    int executable);
+int               as_define_text(struct addrspace *as, struct vnode *v,
+                                 off_t offset, vaddr_t vaddr, size_t sz);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_thread_stack(struct addrspace *as, int *slot,
+                                         vaddr_t *initstackptr);
+void              as_release_thread_stack(struct addrspace *as, int slot);
+bool              as_overlaps(struct addrspace *as, vaddr_t vaddr,
+                              size_t len);
 
 
 /*
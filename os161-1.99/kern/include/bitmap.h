@@ -38,9 +38,15 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      Searches start where the last allocation ended.
+ *     bitmap_alloc_run - locate N cleared bits in a row, set them, and
+ *                      return the index of the first.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
+ *     bitmap_rescan  - recompute internal state after the raw bit data
+ *                      has been changed through bitmap_getdata (e.g.
+ *                      loaded from disk).
  *     bitmap_destroy - destroy bitmap.
  */
 
@@ -50,9 +56,11 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_run(struct bitmap *, unsigned n, unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
 int            bitmap_isset(struct bitmap *, unsigned index);
+void           bitmap_rescan(struct bitmap *);
 void           bitmap_destroy(struct bitmap *);
 
 
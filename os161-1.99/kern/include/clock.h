@@ -35,15 +35,30 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, only when the
+ * CPU is not idle, for scheduling. hardclock_stop() and
+ * hardclock_start() turn it off and on again for the current CPU
+ * around idling; they are machine-dependent.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * Timers call a function at a given time of day, in nanoseconds (see
+ * gettime_nsecs). timer_start queues one (it may fail with ENOMEM),
+ * and timer_stop takes it off the queue again, returning false if it
+ * had already gone off or was never started. The function is called
+ * from an interrupt handler, so it must not sleep. A timer may be
+ * started again once it has gone off or been stopped.
  *
- * gettime() may be used to fetch the current time of day.
+ * timerclock() is called by the hardware timer driver when the
+ * one-shot timer it attached with timerclock_attach() goes off.
+ *
+ * gettime() may be used to fetch the current time of day, and
+ * gettime_nsecs() fetches it as one number.
  * getinterval() computes the time from time1 to time2.
  *
+ * getcycles() returns a count of cycles on the current CPU, for
+ * timing short things cheaply. It is monotonic on each CPU but the
+ * CPUs' counts are only roughly in step. getcyclerate() returns the
+ * number of cycles per second. Both are machine-dependent.
+ *
  * XXX we have struct timespec now, let's use it.
  */
 
@@ -59,19 +74,44 @@
 void hardclock_bootstrap(void);
 
 void hardclock(void);
+void hardclock_stop(void);
+void hardclock_start(void);
+
+struct timer {
+	uint64_t tm_when;		/* when to go off */
+	unsigned tm_index;		/* position in the timer heap */
+	struct timer *tm_next;		/* for timerclock's list of due timers */
+	void (*tm_func)(void *);	/* what to call */
+	void *tm_arg;			/* argument to tm_func */
+};
+
+void timer_init(struct timer *t, void (*func)(void *), void *arg);
+int timer_start(struct timer *t, uint64_t when);
+bool timer_stop(struct timer *t);
+
 void timerclock(void);
+void timerclock_attach(void *dev, void (*arm)(void *dev, uint32_t usecs));
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
+uint64_t gettime_nsecs(void);
 
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
 
+uint64_t getcycles(void);
+uint32_t getcyclerate(void);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocknanosleep() sleeps for a number of nanoseconds, to the
+ * resolution of the hardware timer; it may fail with ENOMEM, or with
+ * EINTR if the process is exiting, in which case the time that was
+ * left goes in *REMAINING unless that's NULL.
  */
 void clocksleep(int seconds);
+int clocknanosleep(uint64_t nsecs, uint64_t *remaining);
 
 
 #endif /* _CLOCK_H_ */
@@ -59,8 +59,17 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Exited threads kept for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 
+	/*
+	 * Written only by this cpu; read from any cpu when the
+	 * tracing, statistics, or profiling code goes over all cpus.
+	 */
+	struct tracebuf *c_trace;	/* Event trace ring */
+	struct syscallstats *c_syscallstats; /* System call statistics */
+	struct profbuf *c_prof;		/* Profiler histograms */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -82,10 +91,16 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_sent counts shootdowns queued for this cpu and
+	 * c_shootdown_done how many of those it has carried out, so a
+	 * sender can wait for its own.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_sent;
+	unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -109,6 +124,12 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of cpus, and cpu number N (0 through cpu_count() - 1).
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned n);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -152,6 +173,11 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends it to all CPUs except the current one,
+ * and then waits until they have all done it, so that the caller can
+ * free the page afterwards. It spins with interrupts on, answering
+ * shootdowns sent to this CPU meanwhile; don't call it holding a
+ * spinlock.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +192,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
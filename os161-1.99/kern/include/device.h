@@ -37,14 +37,34 @@
 
 struct uio;  /* in <uio.h> */
 
+/*
+ * Asynchronous I/O request. The uio must be in kernel space; the
+ * device moves the data itself as each part of the transfer finishes.
+ * When the whole request is done, or has failed, dr_done is called
+ * from the device's interrupt handler, so it must not sleep.
+ *
+ * Several requests may be submitted at once by chaining them through
+ * dr_next. The device runs them in order, starting each one as soon
+ * as the one before it finishes.
+ */
+struct devreq {
+	struct uio *dr_uio;			/* what to transfer */
+	void (*dr_done)(struct devreq *, int result);
+	void *dr_data;				/* for dr_done */
+	struct devreq *dr_next;			/* next in batch or queue */
+};
+
 /*
  * Filesystem-namespace-accessible device.
  * d_io is for both reads and writes; the uio indicates the direction.
+ * d_submit queues a chain of requests and returns without waiting;
+ * it is NULL for devices that only do synchronous I/O.
  */
 struct device {
 	int (*d_open)(struct device *, int flags_from_open);
 	int (*d_close)(struct device *);
 	int (*d_io)(struct device *, struct uio *);
+	int (*d_submit)(struct device *, struct devreq *);
 	int (*d_ioctl)(struct device *, int op, userptr_t data);
 
 	blkcnt_t d_blocks;
@@ -58,6 +78,9 @@ struct device {
 /* Create vnode for a vfs-level device. */
 struct vnode *dev_create_vnode(struct device *dev);
 
+/* d_io for devices with d_submit: submit the request and wait for it. */
+int dev_syncio(struct device *dev, struct uio *uio);
+
 
 /* Initialization functions for builtin vfs-level devices. */
 void devnull_create(void);
@@ -45,6 +45,8 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	off_t ev_size;			/* cached file size... */
+	unsigned ev_sizegen;		/* ...good if this is ef_sizegen */
 };
 
 struct emufs_fs {
@@ -52,6 +54,7 @@ struct emufs_fs {
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	unsigned ef_sizegen;		/* bumped on every write/truncate */
 };
 
 
@@ -0,0 +1,39 @@
+/*
+ * Epoch-based deferred freeing, for tables that are searched without
+ * taking a lock.
+ *
+ * A reader brackets its lookup, and its use of whatever it found, with
+ * epoch_enter() and epoch_exit(). A read section runs with interrupts
+ * off, like holding a spinlock, so it must be short and must not
+ * sleep. Read sections nest.
+ *
+ * A writer first unpublishes an object (e.g. clears its table slot,
+ * under whatever lock serializes writers) and then passes it to
+ * epoch_defer(), which calls FUNC(ARG) from a kernel thread once every
+ * reader that might still see the object has left its read section.
+ * The epoch_cb is normally embedded in the object being freed.
+ * epoch_synchronize() waits for that point directly.
+ *
+ * Since a cpu can't take a timer interrupt inside a read section, the
+ * wait is over once every cpu has had a hardclock() since it started,
+ * or has been idle.
+ */
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+struct epoch_cb {
+	struct epoch_cb *ec_next;
+	void (*ec_func)(void *);
+	void *ec_arg;
+};
+
+void epoch_bootstrap(void);
+
+void epoch_enter(void);
+void epoch_exit(void);
+
+void epoch_synchronize(void);
+void epoch_defer(struct epoch_cb *cb, void (*func)(void *), void *arg);
+
+#endif /* _EPOCH_H_ */
@@ -0,0 +1,18 @@
+/*
+ * Flags for mmap(). Shared with userland through <unistd.h>.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/* Protection (the prot argument) */
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+/* Mapping type (the flags argument); exactly one must be given */
+#define MAP_SHARED    1      /* Writes go back to the file */
+#define MAP_PRIVATE   2      /* Writes are private to the process */
+
+#endif /* _KERN_MMAN_H_ */
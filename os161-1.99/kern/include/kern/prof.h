@@ -0,0 +1,27 @@
+/*
+ * Format of kernel profile dumps. Shared with the profsym tool.
+ *
+ * A dump is a struct prof_header, then ph_nkbuckets sample counts for
+ * kernel text starting at ph_kbase, then ph_nubuckets counts for user
+ * text starting at ph_ubase. Each count (a uint32_t) covers
+ * 2^ph_shift bytes of code. Everything is in the kernel's byte order
+ * (big-endian on MIPS).
+ */
+
+#ifndef _KERN_PROF_H_
+#define _KERN_PROF_H_
+
+#define PROF_MAGIC  0x9f0f0001
+
+struct prof_header {
+	uint32_t ph_magic;		/* PROF_MAGIC */
+	uint32_t ph_hz;			/* samples per second per cpu */
+	uint32_t ph_shift;		/* log2 of bytes per bucket */
+	uint32_t ph_kbase;		/* address of first kernel bucket */
+	uint32_t ph_nkbuckets;		/* number of kernel buckets */
+	uint32_t ph_ubase;		/* address of first user bucket */
+	uint32_t ph_nubuckets;		/* number of user buckets */
+	uint32_t ph_other;		/* samples outside both ranges */
+};
+
+#endif /* _KERN_PROF_H_ */
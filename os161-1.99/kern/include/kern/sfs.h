@@ -71,21 +71,33 @@ struct sfs_super {
 	uint32_t sp_magic;		/* Magic number, should be SFS_MAGIC */
 	uint32_t sp_nblocks;			/* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];
+	uint32_t sp_journalstart;		/* First block of journal */
+	uint32_t sp_journalblocks;		/* Journal size; 0 for none */
+	uint32_t reserved[116];
 };
 
 /*
  * On-disk inode
  */
+#define SFS_INLINESIZE (4*(128-4-SFS_NDIRECT))
+
 struct sfs_inode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
 	uint16_t sfi_type;			/* One of SFS_TYPE_* above */
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dirbuckets;		/* Hashed dirs: # of buckets */
+	char sfi_inline[SFS_INLINESIZE];	/* Small files' contents */
 };
 
+/*
+ * A file or directory no bigger than SFS_INLINESIZE that has no data
+ * blocks keeps its contents in sfi_inline instead. Anything else must
+ * leave sfi_inline zeroed. (Older volumes always zeroed this space,
+ * which reads the same as a small file that was never written.)
+ */
+
 /*
  * On-disk directory entry
  */
@@ -94,5 +106,66 @@ struct sfs_dir {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * A directory with sfi_dirbuckets zero is a plain array of entries,
+ * searched from the start. Otherwise it is a hash table of that many
+ * buckets, each one block of entries, and its size is exactly that
+ * many blocks. An entry's home bucket is SFS_NAMEHASH of its name
+ * modulo the number of buckets; if that's full it goes in the next
+ * bucket with room (wrapping around), so every bucket from its home
+ * up to the one it's in is full. A lookup stops at the first bucket
+ * that isn't. The entries themselves are the same as in a plain
+ * directory, so a hashed directory read as a plain one is still
+ * correct.
+ */
+#define SFS_DIRPERBLOCK   (SFS_BLOCKSIZE / sizeof(struct sfs_dir))
+
+/* Hash a name one character at a time (32-bit FNV-1a) */
+#define SFS_NAMEHASH_INIT 2166136261U
+#define SFS_NAMEHASH(h, c) (((h) ^ (unsigned char)(c)) * 16777619U)
+
+/*
+ * Metadata journal. If sp_journalblocks is nonzero, that many blocks
+ * starting at sp_journalstart hold a write-ahead log of metadata
+ * (inode, bitmap, directory, and indirect blocks). The first block is
+ * a header; the log proper starts right after it and is appended to
+ * from its beginning until the next checkpoint.
+ *
+ * A transaction is one or more descriptors, each followed by the
+ * images of the blocks it lists, and then a commit record. jc_sum is
+ * SFS_JSUM over every descriptor and image of the transaction.
+ * Transactions are numbered consecutively from jh_seq; replay stops
+ * at the first record that isn't the next one in sequence or whose
+ * checksum doesn't match.
+ */
+#define SFS_JMAGIC_HEADER 0x4a686472    /* "Jhdr" */
+#define SFS_JMAGIC_DESC   0x4a647363    /* "Jdsc" */
+#define SFS_JMAGIC_COMMIT 0x4a636d74    /* "Jcmt" */
+#define SFS_JDESC_MAX     125           /* block numbers per descriptor */
+
+/* Add a 32-bit word into a journal checksum */
+#define SFS_JSUM(sum, word) ((((sum) << 1) | ((sum) >> 31)) + (word))
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JMAGIC_HEADER */
+	uint32_t jh_seq;			/* first transaction in log */
+	uint32_t reserved[126];
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JMAGIC_DESC */
+	uint32_t jd_seq;			/* transaction number */
+	uint32_t jd_count;			/* number of blocks listed */
+	uint32_t jd_blocks[SFS_JDESC_MAX];	/* where they belong */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;			/* SFS_JMAGIC_COMMIT */
+	uint32_t jc_seq;			/* transaction number */
+	uint32_t jc_nblocks;			/* log blocks before this one */
+	uint32_t jc_sum;			/* checksum of those blocks */
+	uint32_t reserved[124];
+};
+
 
 #endif /* _KERN_SFS_H_ */
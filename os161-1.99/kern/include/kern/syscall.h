@@ -197,6 +197,14 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- OS/161-specific --
+#define SYS___threadfork 121
+#define SYS___threadexit 122
+#define SYS___futexwait  123
+#define SYS___futexwake  124
+#define SYS_msync        125
+#define SYS___syscallstats 126
+
 /*CALLEND*/
 
 
@@ -0,0 +1,25 @@
+/*
+ * System call statistics, as returned by __syscallstats(). Shared
+ * with userland through <unistd.h>.
+ */
+
+#ifndef _KERN_SYSCALLSTATS_H_
+#define _KERN_SYSCALLSTATS_H_
+
+/* Statistics are kept for call numbers below this */
+#define SYSSTAT_NCALLS    128
+
+/*
+ * Latency histogram buckets. A call taking c cycles is counted in
+ * bucket floor(log2(c)), or bucket 0 if c is 0; the last bucket also
+ * counts everything longer.
+ */
+#define SYSSTAT_NBUCKETS  24
+
+struct syscallstat {
+	__u32 ss_count;				/* number of calls */
+	__u64 ss_cycles;			/* total cycles in those that returned */
+	__u32 ss_buckets[SYSSTAT_NBUCKETS];	/* their latency histogram */
+};
+
+#endif /* _KERN_SYSCALLSTATS_H_ */
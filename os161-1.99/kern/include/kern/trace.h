@@ -0,0 +1,48 @@
+/*
+ * Format of kernel trace dumps. Shared with the tracedecode tool.
+ *
+ * A dump is a struct trace_header followed by th_nrecords records.
+ * Each cpu's records are in time order, one cpu after another; the
+ * decoder merges them. Everything is in the kernel's byte order
+ * (big-endian on MIPS).
+ */
+
+#ifndef _KERN_TRACE_H_
+#define _KERN_TRACE_H_
+
+#define TRACE_MAGIC  0x7ace0001
+
+struct trace_header {
+	uint32_t th_magic;		/* TRACE_MAGIC */
+	uint32_t th_cyclerate;		/* cycle counter ticks per second */
+	uint32_t th_ncpus;		/* number of cpus traced */
+	uint32_t th_nrecords;		/* number of records following */
+};
+
+/*
+ * One event. tr_thread is the address of the thread that was running,
+ * which is enough to tell threads apart. What the arguments mean
+ * depends on the event type.
+ */
+struct trace_record {
+	uint32_t tr_cyclehi;		/* timestamp, high word */
+	uint32_t tr_cyclelo;		/* timestamp, low word */
+	uint32_t tr_thread;		/* current thread */
+	uint16_t tr_type;		/* TRACE_* */
+	uint16_t tr_cpu;		/* cpu number */
+	uint32_t tr_arg1;
+	uint32_t tr_arg2;
+};
+
+/* Event types                     arg1           arg2          */
+#define TRACE_SWITCH     1      /* new thread     old state     */
+#define TRACE_SLEEP      2      /* wchan          -             */
+#define TRACE_WAKE       3      /* wchan          woken thread  */
+#define TRACE_VMFAULT    4      /* fault address  fault type    */
+#define TRACE_SYSCALL    5      /* call number    -             */
+#define TRACE_SYSRET     6      /* call number    error         */
+#define TRACE_DISKREAD   7      /* sector         disk unit     */
+#define TRACE_DISKWRITE  8      /* sector         disk unit     */
+#define TRACE_DISKDONE   9      /* error          disk unit     */
+
+#endif /* _KERN_TRACE_H_ */
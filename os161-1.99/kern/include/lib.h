@@ -157,8 +157,11 @@ const char *strerror(int errcode);
  * putch_prepare and putch_complete should be called around a series
  * of putch() calls, if printing in polling mode is a possibility.
  * kprintf does this.
+ *
+ * putchars is like calling putch on each of LEN chars, but cheaper.
  */
 void putch(int ch);
+void putchars(const char *buf, size_t len);
 void putch_prepare(void);
 void putch_complete(void);
 int getch(void);
@@ -0,0 +1,54 @@
+/*
+ * File mappings for mmap(), used by dumbvm.
+ *
+ * Each address space has a list of mappings in the region between
+ * MMAP_BASE and MMAP_TOP. Pages are brought in on first touch from
+ * vm_fault. Pages of MAP_SHARED mappings live in a page cache keyed on
+ * (vnode, offset), so every mapping of the same file page shares one
+ * frame, and dirty pages are written back by msync and when the last
+ * mapping of them goes away. read() and write() use the same cached
+ * pages, so they agree with shared mappings. MAP_PRIVATE pages are
+ * private copies.
+ */
+
+#ifndef _MMAP_H_
+#define _MMAP_H_
+
+struct addrspace;
+struct vnode;
+struct uio;
+
+/*
+ * mmap() places mappings in this range of user addresses. Program
+ * text mapped by mmap_text goes wherever the executable says.
+ */
+#define MMAP_BASE 0x50000000
+#define MMAP_TOP  0x70000000
+
+int mmap_map(struct addrspace *as, struct vnode *vn, off_t offset,
+             size_t len, int prot, int flags, vaddr_t *ret);
+int mmap_text(struct addrspace *as, struct vnode *vn, off_t offset,
+              vaddr_t vaddr, size_t len);
+int mmap_unmap(struct addrspace *as, vaddr_t addr, size_t len);
+int mmap_sync(struct addrspace *as, vaddr_t addr, size_t len);
+
+/*
+ * Hooks for the VM system. mmap_fault finds the frame for a faulting
+ * address in a mapping and calls TLBLOAD with it and whether it may
+ * be mapped writable; it returns EFAULT if the address isn't mapped
+ * or the access isn't allowed. TLBLOAD is called under a spinlock
+ * that munmap also takes before its TLB shootdown, so an entry can't
+ * be loaded for a page that is already on its way out.
+ */
+int mmap_fault(struct addrspace *as, vaddr_t va, int faulttype,
+               void (*tlbload)(vaddr_t va, paddr_t pa, bool writable));
+int mmap_copy(struct addrspace *old, struct addrspace *new);
+void mmap_destroy(struct addrspace *as);
+
+/*
+ * Hook for read() and write() on seekable files; use instead of
+ * VOP_READ/WRITE. Devices and pipes can't be mapped and don't need it.
+ */
+int mmap_fileio(struct vnode *vn, struct uio *uio);
+
+#endif /* _MMAP_H_ */
@@ -0,0 +1,41 @@
+/*
+ * Open files.
+ *
+ * Each open() or pipe() end makes one of these, and descriptors point
+ * at them. Descriptors copied by fork share the open file, and with
+ * it the seek position, as in Unix. The vnode stays open until the
+ * last descriptor referring to it is closed.
+ */
+
+#ifndef _OPENFILE_H_
+#define _OPENFILE_H_
+
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_flags;			/* open flags: access mode, O_APPEND */
+	bool of_seekable;		/* false for the console and pipes */
+	struct lock *of_lock;		/* held across I/O on seekable files */
+	off_t of_offset;		/* seek position; of_lock protects it */
+	struct spinlock of_reflock;	/* protects of_refcount */
+	unsigned of_refcount;		/* descriptors referring to this */
+};
+
+/*
+ * Wrap a vnode that has already been opened (by vfs_open, or with
+ * VOP_INCOPEN). On success the open file owns that open; on failure
+ * it is still the caller's.
+ */
+int openfile_create(struct vnode *vn, int flags, struct openfile **ret);
+
+/* vfs_open and openfile_create together. Destroys PATH, like vfs_open. */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+#endif /* _OPENFILE_H_ */
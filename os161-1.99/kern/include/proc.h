@@ -36,11 +36,14 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <limits.h>
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <epoch.h>
 
 struct addrspace;
 struct vnode;
+struct openfile;
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -59,25 +62,22 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
-#ifdef UW
-  /* a vnode to refer to the console device */
-  /* this is a quick-and-dirty way to get console writes working */
-  /* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-  struct vnode *console;                /* a vnode for the console device */
-#endif
-
 	/* add more material here as needed */
   pid_t pid; // process id
   pid_t parentPid; // potential parent process id
   int exitCode; // process's exit status if it called _exit
   struct semaphore *procSem; // process semaphore for waitpid
   struct wchan *procWchan; // wait channel for children processes to sleep on and delay destruction
+  bool p_exiting; // set by _exit or a fatal fault; the threads are on their way out; p_lock
+  bool vforkBorrowed; // true while running on the vfork parent's address space
+  struct semaphore *vforkSem; // vfork parent sleeps here until we exec or exit
+  struct openfile *fdTable[OPEN_MAX]; // open files by descriptor, NULL if unused; p_lock
+  struct epoch_cb p_epoch; // for freeing after lock-free lookups are done
 };
 
 struct proc * getProc(pid_t pid);
 void setProcToNull(pid_t pid);
+void waitForParent(pid_t parentPid);
 
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
@@ -102,6 +102,31 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Detach a thread from its process, unless it's the only one left. */
+bool proc_remthread_unlesslast(struct thread *t);
+
+/* Give TO references to all of FROM's open files, closing TO's own. */
+void proc_copyfds(struct proc *from, struct proc *to);
+
+/* Look up descriptor FD and return a reference to it, or NULL. */
+struct openfile *proc_getfile(struct proc *proc, int fd);
+
+/* Put OF in PROC's lowest free descriptor. Returns it, or -1 if full. */
+int proc_addfile(struct proc *proc, struct openfile *of);
+
+/* Put OF0 and OF1 in the two lowest free descriptors, or -1 if full. */
+int proc_addfilepair(struct proc *proc, struct openfile *of0,
+                     struct openfile *of1, int fds[2]);
+
+/* Empty descriptor FD and return what was there (NULL if nothing). */
+struct openfile *proc_removefile(struct proc *proc, int fd);
+
+/* Empty descriptor FD if it still holds OF. Returns true if it did. */
+bool proc_removefileif(struct proc *proc, int fd, struct openfile *of);
+
+/* Close all of a process's open files. */
+void proc_closefds(struct proc *proc);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
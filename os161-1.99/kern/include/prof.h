@@ -0,0 +1,28 @@
+/*
+ * Statistical kernel profiler.
+ *
+ * While profiling is on, every timer interrupt counts the interrupted
+ * PC in a per-cpu histogram, with one count for every few instructions
+ * of kernel text and of user text near the standard load address.
+ * Samples anywhere else are just counted.
+ *
+ * prof_start allocates the histograms (the first time), clears them
+ * and turns profiling on; prof_stop turns it off. prof_dump stops
+ * profiling and writes the histograms, added up over all cpus, to a
+ * file in the format of <kern/prof.h> for profsym to read.
+ */
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <kern/prof.h>
+
+struct profbuf;
+
+struct profbuf *profbuf_create(void);
+void prof_sample(vaddr_t pc);
+int prof_start(void);
+void prof_stop(void);
+int prof_dump(const char *path);
+
+#endif /* _PROF_H_ */
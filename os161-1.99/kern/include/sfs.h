@@ -48,13 +48,31 @@
  */
 #include <kern/sfs.h>
 
+/* Most file data blocks a vnode holds in memory */
+#define SFS_NDBUFS 16
+
+/*
+ * A block of file data held in memory. Dirty blocks don't have disk
+ * blocks allocated for them until they're flushed.
+ */
+struct sfs_dbuf {
+	uint32_t db_fileblock;          /* block number within the file */
+	bool db_dirty;                  /* true if not yet written out */
+	bool db_reserved;               /* a free block is set aside for it */
+	char db_data[SFS_BLOCKSIZE];
+};
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_dbuf *sv_dbufs[SFS_NDBUFS]; /* file data, or NULL */
+	bool sv_idreserved;             /* ...and one for the indirect block */
 };
 
+struct sfs_journal;	/* Opaque; see sfs_journal.c */
+
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_super sfs_super;	/* on-disk superblock */
@@ -63,6 +81,9 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	uint32_t sfs_nfree;             /* blocks clear in freemap */
+	uint32_t sfs_reserved;          /* of those, set aside for buffers */
+	struct sfs_journal *sfs_journal; /* metadata journal, or NULL */
 };
 
 /*
@@ -80,9 +101,41 @@ int sfs_mount(const char *device);
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 /* Convenience functions for block I/O */
+struct iovec;
 int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
+int sfs_wblocks(struct sfs_fs *sfs, struct iovec *iovs, unsigned n,
+		uint32_t block);
+
+/* One block of a batch for sfs_wbatch */
+struct sfs_wreq {
+	void *wr_data;
+	uint32_t wr_block;
+};
+int sfs_wbatch(struct sfs_fs *sfs, struct sfs_wreq *reqs, unsigned n);
+
+/* Write out a file's buffered data */
+int sfs_flushdata(struct sfs_vnode *sv);
+
+/*
+ * Metadata journal. SFS_JOPBLOCKS is what an ordinary operation can
+ * add to a transaction (for sfs_jbegin): the inodes and directory
+ * block of a rename or link, or the inode and indirect block of a
+ * write.
+ */
+#define SFS_JOPBLOCKS 8
+int sfs_jmount(struct sfs_fs *sfs);
+void sfs_junmount(struct sfs_fs *sfs);
+bool sfs_jread(struct sfs_fs *sfs, void *data, uint32_t block);
+int sfs_jwrite(struct sfs_fs *sfs, const void *data, uint32_t block);
+bool sfs_jfree(struct sfs_fs *sfs, uint32_t block);
+bool sfs_jreclaim(struct sfs_fs *sfs);
+void sfs_jmarkmap(struct sfs_fs *sfs, uint32_t block);
+int sfs_jbegin(struct sfs_fs *sfs, uint32_t nblocks);
+uint32_t sfs_jmaxop(struct sfs_fs *sfs);
+int sfs_jcommit(struct sfs_fs *sfs);
+int sfs_jflush(struct sfs_fs *sfs);
 
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
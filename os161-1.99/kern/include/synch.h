@@ -42,16 +42,27 @@
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * Normally a thread woken in P competes with any other thread that
+ * comes along for the count, and can lose over and over. In handoff
+ * mode (sem_set_handoff) V gives its unit straight to the thread that
+ * has waited longest, so waiters get through in FIFO order. That
+ * costs throughput, since the count can't be taken while the woken
+ * thread is waiting to run, but bounds how long anyone waits. The
+ * mode can only be changed while nobody is waiting.
  */
 struct semaphore {
         char *sem_name;
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+  volatile unsigned sem_waiters;  /* threads asleep in P */
+  bool sem_handoff;               /* V hands off to the oldest waiter */
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
 void sem_destroy(struct semaphore *);
+void sem_set_handoff(struct semaphore *, bool handoff);
 
 /*
  * Operations (both atomic):
@@ -62,6 +73,14 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P that gives up with EINTR, without decrementing, if the caller's
+ * process is exiting (see wchan_sleep_intr). Returns 0 once it has
+ * decremented. Not for handoff semaphores, where the wakeup itself is
+ * the unit and an interrupted waiter would lose it.
+ */
+int P_intr(struct semaphore *);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -77,6 +96,9 @@ struct lock {
   struct wchan *lock_wchan;
   volatile struct thread *t;
   struct spinlock lock_spinlock;
+  volatile unsigned lock_waiters;  /* threads asleep in lock_acquire */
+  bool lock_handoff;               /* release hands off to the oldest waiter */
+  volatile bool lock_passing;      /* handed off, new owner not yet running */
 };
 
 struct lock *lock_create(const char *name);
@@ -97,6 +119,13 @@ void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
 
+/*
+ * Handoff mode, as for semaphores: lock_release passes the lock
+ * directly to the thread that has waited longest instead of letting
+ * it race newcomers for it. Only change it while nobody is waiting.
+ */
+void lock_set_handoff(struct lock *, bool handoff);
+
 
 /*
  * Condition variable.
@@ -142,5 +171,51 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * cv_wait that returns EINTR if the caller's process is exiting, 0
+ * otherwise. The lock is held again on return either way.
+ */
+int cv_wait_intr(struct cv *cv, struct lock *lock);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers can't starve writers. (It
+ * also means a thread must not take the read lock again while it
+ * already holds it, or it may deadlock against a waiting writer.)
+ *
+ * Operations:
+ *    rwlock_acquire_read  - Wait until no writer holds or is waiting
+ *                           for the lock, then hold it for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Wait until nobody holds the lock, then
+ *                           hold it for writing.
+ *    rwlock_release_write - Give up the write hold.
+ *    rwlock_do_i_hold_write - True if the current thread holds the
+ *                           lock for writing.
+ */
+
+struct rwlock {
+  char *rwlock_name;
+  struct wchan *rwlock_readwchan;    /* readers wait here */
+  struct wchan *rwlock_writewchan;   /* writers wait here */
+  struct spinlock rwlock_spinlock;
+  volatile unsigned rwlock_readers;  /* readers holding the lock */
+  volatile unsigned rwlock_waitingwriters;
+  volatile struct thread *rwlock_writer;
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
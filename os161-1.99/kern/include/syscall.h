@@ -45,8 +45,26 @@ void syscall(struct trapframe *tf);
 
 int sys_execv(userptr_t progname, userptr_t args);
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
 /* Helper for fork(). You write this. */
 void enter_forked_process(void * tf, unsigned long data2);
+int sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t arg);
+/* Helper for __threadfork(). */
+void enter_new_thread(void *tf, unsigned long slot);
+
+/* Set up the futex table. */
+void futex_bootstrap(void);
+
+/*
+ * Per-cpu system call counts and latency histograms; see
+ * <kern/syscallstats.h>. syscall() counts each call on entry and
+ * records its latency if it returns.
+ */
+struct syscallstats *syscallstats_create(void);
+void syscallstats_enter(int callno);
+void syscallstats_exit(int callno, uint64_t start, uint64_t end);
+void syscallstats_print(void);
+void syscallstats_reset(void);
 
 /* Enter user mode. Does not return. */
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
@@ -59,11 +77,27 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t request, userptr_t remaining);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_read(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_open(userptr_t path, int flags, int mode, int *retval);
+int sys_close(int fdesc);
+int sys_lseek(int fdesc, off_t pos, int whence, off_t *retval);
+int sys_pipe(userptr_t fdsptr);
 void sys__exit(int exitcode);
+void sys___threadexit(void);
+/* End the current process with WAITSTATUS (a _MKWAIT_* value). */
+void proc_exit(int waitstatus);
+int sys___futexwait(userptr_t uaddr, int expected);
+int sys___futexwake(userptr_t uaddr, int count, int *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+             userptr_t stackargs, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
 int sys_getpid(pid_t *retval);
+int sys___syscallstats(int callno, userptr_t stats, int32_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 
 #endif // UW
@@ -55,6 +55,15 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Names shorter than this are kept in the thread, not kmalloc'd */
+#define THREAD_NAMELEN 24
+
+/*
+ * Exited threads, with their stacks, kept on each cpu for thread_fork
+ * to reuse instead of allocating new ones.
+ */
+#define THREAD_CACHE_MAX 16
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -71,6 +80,7 @@ struct thread {
 	 * debugger is messed up.
 	 */
 	char *t_name;			/* Name of this thread */
+	char t_namebuf[THREAD_NAMELEN];	/* Holds t_name if it's short */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
@@ -106,6 +116,8 @@ struct thread {
 	 */
 
 	/* add more here as needed */
+	int t_ustackslot;		/* Extra user stack in use, or -1 */
+	struct wchan *t_intrwchan;	/* Interruptible sleep channel, or NULL */
 };
 
 /*
@@ -157,6 +169,13 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Wake thread T if it's in an interruptible sleep (wchan_sleep_intr),
+ * so it notices its process is exiting. The caller holds T's
+ * process's p_lock.
+ */
+void thread_interrupt(struct thread *t);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -0,0 +1,36 @@
+/*
+ * Kernel event tracing.
+ *
+ * TRACE(type, arg1, arg2) records an event (see <kern/trace.h> for the
+ * types) in the current cpu's ring buffer, stamped with the cycle
+ * counter. It does nothing unless tracing has been turned on, so
+ * tracepoints can be left in hot paths. Each cpu only writes its own
+ * ring, with interrupts off, so no locks are taken; when a ring fills
+ * up the oldest events are overwritten.
+ *
+ * trace_start clears the rings and turns tracing on; trace_stop turns
+ * it off. trace_dump stops tracing and writes the rings to a file for
+ * tracedecode to read.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <kern/trace.h>
+
+struct tracebuf;
+
+extern bool trace_enabled;
+
+#define TRACE(type, a1, a2) \
+	(trace_enabled ? trace_event(type, (uintptr_t)(a1), (uintptr_t)(a2)) \
+	 : (void)0)
+
+void trace_event(unsigned type, uint32_t arg1, uint32_t arg2);
+
+struct tracebuf *tracebuf_create(void);
+void trace_start(void);
+void trace_stop(void);
+int trace_dump(const char *path);
+
+#endif /* _TRACE_H_ */
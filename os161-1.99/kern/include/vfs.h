@@ -114,6 +114,18 @@ int vfs_rename(char *oldpath, char *newpath);
 int vfs_chdir(char *path);
 int vfs_getcwd(struct uio *buf);
 
+/*
+ * Writing files from inside the kernel, for dumps of kernel data.
+ *
+ *    vfs_kcreate - Open PATH for writing, creating it or truncating
+ *                  it. Unlike vfs_open, leaves PATH alone.
+ *    vfs_kwrite  - Write LEN bytes from kernel buffer BUF at *POS and
+ *                  advance *POS. A short write is ENOSPC.
+ */
+
+int vfs_kcreate(const char *path, struct vnode **ret);
+int vfs_kwrite(struct vnode *vn, const void *buf, size_t len, off_t *pos);
+
 /*
  * Misc
  *
@@ -157,6 +169,9 @@ int vfs_getcwd(struct uio *buf);
  *                    specified device.
  *
  *    vfs_unmountall - Unmount all mounted filesystems.
+ *
+ *    pipe_create   - Create an anonymous pipe. Hands back a vnode for
+ *                    each end, each holding one reference.
  */
 
 void vfs_bootstrap(void);
@@ -174,6 +189,8 @@ int vfs_mount(const char *devname, void *data,
 int vfs_unmount(const char *devname);
 int vfs_unmountall(void);
 
+int pipe_create(struct vnode **readend, struct vnode **writeend);
+
 /*
  * Array of vnodes.
  */
@@ -71,6 +71,14 @@ void wchan_unlock(struct wchan *wc);
  */
 void wchan_sleep(struct wchan *wc);
 
+/*
+ * Like wchan_sleep, but give up and return EINTR if the thread's
+ * process is exiting, whether that's noticed before going to sleep,
+ * from thread_interrupt, or after an ordinary wakeup. Returns 0
+ * otherwise. The channel is unlocked on return either way.
+ */
+int wchan_sleep_intr(struct wchan *wc);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The queue should not already be locked.
@@ -42,50 +42,147 @@
  * because if one uses any data type more than a single byte wide,
  * bitmap data saved on disk becomes endian-dependent, which is a
  * severe nuisance.
+ *
+ * Searching is still done 32 bits at a time, though: a "chunk" is four
+ * bytes put together in an endian-independent way, so that bit k of
+ * chunk c is bit 32c+k of the bitmap. The byte array is padded out to
+ * a whole number of chunks, with the padding marked in use.
+ *
+ * On top of that there's a summary with one bit per chunk, set when
+ * the chunk is completely full, so that searches can skip 1024 bits
+ * at a time through full regions. And allocation is next-fit: it
+ * starts where the last one left off, instead of at the beginning,
+ * so it doesn't keep crawling over the full part of the map.
  */
 #define BITS_PER_WORD   (CHAR_BIT)
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+#define BITS_PER_CHUNK  32
+#define WORDS_PER_CHUNK (BITS_PER_CHUNK / BITS_PER_WORD)
+#define CHUNK_ALLBITS   (0xffffffff)
+
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
+        unsigned nchunks;       /* v holds this many chunks */
+        uint32_t *full;         /* summary: one bit per full chunk */
+        unsigned nsummary;      /* words in full[] */
+        unsigned hint;          /* where the next search starts */
 };
 
+/*
+ * Index of the lowest set bit of X, which must not be 0. Binary search,
+ * as a count-leading-zeros instruction would do it in hardware.
+ */
+static
+inline
+unsigned
+bitmap_lowbit(uint32_t x)
+{
+        unsigned n = 0;
+
+        KASSERT(x != 0);
+        if ((x & 0xffff) == 0) {
+                n += 16;
+                x >>= 16;
+        }
+        if ((x & 0xff) == 0) {
+                n += 8;
+                x >>= 8;
+        }
+        if ((x & 0xf) == 0) {
+                n += 4;
+                x >>= 4;
+        }
+        if ((x & 0x3) == 0) {
+                n += 2;
+                x >>= 2;
+        }
+        if ((x & 0x1) == 0) {
+                n += 1;
+        }
+        return n;
+}
+
+static
+inline
+uint32_t
+bitmap_getchunk(struct bitmap *b, unsigned c)
+{
+        const WORD_TYPE *w = &b->v[c * WORDS_PER_CHUNK];
+
+        return (uint32_t)w[0] | (uint32_t)w[1] << 8 |
+                (uint32_t)w[2] << 16 | (uint32_t)w[3] << 24;
+}
+
+/*
+ * Update the summary bit for chunk C.
+ */
+static
+void
+bitmap_summarize(struct bitmap *b, unsigned c)
+{
+        uint32_t mask = (uint32_t)1 << (c % BITS_PER_CHUNK);
+
+        if (bitmap_getchunk(b, c) == CHUNK_ALLBITS) {
+                b->full[c / BITS_PER_CHUNK] |= mask;
+        }
+        else {
+                b->full[c / BITS_PER_CHUNK] &= ~mask;
+        }
+}
+
+void
+bitmap_rescan(struct bitmap *b)
+{
+        unsigned c;
+
+        bzero(b->full, b->nsummary * sizeof(uint32_t));
+        /* summary bits past the last chunk count as full */
+        for (c = b->nchunks; c < b->nsummary * BITS_PER_CHUNK; c++) {
+                b->full[c / BITS_PER_CHUNK] |= (uint32_t)1 << (c % BITS_PER_CHUNK);
+        }
+        for (c = 0; c < b->nchunks; c++) {
+                bitmap_summarize(b, c);
+        }
+        b->hint = 0;
+}
 
 struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b; 
-        unsigned words;
+        unsigned words, j;
 
-        words = DIVROUNDUP(nbits, BITS_PER_WORD);
         b = kmalloc(sizeof(struct bitmap));
         if (b == NULL) {
                 return NULL;
         }
+        b->nchunks = DIVROUNDUP(nbits, BITS_PER_CHUNK);
+        words = b->nchunks * WORDS_PER_CHUNK;
         b->v = kmalloc(words*sizeof(WORD_TYPE));
         if (b->v == NULL) {
                 kfree(b);
                 return NULL;
         }
+        b->nsummary = DIVROUNDUP(b->nchunks, BITS_PER_CHUNK);
+        b->full = kmalloc(b->nsummary * sizeof(uint32_t));
+        if (b->full == NULL) {
+                kfree(b->v);
+                kfree(b);
+                return NULL;
+        }
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
 
         /* Mark any leftover bits at the end in use */
-        if (words > nbits / BITS_PER_WORD) {
-                unsigned j, ix = words-1;
-                unsigned overbits = nbits - ix*BITS_PER_WORD;
-
-                KASSERT(nbits / BITS_PER_WORD == words-1);
-                KASSERT(overbits > 0 && overbits < BITS_PER_WORD);
-                
-                for (j=overbits; j<BITS_PER_WORD; j++) {
-                        b->v[ix] |= ((WORD_TYPE)1 << j);
-                }
+        for (j = nbits; j < words * BITS_PER_WORD; j++) {
+                b->v[j / BITS_PER_WORD] |= ((WORD_TYPE)1 << (j % BITS_PER_WORD));
         }
 
+        bitmap_rescan(b);
         return b;
 }
 
@@ -95,31 +192,141 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
-int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+/*
+ * Index of the first chunk at or after C that isn't full, or nchunks.
+ */
+static
+unsigned
+bitmap_nextchunk(struct bitmap *b, unsigned c)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned s;
+        uint32_t full;
+
+        if (c >= b->nchunks) {
+                return b->nchunks;
+        }
+        s = c / BITS_PER_CHUNK;
+        /* treat the chunks before C as full */
+        full = b->full[s] | (((uint32_t)1 << (c % BITS_PER_CHUNK)) - 1);
+        while (full == CHUNK_ALLBITS) {
+                s++;
+                if (s >= b->nsummary) {
+                        return b->nchunks;
+                }
+                full = b->full[s];
+        }
+        c = s * BITS_PER_CHUNK + bitmap_lowbit(~full);
+        return c < b->nchunks ? c : b->nchunks;
+}
+
+/*
+ * Index of the first clear bit in [START, END), or END.
+ */
+static
+unsigned
+bitmap_findclear(struct bitmap *b, unsigned start, unsigned end)
+{
+        unsigned pos = start, c, bit;
+        uint32_t chunk;
+
+        while (pos < end) {
+                c = pos / BITS_PER_CHUNK;
+                /* treat the bits before POS as set */
+                chunk = bitmap_getchunk(b, c) |
+                        (((uint32_t)1 << (pos % BITS_PER_CHUNK)) - 1);
+                if (chunk != CHUNK_ALLBITS) {
+                        bit = c * BITS_PER_CHUNK + bitmap_lowbit(~chunk);
+                        return bit < end ? bit : end;
+                }
+                pos = bitmap_nextchunk(b, c + 1) * BITS_PER_CHUNK;
+        }
+        return end;
+}
+
+/*
+ * Index of the first set bit in [START, END), or END.
+ */
+static
+unsigned
+bitmap_findset(struct bitmap *b, unsigned start, unsigned end)
+{
+        unsigned pos = start, c, bit;
+        uint32_t chunk;
+
+        while (pos < end) {
+                c = pos / BITS_PER_CHUNK;
+                /* ignore the bits before POS */
+                chunk = bitmap_getchunk(b, c) &
+                        ~(((uint32_t)1 << (pos % BITS_PER_CHUNK)) - 1);
+                if (chunk != 0) {
+                        bit = c * BITS_PER_CHUNK + bitmap_lowbit(chunk);
+                        return bit < end ? bit : end;
+                }
+                pos = (c + 1) * BITS_PER_CHUNK;
+        }
+        return end;
+}
+
+/*
+ * Look for N clear bits in a row starting in [LO, HI). The run may
+ * extend past HI.
+ */
+static
+bool
+bitmap_findrun(struct bitmap *b, unsigned n, unsigned lo, unsigned hi,
+               unsigned *index)
+{
+        unsigned pos = lo, end, limit;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        while (pos < hi) {
+                pos = bitmap_findclear(b, pos, hi);
+                if (pos >= hi) {
+                        break;
+                }
+                limit = n < b->nbits - pos ? pos + n : b->nbits;
+                end = bitmap_findset(b, pos, limit);
+                if (end - pos == n) {
+                        *index = pos;
+                        return true;
                 }
+                pos = end;
         }
-        return ENOSPC;
+        return false;
 }
 
+int
+bitmap_alloc_run(struct bitmap *b, unsigned n, unsigned *index)
+{
+        unsigned ix, i, c, lastc;
+
+        KASSERT(n > 0);
+
+        /* next-fit: from the hint to the end, then from the start */
+        if (!bitmap_findrun(b, n, b->hint, b->nbits, &ix) &&
+            !bitmap_findrun(b, n, 0, b->hint, &ix)) {
+                return ENOSPC;
+        }
+
+        for (i = ix; i < ix + n; i++) {
+                KASSERT((b->v[i / BITS_PER_WORD] &
+                         ((WORD_TYPE)1 << (i % BITS_PER_WORD))) == 0);
+                b->v[i / BITS_PER_WORD] |= (WORD_TYPE)1 << (i % BITS_PER_WORD);
+        }
+        lastc = (ix + n - 1) / BITS_PER_CHUNK;
+        for (c = ix / BITS_PER_CHUNK; c <= lastc; c++) {
+                bitmap_summarize(b, c);
+        }
+
+        b->hint = ix + n < b->nbits ? ix + n : 0;
+        *index = ix;
+        return 0;
+}
+
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        return bitmap_alloc_run(b, 1, index);
+}
 static
 inline
 void
@@ -142,6 +349,7 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        bitmap_summarize(b, index / BITS_PER_CHUNK);
 }
 
 void
@@ -155,6 +363,7 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        bitmap_summarize(b, index / BITS_PER_CHUNK);
 }
 
 
@@ -171,6 +380,7 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
+        kfree(b->full);
         kfree(b->v);
         kfree(b);
 }
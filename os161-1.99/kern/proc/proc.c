@@ -50,8 +50,12 @@
 #include <vfs.h>
 #include <synch.h>
 #include <kern/fcntl.h>  
+#include <kern/wait.h>
+#include <kern/unistd.h>
 #include <limits.h>
 #include <wchan.h>
+#include <epoch.h>
+#include <openfile.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -74,12 +78,57 @@ struct semaphore *no_proc_sem;
 static struct proc *processes[PID_MAX+1];
 static struct semaphore *pidMutex;
 
+/*
+ * Look up a process without taking pidMutex. Slots are only filled and
+ * cleared under pidMutex, and a proc is only freed a grace period after
+ * its slot is cleared (see proc_destroy), so the result stays valid
+ * until the caller's epoch_exit(). Callers that aren't in a read
+ * section must know some other way that the process can't go away,
+ * e.g. because it's their child and they haven't exited yet.
+ */
 struct proc * getProc(pid_t pid) {
-  if (processes[pid] == NULL) return NULL;
+  if (pid < PID_MIN || pid > PID_MAX) return NULL;
   return processes[pid];
 }
 void setProcToNull(pid_t pid) {
+  P(pidMutex);
   processes[pid] = NULL;
+  V(pidMutex);
+}
+
+/*
+ * Sleep until process PARENTPID has exited, if it hasn't already.
+ * The parent clears its slot and then wakes its procWchan, so checking
+ * the slot again with the wait channel locked means we can't miss the
+ * wakeup.
+ */
+void waitForParent(pid_t parentPid) {
+  struct proc *parent;
+
+  epoch_enter();
+  parent = getProc(parentPid);
+  if (parent == NULL) {
+    epoch_exit();
+    return;
+  }
+  wchan_lock(parent->procWchan);
+  if (getProc(parentPid) != parent) {
+    wchan_unlock(parent->procWchan);
+    epoch_exit();
+    return;
+  }
+  epoch_exit();
+  wchan_sleep(parent->procWchan);
+}
+
+/* Free a proc once no lock-free lookup can still be using it. */
+static void proc_free(void *arg) {
+  struct proc *proc = arg;
+  // waitForParent may be about to lock procWchan, so it goes here too
+  if (proc->procSem != NULL) sem_destroy(proc->procSem);
+  if (proc->procWchan != NULL) wchan_destroy(proc->procWchan);
+  kfree(proc->p_name);
+  kfree(proc);
 }
 
 /*
@@ -101,7 +150,17 @@ proc_create(const char *name)
 		return NULL;
 	}
 
+  proc->pid = -1;
   proc->parentPid = -1;
+  proc->exitCode = _MKWAIT_EXIT(0);
+  proc->procSem = NULL;
+  proc->procWchan = NULL;
+  proc->p_exiting = false;
+  proc->vforkBorrowed = false;
+  proc->vforkSem = NULL;
+  for (int fd = 0; fd < OPEN_MAX; fd++) {
+    proc->fdTable[fd] = NULL;
+  }
 
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
@@ -112,10 +171,6 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
-
 	return proc;
 }
 
@@ -137,8 +192,16 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
-  if (proc->procSem != NULL) sem_destroy(proc->procSem);
-  if (proc->procWchan != NULL) wchan_destroy(proc->procWchan);
+  // unpublish first, in case nobody else did (e.g. a failed fork)
+  if (proc->pid != -1) {
+    P(pidMutex);
+    if (processes[proc->pid] == proc) {
+      processes[proc->pid] = NULL;
+    }
+    V(pidMutex);
+  }
+
+  if (proc->vforkSem != NULL) sem_destroy(proc->vforkSem);
 
 	/*
 	 * We don't take p_lock in here because we must have the only
@@ -173,17 +236,13 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console) {
-	  vfs_close(proc->console);
-	}
-#endif // UW
+  proc_closefds(proc);
 
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
-	kfree(proc->p_name);
-	kfree(proc);
+  // getProc callers may still be looking at it
+  epoch_defer(&proc->p_epoch, proc_free, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -245,13 +304,26 @@ proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
 	char *console_path;
+	struct openfile *of;
+	int fd;
 
 	proc = proc_create(name);
 	if (proc == NULL) {
 		return NULL;
 	}
 
-  proc->pid = -1;
+  // everything getProc callers use must exist before the pid is published
+  proc->procSem = sem_create("process semaphore", 0);
+  if (proc->procSem == NULL) {
+    proc_free(proc);
+    return NULL;
+  }
+  proc->procWchan = wchan_create("process wait channel");
+  if (proc->procWchan == NULL) {
+    proc_free(proc);
+    return NULL;
+  }
+
   P(pidMutex);
   for (pid_t i = PID_MIN; i <= PID_MAX; i++) {
     if (processes[i] == NULL) {
@@ -263,32 +335,27 @@ proc_create_runprogram(const char *name)
   V(pidMutex);
 
   if (proc->pid == -1) {
-    kfree(proc);
-    return NULL;
-  }
-
-  proc->procSem = sem_create("process semaphore", 0);
-  if (proc->procSem == NULL) {
-    kfree(proc);
-    return NULL;
-  }
-  proc->procWchan = wchan_create("process wait channel");
-  if (proc->procWchan == NULL) {
-    kfree(proc->procSem);
-    kfree(proc);
+    proc_free(proc);
     return NULL;
   }
 
 #ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
-	}
-	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
+	/*
+	 * open the console for stdin, stdout and stderr - this should
+	 * always succeed
+	 */
+	for (fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+	  console_path = kstrdup("con:");
+	  if (console_path == NULL) {
+	    panic("unable to copy console path name during process creation\n");
+	  }
+	  if (openfile_open(console_path,
+			    fd == STDIN_FILENO ? O_RDONLY : O_WRONLY, 0, &of)) {
+	    panic("unable to open the console during process creation\n");
+	  }
+	  kfree(console_path);
+	  proc->fdTable[fd] = of;
 	}
-	kfree(console_path);
 #endif // UW
 	  
 	/* VM fields */
@@ -376,6 +443,180 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Like proc_remthread, but leave the thread attached (and return
+ * false) if it is the last thread in its process. The check and the
+ * removal happen together, so when several threads of a process exit
+ * at once exactly one of them ends up being the last.
+ */
+bool
+proc_remthread_unlesslast(struct thread *t)
+{
+	struct proc *proc;
+	unsigned i, num;
+
+	proc = t->t_proc;
+	KASSERT(proc != NULL);
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	if (num == 1) {
+		KASSERT(threadarray_get(&proc->p_threads, 0) == t);
+		spinlock_release(&proc->p_lock);
+		return false;
+	}
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == t) {
+			threadarray_remove(&proc->p_threads, i);
+			spinlock_release(&proc->p_lock);
+			t->t_proc = NULL;
+			return true;
+		}
+	}
+	/* Did not find it. */
+	spinlock_release(&proc->p_lock);
+	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
+}
+
+/*
+ * Make TO's file table a copy of FROM's, for fork. Both processes end
+ * up sharing the open files, seek positions included. TO isn't
+ * running yet, so only FROM's table needs locking.
+ */
+void
+proc_copyfds(struct proc *from, struct proc *to)
+{
+  proc_closefds(to);
+  spinlock_acquire(&from->p_lock);
+  for (int fd = 0; fd < OPEN_MAX; fd++) {
+    if (from->fdTable[fd] != NULL) {
+      openfile_incref(from->fdTable[fd]);
+      to->fdTable[fd] = from->fdTable[fd];
+    }
+  }
+  spinlock_release(&from->p_lock);
+}
+
+/*
+ * Drop the references held by a process's file table. This has to
+ * happen as soon as the process exits, not when the proc structure is
+ * finally destroyed, so that e.g. a pipe's reader sees EOF.
+ */
+void
+proc_closefds(struct proc *proc)
+{
+  struct openfile *of;
+
+  for (int fd = 0; fd < OPEN_MAX; fd++) {
+    of = proc_removefile(proc, fd);
+    if (of != NULL) {
+      openfile_decref(of);
+    }
+  }
+}
+
+/*
+ * The descriptor table is shared by the process's threads, so it is
+ * only touched with p_lock held. Callers drop the reference from
+ * proc_getfile with openfile_decref, which may sleep, so it can't be
+ * done under p_lock.
+ */
+struct openfile *
+proc_getfile(struct proc *proc, int fd)
+{
+  struct openfile *of;
+
+  if (fd < 0 || fd >= OPEN_MAX) {
+    return NULL;
+  }
+  spinlock_acquire(&proc->p_lock);
+  of = proc->fdTable[fd];
+  if (of != NULL) {
+    openfile_incref(of);
+  }
+  spinlock_release(&proc->p_lock);
+  return of;
+}
+
+int
+proc_addfile(struct proc *proc, struct openfile *of)
+{
+  int fd;
+
+  spinlock_acquire(&proc->p_lock);
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    if (proc->fdTable[fd] == NULL) {
+      proc->fdTable[fd] = of;
+      spinlock_release(&proc->p_lock);
+      return fd;
+    }
+  }
+  spinlock_release(&proc->p_lock);
+  return -1;
+}
+
+/*
+ * Install both ends of a pipe at once, so another thread never sees
+ * one without the other. Returns -1, installing nothing, if there
+ * aren't two free descriptors.
+ */
+int
+proc_addfilepair(struct proc *proc, struct openfile *of0,
+                 struct openfile *of1, int fds[2])
+{
+  int fd, n = 0;
+
+  spinlock_acquire(&proc->p_lock);
+  for (fd = 0; fd < OPEN_MAX && n < 2; fd++) {
+    if (proc->fdTable[fd] == NULL) {
+      fds[n++] = fd;
+    }
+  }
+  if (n < 2) {
+    spinlock_release(&proc->p_lock);
+    return -1;
+  }
+  proc->fdTable[fds[0]] = of0;
+  proc->fdTable[fds[1]] = of1;
+  spinlock_release(&proc->p_lock);
+  return 0;
+}
+
+struct openfile *
+proc_removefile(struct proc *proc, int fd)
+{
+  struct openfile *of;
+
+  if (fd < 0 || fd >= OPEN_MAX) {
+    return NULL;
+  }
+  spinlock_acquire(&proc->p_lock);
+  of = proc->fdTable[fd];
+  proc->fdTable[fd] = NULL;
+  spinlock_release(&proc->p_lock);
+  return of;
+}
+
+/*
+ * For undoing an install that another thread may already have seen:
+ * it may have closed FD, or closed it and opened something else
+ * there, in which case the slot isn't ours to empty.
+ */
+bool
+proc_removefileif(struct proc *proc, int fd, struct openfile *of)
+{
+  bool removed = false;
+
+  KASSERT(fd >= 0 && fd < OPEN_MAX);
+  spinlock_acquire(&proc->p_lock);
+  if (proc->fdTable[fd] == of) {
+    proc->fdTable[fd] = NULL;
+    removed = true;
+  }
+  spinlock_release(&proc->p_lock);
+  return removed;
+}
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
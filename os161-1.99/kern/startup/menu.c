@@ -42,6 +42,8 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <trace.h>
+#include <prof.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -269,6 +271,68 @@ cmd_panic(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for event tracing: start, stop, or stop and dump to a file.
+ */
+static
+int
+cmd_trace(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		trace_start();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		trace_stop();
+		return 0;
+	}
+	if (nargs == 3 && !strcmp(args[1], "dump")) {
+		return trace_dump(args[2]);
+	}
+	kprintf("Usage: trace on | off | dump file\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the profiler: start, stop, or stop and dump to a file.
+ */
+static
+int
+cmd_prof(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		return prof_start();
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		prof_stop();
+		return 0;
+	}
+	if (nargs == 3 && !strcmp(args[1], "dump")) {
+		return prof_dump(args[2]);
+	}
+	kprintf("Usage: prof on | off | dump file\n");
+	return EINVAL;
+}
+
+/*
+ * Command for printing or clearing system call statistics.
+ */
+static
+int
+cmd_sysstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		syscallstats_print();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscallstats_reset();
+		return 0;
+	}
+	kprintf("Usage: sysstats [reset]\n");
+	return EINVAL;
+}
+
 /*
  * Command for enabling the output of debugging messages of type DB_THREADS.
  */
@@ -443,6 +507,9 @@ static const char *opsmenu[] = {
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
 	"[panic]   Intentional panic         ",
+	"[trace]   Event tracing             ",
+	"[sysstats] System call statistics   ",
+	"[prof]    Kernel profiler           ",
 	"[q]       Quit and shut down        ",
   "[dth]     Enable DB_THREADS debugging messages",
 	NULL
@@ -473,6 +540,8 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Reader-writer lock test       ",
+	"[sy5] Lock fairness test            ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -552,6 +621,9 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "trace",	cmd_trace },
+	{ "sysstats",	cmd_sysstats },
+	{ "prof",	cmd_prof },
 	{ "panic",	cmd_panic },
   { "dth",  cmd_dth },
 	{ "q",		cmd_quit },
@@ -585,6 +657,8 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
+	{ "sy5",	fairtest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -1,40 +1,48 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
 #include <kern/unistd.h>
 #include <lib.h>
 #include <uio.h>
+#include <stat.h>
+#include <synch.h>
 #include <syscall.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <openfile.h>
+#include <mmap.h>
+#include <limits.h>
+#include <copyinout.h>
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
- *
- * You will need to improve this implementation
+ * Common code for read() and write(). Seekable files are locked
+ * for the whole transfer, so threads or processes sharing the open
+ * file each get their own piece of it; for the console and pipes the
+ * offset means nothing and is left at 0.
  */
-
-int
-sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+static int
+fd_io(int fdesc, userptr_t ubuf, unsigned int nbytes, enum uio_rw rw,
+      int *retval)
 {
+  struct openfile *of;
   struct iovec iov;
   struct uio u;
-  int res;
+  struct stat st;
+  int how, res;
 
-  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
-  
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
-    return EUNIMP;
+  of = proc_getfile(curproc, fdesc);
+  if (of == NULL) {
+    return EBADF;
+  }
+  how = of->of_flags & O_ACCMODE;
+  if ((rw == UIO_READ && how == O_WRONLY) ||
+      (rw == UIO_WRITE && how == O_RDONLY)) {
+    openfile_decref(of);
+    return EBADF;
   }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
   KASSERT(curproc->p_addrspace != NULL);
 
   /* set up a uio structure to refer to the user program's buffer (ubuf) */
@@ -42,19 +50,252 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   iov.iov_len = nbytes;
   u.uio_iov = &iov;
   u.uio_iovcnt = 1;
-  u.uio_offset = 0;  /* not needed for the console */
+  u.uio_offset = 0;
   u.uio_resid = nbytes;
   u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
+  u.uio_rw = rw;
   u.uio_space = curproc->p_addrspace;
 
-  res = VOP_WRITE(curproc->console,&u);
+  if (of->of_seekable) {
+    lock_acquire(of->of_lock);
+    if (rw == UIO_WRITE && (of->of_flags & O_APPEND)) {
+      res = VOP_STAT(of->of_vnode, &st);
+      if (res) {
+        goto out;
+      }
+      of->of_offset = st.st_size;
+    }
+    u.uio_offset = of->of_offset;
+  }
+
+  if (of->of_seekable) {
+    /* not VOP_READ/VOP_WRITE, so shared mappings of the file agree */
+    res = mmap_fileio(of->of_vnode, &u);
+  }
+  else if (rw == UIO_READ) {
+    res = VOP_READ(of->of_vnode, &u);
+  }
+  else {
+    res = VOP_WRITE(of->of_vnode, &u);
+  }
+  if (of->of_seekable) {
+    /* a partial transfer still moves the position */
+    of->of_offset = u.uio_offset;
+  }
+  if (res == 0) {
+    /* pass back the number of bytes actually transferred */
+    *retval = nbytes - u.uio_resid;
+    KASSERT(*retval >= 0);
+  }
+
+ out:
+  if (of->of_seekable) {
+    lock_release(of->of_lock);
+  }
+  openfile_decref(of);
+  return res;
+}
+
+/* handler for write() system call                  */
+/*
+ * n.b.
+ * Writes to the console or a pipe are not atomic with respect to
+ * other writers; a pipe may interleave large writes from several
+ * processes.
+ */
+
+int
+sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  return fd_io(fdesc, ubuf, nbytes, UIO_WRITE, retval);
+}
+
+/* handler for read() system call */
+int
+sys_read(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  return fd_io(fdesc, ubuf, nbytes, UIO_READ, retval);
+}
+
+/* handler for open() system call */
+int
+sys_open(userptr_t path, int flags, int mode, int *retval)
+{
+  struct openfile *of;
+  char *kpath;
+  int fd, res;
+
+  DEBUG(DB_SYSCALL,"Syscall: open(%x,%d)\n",(unsigned int)path,flags);
+
+  kpath = kmalloc(PATH_MAX);
+  if (kpath == NULL) {
+    return ENOMEM;
+  }
+  res = copyinstr((const_userptr_t)path, kpath, PATH_MAX, NULL);
+  if (res) {
+    kfree(kpath);
+    return res;
+  }
+
+  res = openfile_open(kpath, flags, mode, &of);
+  kfree(kpath);
   if (res) {
     return res;
   }
 
-  /* pass back the number of bytes actually written */
-  *retval = nbytes - u.uio_resid;
-  KASSERT(*retval >= 0);
+  fd = proc_addfile(curproc, of);
+  if (fd < 0) {
+    openfile_decref(of);
+    return EMFILE;
+  }
+  *retval = fd;
   return 0;
 }
+
+/* handler for close() system call */
+int
+sys_close(int fdesc)
+{
+  struct openfile *of;
+
+  DEBUG(DB_SYSCALL,"Syscall: close(%d)\n",fdesc);
+
+  of = proc_removefile(curproc, fdesc);
+  if (of == NULL) {
+    return EBADF;
+  }
+  openfile_decref(of);
+  return 0;
+}
+
+/*
+ * handler for lseek() system call
+ *
+ * The filesystem gets to veto the new position (devices insist on
+ * whole blocks, and the console and pipes can't seek at all).
+ */
+int
+sys_lseek(int fdesc, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: lseek(%d,%d,%d)\n",fdesc,(int)pos,whence);
+
+  of = proc_getfile(curproc, fdesc);
+  if (of == NULL) {
+    return EBADF;
+  }
+  if (!of->of_seekable) {
+    openfile_decref(of);
+    return ESPIPE;
+  }
+
+  lock_acquire(of->of_lock);
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    res = VOP_STAT(of->of_vnode, &st);
+    if (res) {
+      goto out;
+    }
+    newpos = st.st_size + pos;
+    break;
+  default:
+    res = EINVAL;
+    goto out;
+  }
+  if (newpos < 0) {
+    res = EINVAL;
+    goto out;
+  }
+  res = VOP_TRYSEEK(of->of_vnode, newpos);
+  if (res) {
+    goto out;
+  }
+  of->of_offset = newpos;
+  *retval = newpos;
+
+ out:
+  lock_release(of->of_lock);
+  openfile_decref(of);
+  return res;
+}
+
+/*
+ * handler for pipe() system call
+ *
+ * Puts the read end in the lowest free descriptor and the write end
+ * in the next lowest, and copies both numbers out to user space.
+ */
+int
+sys_pipe(userptr_t fdsptr)
+{
+  struct vnode *readend, *writeend;
+  struct openfile *readof, *writeof;
+  int fds[2];
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: pipe(%x)\n",(unsigned int)fdsptr);
+
+  res = pipe_create(&readend, &writeend);
+  if (res) {
+    return res;
+  }
+  /* openfile_decref closes the ends, so open them */
+  VOP_INCOPEN(readend);
+  VOP_INCOPEN(writeend);
+
+  res = openfile_create(readend, O_RDONLY, &readof);
+  if (res) {
+    vfs_close(readend);
+    vfs_close(writeend);
+    return res;
+  }
+  res = openfile_create(writeend, O_WRONLY, &writeof);
+  if (res) {
+    openfile_decref(readof);
+    vfs_close(writeend);
+    return res;
+  }
+
+  /* keep our own references, so the pointers stay valid below */
+  openfile_incref(readof);
+  openfile_incref(writeof);
+  if (proc_addfilepair(curproc, readof, writeof, fds) < 0) {
+    res = EMFILE;
+    /* drop the references the table would have had */
+    openfile_decref(readof);
+    openfile_decref(writeof);
+    goto done;
+  }
+
+  res = copyout(fds, fdsptr, sizeof(fds));
+  if (res) {
+    /*
+     * Another thread may already have closed or replaced the
+     * descriptors, so only take back the ones still holding our
+     * files.
+     */
+    if (proc_removefileif(curproc, fds[0], readof)) {
+      openfile_decref(readof);
+    }
+    if (proc_removefileif(curproc, fds[1], writeof)) {
+      openfile_decref(writeof);
+    }
+  }
+
+ done:
+  openfile_decref(readof);
+  openfile_decref(writeof);
+  return res;
+}
@@ -0,0 +1,206 @@
+/*
+ * Futex-style blocking for user-level synchronization.
+ *
+ * __futexwait(addr, expected) sleeps as long as the word at ADDR
+ * still holds EXPECTED; __futexwake(addr, n) wakes up to N threads
+ * sleeping on ADDR. User locks built on these only enter the kernel
+ * when they are contended.
+ *
+ * Waiters are keyed on (address space, user address). Keys hash into
+ * a fixed table of buckets; each bucket has a sleep lock (so that the
+ * user word can be read with copyin while holding it) and a short
+ * list of futexes that currently have someone waiting on them. A
+ * futex is created by its first waiter and freed by its last one.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+#define FUTEX_BUCKETS 64
+
+struct futex {
+  struct addrspace *f_as;
+  vaddr_t f_addr;
+  struct cv *f_cv;
+  unsigned f_waiters; // sleeping and not yet woken
+  unsigned f_refs; // threads between lookup and wakeup
+  struct futex *f_next;
+};
+
+struct futexbucket {
+  struct lock *fb_lock;
+  struct futex *fb_head;
+};
+
+static struct futexbucket futextable[FUTEX_BUCKETS];
+
+void
+futex_bootstrap(void)
+{
+  for (int i = 0; i < FUTEX_BUCKETS; i++) {
+    futextable[i].fb_lock = lock_create("futex bucket");
+    if (futextable[i].fb_lock == NULL) {
+      panic("futex_bootstrap: could not create bucket lock\n");
+    }
+    futextable[i].fb_head = NULL;
+  }
+}
+
+static
+struct futexbucket *
+futex_bucket(struct addrspace *as, vaddr_t addr)
+{
+  uint32_t h = (uint32_t)as ^ (addr >> 2);
+
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return &futextable[h % FUTEX_BUCKETS];
+}
+
+/* Find the futex for (as, addr), creating it if asked. Bucket lock held. */
+static
+struct futex *
+futex_lookup(struct futexbucket *fb, struct addrspace *as, vaddr_t addr,
+             bool create)
+{
+  struct futex *f;
+
+  KASSERT(lock_do_i_hold(fb->fb_lock));
+
+  for (f = fb->fb_head; f != NULL; f = f->f_next) {
+    if (f->f_as == as && f->f_addr == addr) {
+      return f;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+
+  f = kmalloc(sizeof(struct futex));
+  if (f == NULL) {
+    return NULL;
+  }
+  f->f_cv = cv_create("futex");
+  if (f->f_cv == NULL) {
+    kfree(f);
+    return NULL;
+  }
+  f->f_as = as;
+  f->f_addr = addr;
+  f->f_waiters = 0;
+  f->f_refs = 0;
+  f->f_next = fb->fb_head;
+  fb->fb_head = f;
+  return f;
+}
+
+/* Unlink and free a futex nobody is using any more. Bucket lock held. */
+static
+void
+futex_release(struct futexbucket *fb, struct futex *f)
+{
+  struct futex **fp;
+
+  KASSERT(lock_do_i_hold(fb->fb_lock));
+  KASSERT(f->f_refs == 0);
+  KASSERT(f->f_waiters == 0);
+
+  for (fp = &fb->fb_head; *fp != f; fp = &(*fp)->f_next) {
+    KASSERT(*fp != NULL);
+  }
+  *fp = f->f_next;
+
+  cv_destroy(f->f_cv);
+  kfree(f);
+}
+
+int
+sys___futexwait(userptr_t uaddr, int expected)
+{
+  struct addrspace *as = curproc_getas();
+  vaddr_t addr = (vaddr_t)uaddr;
+  struct futexbucket *fb;
+  struct futex *f;
+  int val, result;
+
+  if (addr % sizeof(int) != 0) {
+    return EINVAL;
+  }
+
+  fb = futex_bucket(as, addr);
+  lock_acquire(fb->fb_lock);
+
+  /*
+   * Check the value with the bucket lock held: a waker has to get
+   * the same lock, so it can't slip in between the check and the
+   * sleep below.
+   */
+  result = copyin(uaddr, &val, sizeof(int));
+  if (result) {
+    lock_release(fb->fb_lock);
+    return result;
+  }
+  if (val != expected) {
+    lock_release(fb->fb_lock);
+    return EAGAIN;
+  }
+
+  f = futex_lookup(fb, as, addr, true);
+  if (f == NULL) {
+    lock_release(fb->fb_lock);
+    return ENOMEM;
+  }
+
+  f->f_refs++;
+  f->f_waiters++;
+  result = cv_wait_intr(f->f_cv, fb->fb_lock);
+  if (result && f->f_waiters > 0) {
+    /* not woken; don't let a later wake count us */
+    f->f_waiters--;
+  }
+
+  f->f_refs--;
+  if (f->f_refs == 0) {
+    futex_release(fb, f);
+  }
+  lock_release(fb->fb_lock);
+  return result;
+}
+
+int
+sys___futexwake(userptr_t uaddr, int count, int *retval)
+{
+  struct addrspace *as = curproc_getas();
+  vaddr_t addr = (vaddr_t)uaddr;
+  struct futexbucket *fb;
+  struct futex *f;
+  int woken = 0;
+
+  if (addr % sizeof(int) != 0 || count < 0) {
+    return EINVAL;
+  }
+
+  fb = futex_bucket(as, addr);
+  lock_acquire(fb->fb_lock);
+
+  f = futex_lookup(fb, as, addr, false);
+  if (f != NULL) {
+    while (woken < count && f->f_waiters > 0) {
+      cv_signal(f->f_cv, fb->fb_lock);
+      f->f_waiters--;
+      woken++;
+    }
+  }
+
+  lock_release(fb->fb_lock);
+  *retval = woken;
+  return 0;
+}
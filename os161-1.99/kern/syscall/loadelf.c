@@ -145,6 +145,21 @@ load_segment(struct addrspace *as, struct vnode *v,
 	return result;
 }
 
+/*
+ * Read-only segments that are laid out in the file the same way as in
+ * memory (page offsets match, nothing to zero-fill) aren't loaded at
+ * all: they're mapped from the file with as_define_text, so all the
+ * processes running this program share one copy.
+ */
+static
+bool
+segment_is_shared(const Elf_Phdr *ph)
+{
+	return (ph->p_flags & PF_W) == 0 && ph->p_memsz > 0 &&
+		ph->p_filesz == ph->p_memsz &&
+		ph->p_offset % PAGE_SIZE == ph->p_vaddr % PAGE_SIZE;
+}
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -243,11 +258,17 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
-		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+		if (segment_is_shared(&ph)) {
+			result = as_define_text(as, v, ph.p_offset,
+						ph.p_vaddr, ph.p_memsz);
+		}
+		else {
+			result = as_define_region(as,
+						  ph.p_vaddr, ph.p_memsz,
+						  ph.p_flags & PF_R,
+						  ph.p_flags & PF_W,
+						  ph.p_flags & PF_X);
+		}
 		if (result) {
 			return result;
 		}
@@ -288,6 +309,10 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+		if (segment_is_shared(&ph)) {
+			continue;
+		}
+
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
@@ -0,0 +1,101 @@
+/*
+ * mmap, munmap and msync. The mapping work is in vm/mmap.c; this is
+ * just argument checking.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <current.h>
+#include <proc.h>
+#include <limits.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <mmap.h>
+#include <syscall.h>
+
+/*
+ * mmap(addr, len, prot, flags, fd, offset) has more arguments than
+ * fit in registers: fd and offset come from the user stack at
+ * STACKARGS, with offset 8-aligned after fd. The address is only a
+ * hint and is ignored.
+ *
+ * The file must be open for reading, and for writing too if stores
+ * through a shared mapping could reach it.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+         userptr_t stackargs, int32_t *retval)
+{
+  struct openfile *of;
+  vaddr_t va;
+  off_t offset;
+  int fd, how, result;
+
+  (void)addr;
+
+  result = copyin(stackargs, &fd, sizeof(int));
+  if (result) {
+    return result;
+  }
+  result = copyin(stackargs + 8, &offset, sizeof(off_t));
+  if (result) {
+    return result;
+  }
+
+  if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+    return EINVAL;
+  }
+  if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+    return EINVAL;
+  }
+  if (offset < 0 || offset % PAGE_SIZE != 0) {
+    return EINVAL;
+  }
+  of = proc_getfile(curproc, fd);
+  if (of == NULL) {
+    return EBADF;
+  }
+  how = of->of_flags & O_ACCMODE;
+  if (how == O_WRONLY ||
+      (how == O_RDONLY && flags == MAP_SHARED && (prot & PROT_WRITE))) {
+    openfile_decref(of);
+    return EACCES;
+  }
+
+  /* the filesystem decides whether this kind of file can be mapped */
+  result = VOP_MMAP(of->of_vnode);
+  if (result) {
+    openfile_decref(of);
+    return ENODEV;
+  }
+
+  /* the mapping holds its own vnode reference */
+  result = mmap_map(curproc_getas(), of->of_vnode, offset, len, prot, flags,
+                    &va);
+  openfile_decref(of);
+  if (result) {
+    return result;
+  }
+  *retval = (int32_t)va;
+  return 0;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+  return mmap_unmap(curproc_getas(), (vaddr_t)addr, len);
+}
+
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+  /* writes are always synchronous */
+  (void)flags;
+  return mmap_sync(curproc_getas(), (vaddr_t)addr, len);
+}
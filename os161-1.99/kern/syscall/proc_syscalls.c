@@ -16,6 +16,22 @@
 #include <kern/fcntl.h>
 #include <vfs.h>
 #include <limits.h>
+#include <epoch.h>
+
+/*
+ * A vfork child runs on its parent's address space until it execs or
+ * exits. Give the address space back (without destroying it) and let
+ * the parent, asleep in sys_vfork, continue.
+ */
+static void vfork_release(struct proc *p) {
+  KASSERT(p->vforkBorrowed);
+  KASSERT(p->vforkSem != NULL);
+
+  as_deactivate();
+  curproc_setas(NULL);
+  p->vforkBorrowed = false;
+  V(p->vforkSem);
+}
 
 int sys_execv(userptr_t progname, userptr_t args)
 {
@@ -61,10 +77,15 @@ int sys_execv(userptr_t progname, userptr_t args)
 	}
   kfree(name);
 
-  // destroy old address space
-  as_deactivate();
-  old_as = curproc_setas(NULL);
-  as_destroy(old_as);
+  // destroy old address space, or hand it back if it was borrowed by vfork
+  if (curproc->vforkBorrowed) {
+    vfork_release(curproc);
+  }
+  else {
+    as_deactivate();
+    old_as = curproc_setas(NULL);
+    as_destroy(old_as);
+  }
   KASSERT(curproc_getas() == NULL);
 
 	/* Create a new address space. */
@@ -150,6 +171,7 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
   }
 
   child->parentPid = curproc->pid;
+  proc_copyfds(curproc, child);
 
   struct trapframe *childTF = kmalloc(sizeof(struct trapframe));
   if (childTF == NULL) {
@@ -171,6 +193,56 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
   return 0;
 }
 
+/*
+ * vfork: like fork, but the child borrows the parent's address space
+ * instead of getting a copy from as_copy. The parent is suspended
+ * until the child calls execv or _exit, so the two never run on the
+ * same address space at once.
+ */
+int sys_vfork(struct trapframe *tf, pid_t *retval) {
+  struct proc *child = proc_create_runprogram("child process");
+  if (child == NULL) {
+    return ENPROC;
+  }
+
+  child->vforkSem = sem_create("vfork semaphore", 0);
+  if (child->vforkSem == NULL) {
+    proc_destroy(child);
+    return ENOMEM;
+  }
+
+  child->p_addrspace = curproc_getas();
+  child->vforkBorrowed = true;
+  child->parentPid = curproc->pid;
+  proc_copyfds(curproc, child);
+
+  struct trapframe *childTF = kmalloc(sizeof(struct trapframe));
+  if (childTF == NULL) {
+    child->p_addrspace = NULL;
+    proc_destroy(child);
+    return ENOMEM;
+  }
+
+  *childTF = *tf;
+
+  int err = thread_fork("child process thread", child, enter_forked_process, childTF, 0);
+  if (err) {
+    child->p_addrspace = NULL;
+    proc_destroy(child);
+    kfree(childTF);
+    childTF = NULL;
+    return err;
+  }
+
+  // the child can't be destroyed before we return: it waits for its
+  // parent to exit first (see sys__exit)
+  P(child->vforkSem);
+  as_activate();
+
+  *retval = child->pid;
+  return 0;
+}
+
 void enter_forked_process(void * tf, unsigned long data2) {
   (void) data2;
 
@@ -186,34 +258,144 @@ void enter_forked_process(void * tf, unsigned long data2) {
   mips_usermode(&childTF);
 }
 
+/*
+ * __threadfork: start another thread in the current process, running
+ * on the same address space with a user stack of its own. It begins
+ * at ENTRY with ARG as its only argument; libc supplies an ENTRY that
+ * calls __threadexit when the thread's function returns.
+ */
+int sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t arg) {
+  struct trapframe *threadTF;
+  vaddr_t stackptr;
+  int slot, err;
+
+  threadTF = kmalloc(sizeof(struct trapframe));
+  if (threadTF == NULL) {
+    return ENOMEM;
+  }
+
+  err = as_define_thread_stack(curproc_getas(), &slot, &stackptr);
+  if (err) {
+    kfree(threadTF);
+    return err;
+  }
+
+  // start from our registers so that gp and friends are right
+  *threadTF = *tf;
+  threadTF->tf_epc = (vaddr_t)entry;
+  threadTF->tf_a0 = (vaddr_t)arg;
+  threadTF->tf_sp = stackptr;
+  threadTF->tf_ra = 0;
+
+  err = thread_fork("user thread", curproc, enter_new_thread, threadTF, slot);
+  if (err) {
+    as_release_thread_stack(curproc_getas(), slot);
+    kfree(threadTF);
+    return err;
+  }
+
+  return 0;
+}
+
+void enter_new_thread(void *tf, unsigned long slot) {
+  struct trapframe threadTF = *((struct trapframe *) tf);
+  kfree(tf);
+
+  curthread->t_ustackslot = slot;
+
+  // the process may have started exiting since __threadfork
+  if (curproc->p_exiting) {
+    sys___threadexit();
+  }
+
+  as_activate();
+
+  mips_usermode(&threadTF);
+}
+
 void sys__exit(int exitcode) {
+  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+
+  proc_exit(_MKWAIT_EXIT(exitcode));
+}
+
+/*
+ * End the whole process. Mark it exiting and wake every other thread
+ * that's in an interruptible sleep; those, and threads that are
+ * running or in other sleeps, leave through __threadexit the next
+ * time they would return to user mode (see mips_trap). The last one
+ * out, possibly us, does the teardown.
+ */
+void proc_exit(int waitstatus) {
+  struct proc *p = curproc;
+  struct thread *t;
+  unsigned i, num;
+
+  spinlock_acquire(&p->p_lock);
+  if (!p->p_exiting) {
+    // if two threads exit at once, the first one's status sticks
+    p->exitCode = waitstatus;
+    p->p_exiting = true;
+  }
+  num = threadarray_num(&p->p_threads);
+  for (i = 0; i < num; i++) {
+    t = threadarray_get(&p->p_threads, i);
+    if (t != curthread) {
+      thread_interrupt(t);
+    }
+  }
+  spinlock_release(&p->p_lock);
+
+  sys___threadexit();
+}
+
+/*
+ * __threadexit: the calling thread leaves its process. Other threads
+ * keep running; only when the last one leaves (here or through
+ * proc_exit) does the process itself exit, with the status from
+ * _exit, or 0 if there wasn't one.
+ */
+void sys___threadexit(void) {
 
   struct addrspace *as;
   struct proc *p = curproc;
-  curproc->exitCode = _MKWAIT_EXIT(exitcode);
 
-  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+  if (curthread->t_ustackslot >= 0) {
+    as_release_thread_stack(curproc_getas(), curthread->t_ustackslot);
+    curthread->t_ustackslot = -1;
+  }
+
+  if (proc_remthread_unlesslast(curthread)) {
+    thread_exit();
+  }
 
   KASSERT(curproc->p_addrspace != NULL);
-  as_deactivate();
-  /*
-   * clear p_addrspace before calling as_destroy. Otherwise if
-   * as_destroy sleeps (which is quite possible) when we
-   * come back we'll be calling as_activate on a
-   * half-destroyed address space. This tends to be
-   * messily fatal.
-   */
-  as = curproc_setas(NULL);
-  as_destroy(as);
+  if (curproc->vforkBorrowed) {
+    // the address space belongs to our vfork parent
+    vfork_release(curproc);
+  }
+  else {
+    as_deactivate();
+    /*
+     * clear p_addrspace before calling as_destroy. Otherwise if
+     * as_destroy sleeps (which is quite possible) when we
+     * come back we'll be calling as_activate on a
+     * half-destroyed address space. This tends to be
+     * messily fatal.
+     */
+    as = curproc_setas(NULL);
+    as_destroy(as);
+  }
+
+  proc_closefds(curproc);
 
   V(curproc->procSem); // allow waitpid call to return
 
   // delay process destruction until waitpid cannot be called,
   // aka when parent process is NULL
 
-  if (curproc->parentPid != -1 && getProc(curproc->parentPid) != NULL) {
-    wchan_lock(getProc(curproc->parentPid)->procWchan);
-    wchan_sleep(getProc(curproc->parentPid)->procWchan);
+  if (curproc->parentPid != -1) {
+    waitForParent(curproc->parentPid);
   }
   setProcToNull(curproc->pid);
   // wake up all children processes from their delayed destruction
@@ -229,7 +411,7 @@ void sys__exit(int exitcode) {
   
   thread_exit();
   /* thread_exit() does not return, so we should never get here */
-  panic("return from thread_exit in sys_exit\n");
+  panic("return from thread_exit in sys___threadexit\n");
 }
 
 int
@@ -242,26 +424,36 @@ sys_getpid(pid_t *retval)
 int
 sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval)
 {
+  struct proc *child;
   int exitstatus;
   int result;
 
   if (options != 0) {
     return(EINVAL);
   }
-  if (getProc(pid)->parentPid != curproc->pid) {
-    return(ECHILD);
-  }
-  if (getProc(pid) == NULL) {
+  epoch_enter();
+  child = getProc(pid);
+  if (child == NULL) {
+    epoch_exit();
     return(ESRCH);
   }
+  if (child->parentPid != curproc->pid) {
+    epoch_exit();
+    return(ECHILD);
+  }
+  epoch_exit();
   if (status == NULL) {
     return(EFAULT);
   }
 
-  P(getProc(pid)->procSem);
-  V(getProc(pid)->procSem); // in case waitpid gets called more than once after child process exited
+  // our child can't be destroyed until we exit, so child stays valid
+  result = P_intr(child->procSem);
+  if (result) {
+    return(result);
+  }
+  V(child->procSem); // in case waitpid gets called more than once after child process exited
 
-  exitstatus = getProc(pid)->exitCode;
+  exitstatus = child->exitCode;
 
   result = copyout((void *)&exitstatus,status,sizeof(int));
   if (result) {
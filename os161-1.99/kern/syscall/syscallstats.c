@@ -0,0 +1,195 @@
+/*
+ * System call statistics.
+ *
+ * Each cpu counts the calls made on it, in a table indexed by call
+ * number, so recording a call takes no locks. Calls are counted at
+ * entry so that ones that never return (_exit, a successful execv)
+ * still show up; their latency is recorded at exit, on whichever cpu
+ * the call finishes on, so only calls that returned are in the
+ * histogram. Readers add up all
+ * the cpus' tables without stopping them; the totals may be slightly
+ * out of date but that doesn't matter for statistics.
+ *
+ * Latencies are cycle counts from entry to syscall() to the end of
+ * dispatch. A thread that slept may finish on a different cpu from
+ * the one it started on, and the cpus' cycle counters are not exactly
+ * in step, so such times are approximate.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscallstats.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+struct syscallstats {
+	struct syscallstat sst_calls[SYSSTAT_NCALLS];
+};
+
+struct syscallstats *
+syscallstats_create(void)
+{
+	struct syscallstats *sst;
+
+	sst = kmalloc(sizeof(*sst));
+	if (sst == NULL) {
+		return NULL;
+	}
+	bzero(sst->sst_calls, sizeof(sst->sst_calls));
+	return sst;
+}
+
+static
+unsigned
+syscallstats_bucket(uint64_t cycles)
+{
+	unsigned b = 0;
+
+	while (cycles > 1 && b < SYSSTAT_NBUCKETS - 1) {
+		cycles >>= 1;
+		b++;
+	}
+	return b;
+}
+
+/*
+ * Count a call to CALLNO on entry to syscall(). Interrupts are off
+ * while the entry is updated so nothing else on this cpu can update
+ * it at the same time.
+ */
+void
+syscallstats_enter(int callno)
+{
+	int spl;
+
+	if (callno < 0 || callno >= SYSSTAT_NCALLS) {
+		return;
+	}
+	spl = splhigh();
+	curcpu->c_syscallstats->sst_calls[callno].ss_count++;
+	splx(spl);
+}
+
+/*
+ * Record the latency of a call that ran from cycle START to cycle END
+ * and is about to return.
+ */
+void
+syscallstats_exit(int callno, uint64_t start, uint64_t end)
+{
+	struct syscallstat *ss;
+	uint64_t cycles;
+	int spl;
+
+	if (callno < 0 || callno >= SYSSTAT_NCALLS) {
+		return;
+	}
+	/* can happen if we finished on a cpu whose counter is behind */
+	cycles = end > start ? end - start : 0;
+
+	spl = splhigh();
+	ss = &curcpu->c_syscallstats->sst_calls[callno];
+	ss->ss_cycles += cycles;
+	ss->ss_buckets[syscallstats_bucket(cycles)]++;
+	splx(spl);
+}
+
+/*
+ * Add up one call's statistics over all cpus.
+ */
+static
+void
+syscallstats_sum(int callno, struct syscallstat *total)
+{
+	struct syscallstat *ss;
+	unsigned c, i;
+
+	bzero(total, sizeof(*total));
+	for (c = 0; c < cpu_count(); c++) {
+		ss = &cpu_get(c)->c_syscallstats->sst_calls[callno];
+		total->ss_count += ss->ss_count;
+		total->ss_cycles += ss->ss_cycles;
+		for (i = 0; i < SYSSTAT_NBUCKETS; i++) {
+			total->ss_buckets[i] += ss->ss_buckets[i];
+		}
+	}
+}
+
+/*
+ * Print a line for each call that has been made: the count, mean
+ * latency of the calls that returned, and the histogram from the
+ * first to the last nonempty bucket. Calls that never returned have
+ * nothing in the histogram and no mean.
+ */
+void
+syscallstats_print(void)
+{
+	struct syscallstat total;
+	unsigned lo, hi, i;
+	uint32_t returned;
+	int callno;
+
+	kprintf("call      count  mean cycles  histogram (from 2^n cycles)\n");
+	for (callno = 0; callno < SYSSTAT_NCALLS; callno++) {
+		syscallstats_sum(callno, &total);
+		if (total.ss_count == 0) {
+			continue;
+		}
+		returned = 0;
+		for (i = 0; i < SYSSTAT_NBUCKETS; i++) {
+			returned += total.ss_buckets[i];
+		}
+		if (returned == 0) {
+			kprintf("%4d %10u            -\n", callno, total.ss_count);
+			continue;
+		}
+		for (lo = 0; total.ss_buckets[lo] == 0; lo++);
+		for (hi = SYSSTAT_NBUCKETS - 1; total.ss_buckets[hi] == 0; hi--);
+
+		kprintf("%4d %10u %12llu  n=%u:", callno, total.ss_count,
+			total.ss_cycles / returned, lo);
+		for (i = lo; i <= hi; i++) {
+			kprintf(" %u", total.ss_buckets[i]);
+		}
+		kprintf("\n");
+	}
+}
+
+void
+syscallstats_reset(void)
+{
+	struct syscallstats *sst;
+	unsigned i;
+
+	for (i = 0; i < cpu_count(); i++) {
+		sst = cpu_get(i)->c_syscallstats;
+		bzero(sst->sst_calls, sizeof(sst->sst_calls));
+	}
+}
+
+/*
+ * __syscallstats(callno, stats): copy out the statistics for CALLNO
+ * and return the cycle counter rate, so they can be turned into time.
+ */
+int
+sys___syscallstats(int callno, userptr_t stats, int32_t *retval)
+{
+	struct syscallstat total;
+	int result;
+
+	if (callno < 0 || callno >= SYSSTAT_NCALLS) {
+		return EINVAL;
+	}
+	syscallstats_sum(callno, &total);
+	result = copyout(&total, stats, sizeof(total));
+	if (result) {
+		return result;
+	}
+	*retval = getcyclerate();
+	return 0;
+}
@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,36 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time given in REQUEST. The only thing that cuts a
+ * sleep short is the process exiting (there are no signals); then
+ * the time that was left is written to REMAINING, if it isn't NULL.
+ */
+int
+sys_nanosleep(const_userptr_t request, userptr_t remaining)
+{
+	struct timespec ts;
+	uint64_t left;
+	int result, result2;
+
+	result = copyin(request, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	result = clocknanosleep((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+				&left);
+	if (result == EINTR && remaining != NULL) {
+		ts.tv_sec = left / 1000000000;
+		ts.tv_nsec = left % 1000000000;
+		result2 = copyout(&ts, remaining, sizeof(ts));
+		if (result2) {
+			return result2;
+		}
+	}
+	return result;
+}
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <test.h>
@@ -40,7 +41,8 @@ bitmaptest(int nargs, char **args)
 	struct bitmap *b;
 	char data[TESTSIZE];
 	uint32_t x;
-	int i;
+	unsigned n;
+	int i, j;
 
 	(void)nargs;
 	(void)args;
@@ -101,6 +103,31 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Free every third bit; runs of 2 should no longer fit. */
+	for (i=0; i<TESTSIZE; i+=3) {
+		bitmap_unmark(b, i);
+	}
+	KASSERT(bitmap_alloc_run(b, 2, &x) == ENOSPC);
+	bitmap_destroy(b);
+
+	/* Fill a fresh bitmap with runs of assorted lengths. */
+	b = bitmap_create(TESTSIZE);
+	KASSERT(b != NULL);
+	n = 0;
+	for (i=1; bitmap_alloc_run(b, i % 37 + 1, &x) == 0; i++) {
+		KASSERT(x + i % 37 + 1 <= TESTSIZE);
+		for (j=0; j < i % 37 + 1; j++) {
+			KASSERT(bitmap_isset(b, x + j));
+		}
+		n += i % 37 + 1;
+	}
+	/* single bits must still fill up whatever gaps are left */
+	while (bitmap_alloc(b, &x)==0) {
+		n++;
+	}
+	KASSERT(n == TESTSIZE);
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
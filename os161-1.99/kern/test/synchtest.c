@@ -35,12 +35,15 @@
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <test.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
+#define NRWLOOPS      40
+#define NFAIRLOOPS    50
 #define NTHREADS      32
 
 static volatile unsigned long testval1;
@@ -347,3 +350,274 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test. Even-numbered threads write, odd ones
+ * read. Writers check that nobody else is inside; readers check that
+ * no writer is and that what the last writer left is consistent.
+ * Everyone yields while holding the lock so that readers get a chance
+ * to overlap.
+ */
+
+static struct rwlock *testrwlock;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static unsigned rwreaders, rwwriters, rwmaxreaders;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	panic("rwlock test failed\n");
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 2 == 0) {
+			rwlock_acquire_write(testrwlock);
+			if (!rwlock_do_i_hold_write(testrwlock)) {
+				rwfail(num, "rwlock_do_i_hold_write is false");
+			}
+			spinlock_acquire(&rwcount_lock);
+			if (rwreaders != 0 || rwwriters != 0) {
+				rwfail(num, "writer is not alone");
+			}
+			rwwriters++;
+			spinlock_release(&rwcount_lock);
+
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+
+			spinlock_acquire(&rwcount_lock);
+			rwwriters--;
+			spinlock_release(&rwcount_lock);
+			rwlock_release_write(testrwlock);
+		}
+		else {
+			rwlock_acquire_read(testrwlock);
+			if (rwlock_do_i_hold_write(testrwlock)) {
+				rwfail(num, "reader holds the write lock");
+			}
+			spinlock_acquire(&rwcount_lock);
+			if (rwwriters != 0) {
+				rwfail(num, "reader is in with a writer");
+			}
+			rwreaders++;
+			if (rwreaders > rwmaxreaders) {
+				rwmaxreaders = rwreaders;
+			}
+			spinlock_release(&rwcount_lock);
+
+			if (testval2 != testval1*testval1) {
+				rwfail(num, "saw a half-done write");
+			}
+			thread_yield();
+
+			spinlock_acquire(&rwcount_lock);
+			rwreaders--;
+			spinlock_release(&rwcount_lock);
+			rwlock_release_read(testrwlock);
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = 0;
+	rwmaxreaders = 0;
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("At most %u readers held the lock at once.\n", rwmaxreaders);
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+/*
+ * Fairness test. Every thread takes a lock (or a semaphore used as
+ * one) over and over, holding it for a little while each time, and
+ * times how long each acquire waits. This is run with and without
+ * handoff mode, and the worst and 99th percentile waits are printed
+ * for each. Without handoff, a thread that has just released the lock
+ * usually gets it straight back, so the worst waits are much longer.
+ *
+ * A thread that slept may wake on another cpu, whose cycle counter is
+ * only roughly in step, so the times are approximate.
+ */
+
+static struct semaphore *fairsem;
+static struct lock *fairlock;
+static uint32_t fairwaits[NTHREADS * NFAIRLOOPS];
+
+static
+void
+fairtestthread(void *junk, unsigned long num)
+{
+	uint64_t start, end;
+	volatile int j;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NFAIRLOOPS; i++) {
+		start = getcycles();
+		if (fairlock != NULL) {
+			lock_acquire(fairlock);
+		}
+		else {
+			P(fairsem);
+		}
+		end = getcycles();
+		fairwaits[num * NFAIRLOOPS + i] =
+			end > start ? (uint32_t)(end - start) : 0;
+
+		for (j=0; j<500; j++);
+
+		if (fairlock != NULL) {
+			lock_release(fairlock);
+		}
+		else {
+			V(fairsem);
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+/*
+ * Print the longest and 99th percentile waits. Only the top 1% of the
+ * waits matter for that, so keep just those, largest first.
+ */
+static
+void
+fairreport(const char *what)
+{
+	const unsigned n = NTHREADS * NFAIRLOOPS, k = n / 100 + 1;
+	uint32_t top[NTHREADS * NFAIRLOOPS / 100 + 1];
+	unsigned ntop = 0, i, j;
+	uint32_t rate = getcyclerate();
+
+	for (i=0; i<n; i++) {
+		if (ntop == k && fairwaits[i] <= top[k-1]) {
+			continue;
+		}
+		if (ntop < k) {
+			ntop++;
+		}
+		for (j = ntop-1; j > 0 && top[j-1] < fairwaits[i]; j--) {
+			top[j] = top[j-1];
+		}
+		top[j] = fairwaits[i];
+	}
+
+	kprintf("%-16s max %8llu us, p99 %8llu us\n", what,
+		(uint64_t)top[0] * 1000000 / rate,
+		(uint64_t)top[k-1] * 1000000 / rate);
+}
+
+static
+void
+fairrun(const char *what, bool uselock, bool handoff)
+{
+	int i, result;
+
+	if (uselock) {
+		fairlock = lock_create("fairlock");
+		if (fairlock == NULL) {
+			panic("fairtest: lock_create failed\n");
+		}
+		lock_set_handoff(fairlock, handoff);
+	}
+	else {
+		fairsem = sem_create("fairsem", 1);
+		if (fairsem == NULL) {
+			panic("fairtest: sem_create failed\n");
+		}
+		sem_set_handoff(fairsem, handoff);
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, fairtestthread,
+				     NULL, i);
+		if (result) {
+			panic("fairtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	if (uselock) {
+		lock_destroy(fairlock);
+		fairlock = NULL;
+	}
+	else {
+		sem_destroy(fairsem);
+		fairsem = NULL;
+	}
+	fairreport(what);
+}
+
+int
+fairtest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting fairness test...\n");
+
+	fairrun("semaphore", false, false);
+	fairrun("semaphore handoff", false, true);
+	fairrun("lock", true, false);
+	fairrun("lock handoff", true, true);
+
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Fairness test done.\n");
+
+	return 0;
+}
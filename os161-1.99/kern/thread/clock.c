@@ -28,9 +28,11 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
-#include <wchan.h>
+#include <spinlock.h>
+#include <synch.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
@@ -38,9 +40,13 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * hardclock() runs HZ times a second on each busy cpu, for the
+ * scheduler. Everything else that needs to happen at a particular
+ * time goes through the timers below, which are kept in a heap
+ * ordered by deadline. A one-shot hardware timer (the ltimer) is set
+ * to go off at the earliest deadline, and timerclock() runs whatever
+ * is due when it does. So sleeps have the resolution of the hardware
+ * timer rather than of the tick, and idle cpus don't need ticks.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -53,10 +59,24 @@
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
+/* Initial size of the timer heap; it grows as needed. */
+#define TIMER_HEAPSIZE		32
+
+/* tm_index of a timer that isn't in the heap */
+#define TIMER_IDLE		((unsigned)-1)
+
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * The pending timers, as a binary heap: timer_heap[0] is the one due
+ * first, and each timer is due no earlier than its parent. Protected
+ * by timer_lock.
  */
-static struct wchan *lbolt;
+static struct spinlock timer_lock = SPINLOCK_INITIALIZER;
+static struct timer **timer_heap;
+static unsigned timer_count, timer_max;
+
+/* The hardware timer, once its driver has attached. */
+static void *timer_dev;
+static void (*timer_arm)(void *dev, uint32_t usecs);
 
 /*
  * Setup.
@@ -64,26 +84,265 @@ static struct wchan *lbolt;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	timer_heap = kmalloc(TIMER_HEAPSIZE * sizeof(struct timer *));
+	if (timer_heap == NULL) {
+		panic("Couldn't allocate timer heap\n");
+	}
+	timer_max = TIMER_HEAPSIZE;
+	timer_count = 0;
+}
+
+/*
+ * Time of day in nanoseconds.
+ */
+uint64_t
+gettime_nsecs(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+////////////////////////////////////////////////////////////
+// timer heap
+
+static
+void
+timer_place(unsigned i, struct timer *t)
+{
+	timer_heap[i] = t;
+	t->tm_index = i;
+}
+
+static
+void
+timer_siftup(unsigned i)
+{
+	struct timer *t = timer_heap[i];
+	unsigned parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (timer_heap[parent]->tm_when <= t->tm_when) {
+			break;
+		}
+		timer_place(i, timer_heap[parent]);
+		i = parent;
+	}
+	timer_place(i, t);
+}
+
+static
+void
+timer_siftdown(unsigned i)
+{
+	struct timer *t = timer_heap[i];
+	unsigned child;
+
+	while ((child = 2 * i + 1) < timer_count) {
+		if (child + 1 < timer_count &&
+		    timer_heap[child + 1]->tm_when < timer_heap[child]->tm_when) {
+			child++;
+		}
+		if (t->tm_when <= timer_heap[child]->tm_when) {
+			break;
+		}
+		timer_place(i, timer_heap[child]);
+		i = child;
+	}
+	timer_place(i, t);
+}
+
+/*
+ * Take the timer at index I out of the heap.
+ */
+static
+void
+timer_remove(unsigned i)
+{
+	struct timer *t = timer_heap[i];
+
+	timer_count--;
+	if (i < timer_count) {
+		timer_place(i, timer_heap[timer_count]);
+		timer_siftup(i);
+		timer_siftdown(timer_heap[i]->tm_index);
+	}
+	t->tm_index = TIMER_IDLE;
+}
+
+/*
+ * Set the hardware timer for the earliest deadline. Call with
+ * timer_lock held.
+ */
+static
+void
+timer_program(void)
+{
+	uint64_t now, when, usecs;
+
+	if (timer_count == 0 || timer_arm == NULL) {
+		return;
+	}
+	now = gettime_nsecs();
+	when = timer_heap[0]->tm_when;
+	usecs = when > now ? (when - now + 999) / 1000 : 1;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	if (usecs > 0xffffffff) {
+		usecs = 0xffffffff;
+	}
+	timer_arm(timer_dev, usecs);
+}
+
+/*
+ * Make room for one more timer. The new array has to be allocated
+ * without timer_lock held; if someone else grew the heap meanwhile,
+ * ours is thrown away.
+ */
+static
+int
+timer_grow(void)
+{
+	struct timer **newheap, **oldheap;
+	unsigned newmax;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&timer_lock);
+	newmax = timer_max * 2;
+	spinlock_release(&timer_lock);
+
+	newheap = kmalloc(newmax * sizeof(struct timer *));
+	if (newheap == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&timer_lock);
+	if (newmax > timer_max) {
+		memcpy(newheap, timer_heap, timer_count * sizeof(struct timer *));
+		oldheap = timer_heap;
+		timer_heap = newheap;
+		timer_max = newmax;
+	}
+	else {
+		oldheap = newheap;
+	}
+	spinlock_release(&timer_lock);
+
+	kfree(oldheap);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// timer interface
+
+void
+timer_init(struct timer *t, void (*func)(void *), void *arg)
+{
+	t->tm_when = 0;
+	t->tm_index = TIMER_IDLE;
+	t->tm_next = NULL;
+	t->tm_func = func;
+	t->tm_arg = arg;
+}
+
+int
+timer_start(struct timer *t, uint64_t when)
+{
+	int result;
+
+	spinlock_acquire(&timer_lock);
+	KASSERT(t->tm_index == TIMER_IDLE);
+	while (timer_count == timer_max) {
+		spinlock_release(&timer_lock);
+		result = timer_grow();
+		if (result) {
+			return result;
+		}
+		spinlock_acquire(&timer_lock);
+	}
+
+	t->tm_when = when;
+	timer_place(timer_count, t);
+	timer_count++;
+	timer_siftup(t->tm_index);
+	if (t->tm_index == 0) {
+		/* new earliest deadline */
+		timer_program();
 	}
+	spinlock_release(&timer_lock);
+	return 0;
+}
+
+bool
+timer_stop(struct timer *t)
+{
+	bool wasqueued;
+
+	spinlock_acquire(&timer_lock);
+	wasqueued = t->tm_index != TIMER_IDLE;
+	if (wasqueued) {
+		timer_remove(t->tm_index);
+	}
+	spinlock_release(&timer_lock);
+	return wasqueued;
 }
 
 /*
- * This is called once per second, on one processor, by the timer
- * code.
+ * Called by the hardware timer's driver. The hardware timer is set for
+ * the earliest deadline, but check the time anyway: the timer may have
+ * been set again since this interrupt was raised. Timers that are due
+ * are taken out of the heap first and their functions called after
+ * the lock is dropped, so they can start timers themselves.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	wchan_wakeall(lbolt);
+	struct timer *due = NULL, *t, *next;
+	uint64_t now;
+
+	spinlock_acquire(&timer_lock);
+	now = gettime_nsecs();
+	while (timer_count > 0 && timer_heap[0]->tm_when <= now) {
+		t = timer_heap[0];
+		timer_remove(0);
+		t->tm_next = due;
+		due = t;
+	}
+	timer_program();
+	spinlock_release(&timer_lock);
+
+	for (t = due; t != NULL; t = next) {
+		/* T may be gone as soon as its function has run */
+		next = t->tm_next;
+		t->tm_func(t->tm_arg);
+	}
+}
+
+/*
+ * Called by the driver of the one-shot hardware timer. ARM(DEV, USECS)
+ * must make it interrupt once, USECS microseconds from now, replacing
+ * any earlier setting; the interrupt handler then calls timerclock().
+ */
+void
+timerclock_attach(void *dev, void (*arm)(void *dev, uint32_t usecs))
+{
+	spinlock_acquire(&timer_lock);
+	if (timer_arm == NULL) {
+		timer_dev = dev;
+		timer_arm = arm;
+		timer_program();
+	}
+	spinlock_release(&timer_lock);
 }
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, except while the processor is idle.
  */
 void
 hardclock(void)
@@ -102,15 +361,77 @@ hardclock(void)
 	thread_yield();
 }
 
+////////////////////////////////////////////////////////////
+// sleeping
+
+/*
+ * Timer function for clocknanosleep: wake the one thread waiting on
+ * this timer's semaphore.
+ */
+static
+void
+clock_wakeup(void *arg)
+{
+	struct semaphore *sem = arg;
+
+	V(sem);
+}
+
+/*
+ * Suspend execution for NSECS nanoseconds. Each sleeper waits on a
+ * semaphore of its own, so a timer going off wakes only the thread it
+ * belongs to. If the sleep is interrupted, what was left of it goes in
+ * *REMAINING (if not NULL).
+ */
+int
+clocknanosleep(uint64_t nsecs, uint64_t *remaining)
+{
+	struct timer t;
+	struct semaphore *sem;
+	uint64_t when, now;
+	int result;
+
+	sem = sem_create("nanosleep", 0);
+	if (sem == NULL) {
+		return ENOMEM;
+	}
+
+	when = gettime_nsecs() + nsecs;
+	timer_init(&t, clock_wakeup, sem);
+	result = timer_start(&t, when);
+	if (result) {
+		sem_destroy(sem);
+		return result;
+	}
+
+	result = P_intr(sem);
+	if (result) {
+		/*
+		 * If the timer has already been taken off the heap,
+		 * its function may be running now; it uses T and SEM,
+		 * so wait for it to finish.
+		 */
+		if (!timer_stop(&t)) {
+			P(sem);
+		}
+		if (remaining != NULL) {
+			now = gettime_nsecs();
+			*remaining = now < when ? when - now : 0;
+		}
+	}
+	sem_destroy(sem);
+	return result;
+}
+
 /*
  * Suspend execution for n seconds.
  */
 void
 clocksleep(int num_secs)
 {
-	while (num_secs > 0) {
-		wchan_lock(lbolt);
-		wchan_sleep(lbolt);
-		num_secs--;
+	if (num_secs <= 0) {
+		return;
 	}
+	/* Out of memory for the timer: best we can do is not sleep */
+	(void)clocknanosleep((uint64_t)num_secs * 1000000000, NULL);
 }
@@ -0,0 +1,128 @@
+/*
+ * Epoch-based deferred freeing. See <epoch.h>.
+ *
+ * Deferred callbacks are collected on a list, and a kernel thread
+ * waits for a grace period and then runs everything that was on the
+ * list when the wait started. Batching them this way means one wait
+ * covers any number of frees.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <epoch.h>
+
+static struct spinlock epoch_lock = SPINLOCK_INITIALIZER;
+static struct epoch_cb *epoch_pending;
+static struct wchan *epoch_wchan;
+
+void
+epoch_enter(void)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+}
+
+void
+epoch_exit(void)
+{
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Wait until every cpu has taken a timer interrupt or been seen idle.
+ * (Idle cpus don't get hardclocks, but the idle loop is never inside
+ * a read section.) The cpus are checked one after another; a cpu
+ * whose count has already moved on since we started costs nothing,
+ * so this usually takes about one tick however many cpus there are.
+ */
+void
+epoch_synchronize(void)
+{
+	struct cpu *c;
+	unsigned i, start;
+
+	KASSERT(curthread->t_curspl == 0);
+
+	for (i = 0; i < cpu_count(); i++) {
+		c = cpu_get(i);
+		start = c->c_hardclocks;
+		while (c->c_hardclocks == start && !c->c_isidle) {
+			thread_yield();
+		}
+	}
+}
+
+void
+epoch_defer(struct epoch_cb *cb, void (*func)(void *), void *arg)
+{
+	cb->ec_func = func;
+	cb->ec_arg = arg;
+
+	spinlock_acquire(&epoch_lock);
+	cb->ec_next = epoch_pending;
+	epoch_pending = cb;
+	if (epoch_wchan != NULL) {
+		wchan_wakeone(epoch_wchan);
+	}
+	spinlock_release(&epoch_lock);
+}
+
+static
+void
+epoch_thread(void *unused1, unsigned long unused2)
+{
+	struct epoch_cb *cb, *next;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		spinlock_acquire(&epoch_lock);
+		while (epoch_pending == NULL) {
+			wchan_lock(epoch_wchan);
+			spinlock_release(&epoch_lock);
+			wchan_sleep(epoch_wchan);
+			spinlock_acquire(&epoch_lock);
+		}
+		cb = epoch_pending;
+		epoch_pending = NULL;
+		spinlock_release(&epoch_lock);
+
+		epoch_synchronize();
+
+		for (; cb != NULL; cb = next) {
+			/* the callback probably frees CB */
+			next = cb->ec_next;
+			cb->ec_func(cb->ec_arg);
+		}
+	}
+}
+
+/*
+ * Start the thread that runs deferred callbacks. Anything deferred
+ * before this just waits on the list until the thread gets to it.
+ */
+void
+epoch_bootstrap(void)
+{
+	struct wchan *wc;
+	int result;
+
+	wc = wchan_create("epoch");
+	if (wc == NULL) {
+		panic("epoch_bootstrap: Out of memory\n");
+	}
+	spinlock_acquire(&epoch_lock);
+	epoch_wchan = wc;
+	spinlock_release(&epoch_lock);
+
+	result = thread_fork("epoch", NULL, epoch_thread, NULL, 0);
+	if (result) {
+		panic("epoch_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+}
@@ -0,0 +1,228 @@
+/*
+ * Statistical kernel profiler. See <prof.h>.
+ *
+ * Each cpu only counts into its own histograms, from its own timer
+ * interrupt, so no locks are needed.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <vfs.h>
+#include <prof.h>
+
+/* 16 bytes (four instructions) per bucket */
+#define PROF_SHIFT 4
+
+/* buckets written at a time by prof_dump */
+#define PROF_CHUNK 128
+
+/*
+ * Kernel text runs from the exception vectors at the bottom of kseg0
+ * to _etext, which the linker sets. User programs are linked at
+ * 0x400000; only the first PROF_USIZE bytes of them are covered.
+ */
+#define PROF_KBASE  MIPS_KSEG0
+#define PROF_UBASE  0x00400000
+#define PROF_USIZE  0x20000
+
+extern char _etext[];
+
+struct profbuf {
+	uint32_t *pb_kcounts;		/* kernel text histogram */
+	uint32_t *pb_ucounts;		/* user text histogram */
+	uint32_t pb_other;		/* samples outside both */
+};
+
+static bool prof_enabled = false;
+
+/* true once every cpu's histograms have been allocated */
+static bool prof_allocated = false;
+
+static
+unsigned
+prof_nkbuckets(void)
+{
+	vaddr_t etext = (vaddr_t)_etext;
+
+	return (etext - PROF_KBASE + (1 << PROF_SHIFT) - 1) >> PROF_SHIFT;
+}
+
+static
+unsigned
+prof_nubuckets(void)
+{
+	return PROF_USIZE >> PROF_SHIFT;
+}
+
+/*
+ * The histograms themselves are only allocated when profiling is
+ * first started.
+ */
+struct profbuf *
+profbuf_create(void)
+{
+	struct profbuf *pb;
+
+	pb = kmalloc(sizeof(*pb));
+	if (pb == NULL) {
+		return NULL;
+	}
+	pb->pb_kcounts = NULL;
+	pb->pb_ucounts = NULL;
+	pb->pb_other = 0;
+	return pb;
+}
+
+/*
+ * Count a sample. Called from the timer interrupt with the PC it
+ * interrupted.
+ */
+void
+prof_sample(vaddr_t pc)
+{
+	struct profbuf *pb;
+	vaddr_t etext = (vaddr_t)_etext;
+
+	if (!prof_enabled) {
+		return;
+	}
+	pb = curcpu->c_prof;
+
+	if (pc >= PROF_KBASE && pc < etext) {
+		pb->pb_kcounts[(pc - PROF_KBASE) >> PROF_SHIFT]++;
+	}
+	else if (pc >= PROF_UBASE && pc < PROF_UBASE + PROF_USIZE) {
+		pb->pb_ucounts[(pc - PROF_UBASE) >> PROF_SHIFT]++;
+	}
+	else {
+		pb->pb_other++;
+	}
+}
+
+int
+prof_start(void)
+{
+	struct profbuf *pb;
+	size_t ksize, usize;
+	unsigned i;
+
+	prof_stop();
+
+	ksize = prof_nkbuckets() * sizeof(uint32_t);
+	usize = prof_nubuckets() * sizeof(uint32_t);
+	for (i = 0; i < cpu_count(); i++) {
+		pb = cpu_get(i)->c_prof;
+		if (pb->pb_kcounts == NULL) {
+			pb->pb_kcounts = kmalloc(ksize);
+			if (pb->pb_kcounts == NULL) {
+				return ENOMEM;
+			}
+		}
+		if (pb->pb_ucounts == NULL) {
+			pb->pb_ucounts = kmalloc(usize);
+			if (pb->pb_ucounts == NULL) {
+				return ENOMEM;
+			}
+		}
+		bzero(pb->pb_kcounts, ksize);
+		bzero(pb->pb_ucounts, usize);
+		pb->pb_other = 0;
+	}
+	prof_allocated = true;
+	prof_enabled = true;
+	return 0;
+}
+
+void
+prof_stop(void)
+{
+	prof_enabled = false;
+}
+
+/*
+ * Write the total of all cpus' counts for the kernel or the user
+ * histogram. Goes a chunk at a time to keep the buffer on the stack
+ * small.
+ */
+static
+int
+prof_write_counts(struct vnode *vn, bool user, unsigned nbuckets,
+		  off_t *pos)
+{
+	uint32_t sums[PROF_CHUNK];
+	struct profbuf *pb;
+	uint32_t *counts;
+	unsigned base, n, i, c;
+	int result;
+
+	for (base = 0; base < nbuckets; base += n) {
+		n = nbuckets - base;
+		if (n > PROF_CHUNK) {
+			n = PROF_CHUNK;
+		}
+		bzero(sums, sizeof(sums));
+		for (c = 0; c < cpu_count(); c++) {
+			pb = cpu_get(c)->c_prof;
+			counts = user ? pb->pb_ucounts : pb->pb_kcounts;
+			for (i = 0; i < n; i++) {
+				sums[i] += counts[base + i];
+			}
+		}
+
+		result = vfs_kwrite(vn, sums, n * sizeof(uint32_t), pos);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+int
+prof_dump(const char *path)
+{
+	struct prof_header ph;
+	struct vnode *vn;
+	unsigned i;
+	off_t pos = 0;
+	int result;
+
+	prof_stop();
+
+	if (!prof_allocated) {
+		kprintf("prof: Profiling was never started\n");
+		return EINVAL;
+	}
+
+	ph.ph_magic = PROF_MAGIC;
+	ph.ph_hz = HZ;
+	ph.ph_shift = PROF_SHIFT;
+	ph.ph_kbase = PROF_KBASE;
+	ph.ph_nkbuckets = prof_nkbuckets();
+	ph.ph_ubase = PROF_UBASE;
+	ph.ph_nubuckets = prof_nubuckets();
+	ph.ph_other = 0;
+	for (i = 0; i < cpu_count(); i++) {
+		ph.ph_other += cpu_get(i)->c_prof->pb_other;
+	}
+
+	result = vfs_kcreate(path, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = vfs_kwrite(vn, &ph, sizeof(ph), &pos);
+	if (result == 0) {
+		result = prof_write_counts(vn, false, ph.ph_nkbuckets, &pos);
+	}
+	if (result == 0) {
+		result = prof_write_counts(vn, true, ph.ph_nubuckets, &pos);
+	}
+
+	vfs_close(vn);
+	return result;
+}
@@ -71,6 +71,8 @@ sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+  sem->sem_waiters = 0;
+  sem->sem_handoff = false;
 
         return sem;
 }
@@ -87,6 +89,16 @@ sem_destroy(struct semaphore *sem)
         kfree(sem);
 }
 
+void
+sem_set_handoff(struct semaphore *sem, bool handoff)
+{
+  KASSERT(sem != NULL);
+  spinlock_acquire(&sem->sem_lock);
+  KASSERT(sem->sem_waiters == 0);
+  sem->sem_handoff = handoff;
+  spinlock_release(&sem->sem_lock);
+}
+
 void 
 P(struct semaphore *sem)
 {
@@ -101,6 +113,19 @@ P(struct semaphore *sem)
         KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&sem->sem_lock);
+  if (sem->sem_handoff && sem->sem_count == 0) {
+    /*
+     * In handoff mode V doesn't touch the count while anyone is
+     * waiting; it takes a waiter off sem_waiters and wakes it,
+     * and that wakeup is our unit. wchan_wakeone is FIFO, so it
+     * goes to whoever has waited longest.
+     */
+    sem->sem_waiters++;
+    wchan_lock(sem->sem_wchan);
+    spinlock_release(&sem->sem_lock);
+    wchan_sleep(sem->sem_wchan);
+    return;
+  }
         while (sem->sem_count == 0) {
 		/*
 		 * Bridge to the wchan lock, so if someone else comes
@@ -116,19 +141,50 @@ P(struct semaphore *sem)
 		 * strict ordering. Too bad. :-)
 		 *
 		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * ordering? (Answer: see sem_set_handoff.)
 		 */
+    sem->sem_waiters++;
 		wchan_lock(sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
                 wchan_sleep(sem->sem_wchan);
 
 		spinlock_acquire(&sem->sem_lock);
+    sem->sem_waiters--;
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+P_intr(struct semaphore *sem)
+{
+  int result;
+
+  KASSERT(sem != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+
+  spinlock_acquire(&sem->sem_lock);
+  KASSERT(!sem->sem_handoff);
+  while (sem->sem_count == 0) {
+    sem->sem_waiters++;
+    wchan_lock(sem->sem_wchan);
+    spinlock_release(&sem->sem_lock);
+    result = wchan_sleep_intr(sem->sem_wchan);
+
+    spinlock_acquire(&sem->sem_lock);
+    sem->sem_waiters--;
+    if (result) {
+      spinlock_release(&sem->sem_lock);
+      return result;
+    }
+  }
+  KASSERT(sem->sem_count > 0);
+  sem->sem_count--;
+  spinlock_release(&sem->sem_lock);
+  return 0;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -136,6 +192,14 @@ V(struct semaphore *sem)
 
 	spinlock_acquire(&sem->sem_lock);
 
+  if (sem->sem_handoff && sem->sem_waiters > 0) {
+    /* the count stays 0, so nobody else can take this unit */
+    sem->sem_waiters--;
+    wchan_wakeone(sem->sem_wchan);
+    spinlock_release(&sem->sem_lock);
+    return;
+  }
+
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
 	wchan_wakeone(sem->sem_wchan);
@@ -153,11 +217,24 @@ lock_acquire(struct lock *lock)
   KASSERT(lock != NULL);
   KASSERT(curthread->t_in_interrupt == false);
   spinlock_acquire(&lock->lock_spinlock);
-  while (lock->t != NULL) {
+  if (lock->lock_handoff && (lock->t != NULL || lock->lock_passing)) {
+    // lock_release passes the lock to us by setting lock_passing
+    // and waking us, oldest waiter first
+    lock->lock_waiters++;
     wchan_lock(lock->lock_wchan);
     spinlock_release(&lock->lock_spinlock);
     wchan_sleep(lock->lock_wchan);
     spinlock_acquire(&lock->lock_spinlock);
+    KASSERT(lock->lock_passing);
+    lock->lock_passing = false;
+  }
+  while (lock->t != NULL || lock->lock_passing) {
+    lock->lock_waiters++;
+    wchan_lock(lock->lock_wchan);
+    spinlock_release(&lock->lock_spinlock);
+    wchan_sleep(lock->lock_wchan);
+    spinlock_acquire(&lock->lock_spinlock);
+    lock->lock_waiters--;
   }
   lock->t = curthread;
   KASSERT(lock_do_i_hold(lock));
@@ -171,10 +248,25 @@ lock_release(struct lock *lock)
   spinlock_acquire(&lock->lock_spinlock);
   lock->t = NULL;
   KASSERT(lock->t == NULL);
+  if (lock->lock_handoff && lock->lock_waiters > 0) {
+    // keep newcomers out until the woken thread takes over
+    lock->lock_waiters--;
+    lock->lock_passing = true;
+  }
   wchan_wakeone(lock->lock_wchan);
   spinlock_release(&lock->lock_spinlock);
 }
 
+void
+lock_set_handoff(struct lock *lock, bool handoff)
+{
+  KASSERT(lock != NULL);
+  spinlock_acquire(&lock->lock_spinlock);
+  KASSERT(lock->lock_waiters == 0);
+  lock->lock_handoff = handoff;
+  spinlock_release(&lock->lock_spinlock);
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -207,6 +299,9 @@ lock_create(const char *name)
 
   spinlock_init(&lock->lock_spinlock);
   lock->t = NULL;
+  lock->lock_waiters = 0;
+  lock->lock_handoff = false;
+  lock->lock_passing = false;
         
         return lock;
 }
@@ -285,6 +380,29 @@ spinlock_release(&cv->cv_spinlock);
   lock_acquire(lock);
 }
 
+/*
+ * An interrupted waiter leaves num_of_waiting one too high. That only
+ * costs a later cv_signal a wakeup with nobody to wake; the count is
+ * never lower than the number of sleepers.
+ */
+int
+cv_wait_intr(struct cv *cv, struct lock *lock)
+{
+  int result;
+
+  KASSERT(cv != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+  KASSERT(lock_do_i_hold(lock));
+spinlock_acquire(&cv->cv_spinlock);
+  cv->num_of_waiting = cv->num_of_waiting + 1;
+  wchan_lock(cv->cv_wchan);
+  lock_release(lock);
+spinlock_release(&cv->cv_spinlock);
+  result = wchan_sleep_intr(cv->cv_wchan);
+  lock_acquire(lock);
+  return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -310,3 +428,136 @@ spinlock_acquire(&cv->cv_spinlock);
   }
 spinlock_release(&cv->cv_spinlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+  struct rwlock *rw;
+
+  rw = kmalloc(sizeof(struct rwlock));
+  if (rw == NULL) {
+    return NULL;
+  }
+  rw->rwlock_name = kstrdup(name);
+  if (rw->rwlock_name == NULL) {
+    kfree(rw);
+    return NULL;
+  }
+  rw->rwlock_readwchan = wchan_create(rw->rwlock_name);
+  if (rw->rwlock_readwchan == NULL) {
+    kfree(rw->rwlock_name);
+    kfree(rw);
+    return NULL;
+  }
+  rw->rwlock_writewchan = wchan_create(rw->rwlock_name);
+  if (rw->rwlock_writewchan == NULL) {
+    wchan_destroy(rw->rwlock_readwchan);
+    kfree(rw->rwlock_name);
+    kfree(rw);
+    return NULL;
+  }
+  spinlock_init(&rw->rwlock_spinlock);
+  rw->rwlock_readers = 0;
+  rw->rwlock_waitingwriters = 0;
+  rw->rwlock_writer = NULL;
+  return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+  KASSERT(rw != NULL);
+  KASSERT(rw->rwlock_readers == 0);
+  KASSERT(rw->rwlock_writer == NULL);
+  KASSERT(rw->rwlock_waitingwriters == 0);
+
+  spinlock_cleanup(&rw->rwlock_spinlock);
+  wchan_destroy(rw->rwlock_writewchan);
+  wchan_destroy(rw->rwlock_readwchan);
+  kfree(rw->rwlock_name);
+  kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+  KASSERT(rw != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+  KASSERT(rw->rwlock_writer != curthread);
+
+  spinlock_acquire(&rw->rwlock_spinlock);
+  while (rw->rwlock_writer != NULL || rw->rwlock_waitingwriters > 0) {
+    wchan_lock(rw->rwlock_readwchan);
+    spinlock_release(&rw->rwlock_spinlock);
+    wchan_sleep(rw->rwlock_readwchan);
+    spinlock_acquire(&rw->rwlock_spinlock);
+  }
+  rw->rwlock_readers++;
+  spinlock_release(&rw->rwlock_spinlock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+  KASSERT(rw != NULL);
+
+  spinlock_acquire(&rw->rwlock_spinlock);
+  KASSERT(rw->rwlock_readers > 0);
+  rw->rwlock_readers--;
+  if (rw->rwlock_readers == 0 && rw->rwlock_waitingwriters > 0) {
+    wchan_wakeone(rw->rwlock_writewchan);
+  }
+  spinlock_release(&rw->rwlock_spinlock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+  KASSERT(rw != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+  KASSERT(rw->rwlock_writer != curthread);
+
+  spinlock_acquire(&rw->rwlock_spinlock);
+  rw->rwlock_waitingwriters++;
+  while (rw->rwlock_writer != NULL || rw->rwlock_readers > 0) {
+    wchan_lock(rw->rwlock_writewchan);
+    spinlock_release(&rw->rwlock_spinlock);
+    wchan_sleep(rw->rwlock_writewchan);
+    spinlock_acquire(&rw->rwlock_spinlock);
+  }
+  rw->rwlock_waitingwriters--;
+  rw->rwlock_writer = curthread;
+  spinlock_release(&rw->rwlock_spinlock);
+}
+
+/*
+ * Hand off to the next writer if there is one; otherwise let all the
+ * waiting readers in together.
+ */
+void
+rwlock_release_write(struct rwlock *rw)
+{
+  KASSERT(rw != NULL);
+  KASSERT(rwlock_do_i_hold_write(rw));
+
+  spinlock_acquire(&rw->rwlock_spinlock);
+  rw->rwlock_writer = NULL;
+  if (rw->rwlock_waitingwriters > 0) {
+    wchan_wakeone(rw->rwlock_writewchan);
+  }
+  else {
+    wchan_wakeall(rw->rwlock_readwchan);
+  }
+  spinlock_release(&rw->rwlock_spinlock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+  KASSERT(rw != NULL);
+  return (rw->rwlock_writer == curthread);
+}
@@ -49,7 +49,11 @@
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
+#include <clock.h>
 #include <vnode.h>
+#include <trace.h>
+#include <prof.h>
+#include <syscall.h>
 
 #include "opt-synchprobs.h"
 
@@ -69,6 +73,12 @@ DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
 static struct cpuarray allcpus;
 
+/*
+ * Protects every thread's t_intrwchan. Taken before a wchan lock,
+ * never while holding one.
+ */
+static struct spinlock thread_intrlock = SPINLOCK_INITIALIZER;
+
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
@@ -112,34 +122,51 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set a thread's name. Short names are copied into the thread itself
+ * so that reusing a cached thread doesn't need to allocate anything.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_setname(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+		return 0;
 	}
-
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
 	}
+	thread->t_name = NULL;
+}
+
+/*
+ * Set up everything in a new or reused thread except its name and
+ * stack.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -150,6 +177,31 @@ thread_create(const char *name)
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
 	/* If you add to struct thread, be sure to initialize here */
+	thread->t_ustackslot = -1;
+	thread->t_intrwchan = NULL;
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+	thread_init(thread);
+	thread->t_stack = NULL;
 
 	return thread;
 }
@@ -179,6 +231,7 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 
 	c->c_isidle = false;
@@ -187,8 +240,24 @@ cpu_create(unsigned hardware_number)
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_sent = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+	/* before the cpu is in allcpus, where they can be found */
+	c->c_trace = tracebuf_create();
+	if (c->c_trace == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_syscallstats = syscallstats_create();
+	if (c->c_syscallstats == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_prof = profbuf_create();
+	if (c->c_prof == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
@@ -227,6 +296,22 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Number of cpus, and cpu number N. The cpu array only changes during
+ * boot, so these don't need a lock.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned n)
+{
+	return cpuarray_get(&allcpus, n);
+}
+
 /*
  * Destroy a thread.
  *
@@ -258,10 +343,68 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	thread_freename(thread);
 	kfree(thread);
 }
 
+/*
+ * Keep a dead thread and its stack on this cpu's cache for
+ * thread_fork, or destroy it if the cache is full. Called from
+ * exorcise(), so interrupts are off.
+ */
+static
+void
+thread_cache_put(struct thread *thread)
+{
+	struct threadlist *cache = &curcpu->c_threadcache;
+
+	KASSERT(thread->t_proc == NULL);
+
+	if (thread->t_stack == NULL || cache->tl_count >= THREAD_CACHE_MAX) {
+		thread_destroy(thread);
+		return;
+	}
+
+	/* the stack magic is still there from when it was first set up */
+	thread_checkstack(thread);
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread_freename(thread);
+	thread->t_wchan_name = "CACHED";
+
+	/* last in, first out, so the stack is more likely still cached */
+	threadlist_addhead(cache, thread);
+}
+
+/*
+ * Take a thread from this cpu's cache and set it up as if it were
+ * new, or return NULL if the cache is empty. A long name still has to
+ * be allocated; if that fails the thread goes back in the cache.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	/* exorcise() adds to the cache from thread_switch */
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	thread_init(thread);
+	if (thread_setname(thread, name)) {
+		spl = splhigh();
+		threadlist_addhead(&curcpu->c_threadcache, thread);
+		splx(spl);
+		return NULL;
+	}
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
@@ -277,7 +420,7 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		thread_cache_put(z);
 	}
 }
 
@@ -487,18 +630,22 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Reuse an exited thread and its stack if there is one */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -548,6 +695,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	bool ticksoff;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -629,16 +777,28 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
-	/* The current cpu is now idle. */
+	/*
+	 * The current cpu is now idle. If it has to wait, it does so
+	 * without hardclocks; anything due at a particular time is on
+	 * the timer heap, which doesn't depend on them.
+	 */
 	curcpu->c_isidle = true;
+	ticksoff = false;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+			if (!ticksoff) {
+				hardclock_stop();
+				ticksoff = true;
+			}
 			cpu_idle();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
+	if (ticksoff) {
+		hardclock_start();
+	}
 	curcpu->c_isidle = false;
 
 	/*
@@ -648,6 +808,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * assume the compiler will optimize one away if they're the
 	 * same.
 	 */
+	TRACE(TRACE_SWITCH, next, newstate);
+
 	curcpu->c_curthread = next;
 	curthread = next;
 
@@ -1025,9 +1187,88 @@ wchan_sleep(struct wchan *wc)
 	/* may not sleep in an interrupt handler */
 	KASSERT(!curthread->t_in_interrupt);
 
+	TRACE(TRACE_SLEEP, wc, 0);
 	thread_switch(S_SLEEP, wc);
 }
 
+/*
+ * True if the current thread's process is exiting.
+ */
+static
+bool
+thread_killed(void)
+{
+	struct proc *p = curthread->t_proc;
+
+	return p != NULL && p->p_exiting;
+}
+
+/*
+ * Interruptible sleep. t_intrwchan is set with WC locked, before
+ * p_exiting is checked, and thread_interrupt sets p_exiting before
+ * looking at t_intrwchan; so either we see the process exiting or
+ * thread_interrupt finds us. Clearing t_intrwchan takes
+ * thread_intrlock, which keeps WC alive while thread_interrupt might
+ * still be about to lock it.
+ */
+int
+wchan_sleep_intr(struct wchan *wc)
+{
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	curthread->t_intrwchan = wc;
+	if (thread_killed()) {
+		wchan_unlock(wc);
+	}
+	else {
+		TRACE(TRACE_SLEEP, wc, 0);
+		thread_switch(S_SLEEP, wc);
+	}
+
+	spinlock_acquire(&thread_intrlock);
+	curthread->t_intrwchan = NULL;
+	spinlock_release(&thread_intrlock);
+
+	return thread_killed() ? EINTR : 0;
+}
+
+void
+thread_interrupt(struct thread *t)
+{
+	struct wchan *wc;
+	struct threadlistnode *tln;
+	bool found = false;
+
+	KASSERT(t != curthread);
+
+	spinlock_acquire(&thread_intrlock);
+	wc = t->t_intrwchan;
+	if (wc == NULL) {
+		spinlock_release(&thread_intrlock);
+		return;
+	}
+	spinlock_acquire(&wc->wc_lock);
+	/* it may have been woken already, or not be asleep yet */
+	for (tln = wc->wc_threads.tl_head.tln_next; tln->tln_self != NULL;
+	     tln = tln->tln_next) {
+		if (tln->tln_self == t) {
+			found = true;
+			break;
+		}
+	}
+	if (found) {
+		threadlist_remove(&wc->wc_threads, t);
+	}
+	spinlock_release(&wc->wc_lock);
+	spinlock_release(&thread_intrlock);
+
+	if (found) {
+		TRACE(TRACE_WAKE, wc, t);
+		thread_make_runnable(t, false);
+	}
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1050,6 +1291,7 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
+	TRACE(TRACE_WAKE, wc, target);
 	thread_make_runnable(target, false);
 }
 
@@ -1084,6 +1326,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		TRACE(TRACE_WAKE, wc, target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1155,6 +1398,7 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+	target->c_shootdown_sent++;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
@@ -1162,6 +1406,54 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Wait until C has carried out every shootdown queued for it so far,
+ * ours included. C does all of its queue at once, so this takes at
+ * most one more of its IPIs even if others keep sending.
+ */
+static
+void
+ipi_tlbshootdown_wait(struct cpu *c)
+{
+	unsigned target;
+	bool done;
+
+	spinlock_acquire(&c->c_ipi_lock);
+	target = c->c_shootdown_sent;
+	spinlock_release(&c->c_ipi_lock);
+
+	do {
+		spinlock_acquire(&c->c_ipi_lock);
+		done = (int)(c->c_shootdown_done - target) >= 0;
+		spinlock_release(&c->c_ipi_lock);
+	} while (!done);
+}
+
+void
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i;
+	struct cpu *c;
+
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+		}
+	}
+
+	/*
+	 * Wait for all of them. That includes this cpu: if we have
+	 * moved since the loop above, a shootdown we sent may be
+	 * waiting here, and it comes in as soon as the lock drops.
+	 */
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		ipi_tlbshootdown_wait(cpuarray_get(&allcpus, i));
+	}
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -1202,6 +1494,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_sent;
 	}
 
 	curcpu->c_ipi_pending = 0;
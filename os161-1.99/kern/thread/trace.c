@@ -0,0 +1,158 @@
+/*
+ * Kernel event tracing. See <trace.h>.
+ *
+ * Each cpu has a ring of TRACE_NRECORDS records. tb_next counts every
+ * event ever recorded on the cpu, so the ring holds events
+ * tb_next - TRACE_NRECORDS (or 0) through tb_next - 1.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vfs.h>
+#include <trace.h>
+
+#define TRACE_NRECORDS 1024
+
+struct tracebuf {
+	unsigned tb_next;		/* count of events recorded */
+	struct trace_record tb_records[TRACE_NRECORDS];
+};
+
+bool trace_enabled = false;
+
+struct tracebuf *
+tracebuf_create(void)
+{
+	struct tracebuf *tb;
+
+	tb = kmalloc(sizeof(*tb));
+	if (tb == NULL) {
+		return NULL;
+	}
+	tb->tb_next = 0;
+	return tb;
+}
+
+/*
+ * Record an event. Called through TRACE(). Interrupts are off while
+ * the record is filled in, so it can't be interleaved with another
+ * event on this cpu, and no other cpu writes this ring.
+ */
+void
+trace_event(unsigned type, uint32_t arg1, uint32_t arg2)
+{
+	struct tracebuf *tb;
+	struct trace_record *tr;
+	uint64_t now;
+	int spl;
+
+	spl = splhigh();
+	tb = curcpu->c_trace;
+	now = getcycles();
+
+	tr = &tb->tb_records[tb->tb_next % TRACE_NRECORDS];
+	tb->tb_next++;
+
+	tr->tr_cyclehi = now >> 32;
+	tr->tr_cyclelo = now & 0xffffffff;
+	tr->tr_thread = (uintptr_t)curthread;
+	tr->tr_type = type;
+	tr->tr_cpu = curcpu->c_number;
+	tr->tr_arg1 = arg1;
+	tr->tr_arg2 = arg2;
+	splx(spl);
+}
+
+void
+trace_start(void)
+{
+	unsigned i;
+
+	trace_stop();
+	for (i = 0; i < cpu_count(); i++) {
+		cpu_get(i)->c_trace->tb_next = 0;
+	}
+	trace_enabled = true;
+}
+
+/*
+ * Doesn't wait for other cpus: a TRACE() that had already seen
+ * trace_enabled set may still add its record.
+ */
+void
+trace_stop(void)
+{
+	trace_enabled = false;
+}
+
+/*
+ * Number of records in the ring and the index of the oldest.
+ */
+static
+unsigned
+tracebuf_count(struct tracebuf *tb, unsigned *first)
+{
+	if (tb->tb_next <= TRACE_NRECORDS) {
+		*first = 0;
+		return tb->tb_next;
+	}
+	*first = tb->tb_next % TRACE_NRECORDS;
+	return TRACE_NRECORDS;
+}
+
+/*
+ * Stop tracing and write everything in the rings to PATH, oldest
+ * first within each cpu.
+ */
+int
+trace_dump(const char *path)
+{
+	struct trace_header th;
+	struct tracebuf *tb;
+	struct vnode *vn;
+	unsigned i, first, count;
+	off_t pos = 0;
+	int result;
+
+	trace_stop();
+
+	th.th_magic = TRACE_MAGIC;
+	th.th_cyclerate = getcyclerate();
+	th.th_ncpus = cpu_count();
+	th.th_nrecords = 0;
+	for (i = 0; i < cpu_count(); i++) {
+		th.th_nrecords += tracebuf_count(cpu_get(i)->c_trace, &first);
+	}
+
+	result = vfs_kcreate(path, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = vfs_kwrite(vn, &th, sizeof(th), &pos);
+	for (i = 0; i < cpu_count() && result == 0; i++) {
+		tb = cpu_get(i)->c_trace;
+		count = tracebuf_count(tb, &first);
+		if (first + count > TRACE_NRECORDS) {
+			/* the ring has wrapped; write the older half first */
+			result = vfs_kwrite(vn, &tb->tb_records[first],
+				(TRACE_NRECORDS - first) *
+				sizeof(struct trace_record), &pos);
+			count -= TRACE_NRECORDS - first;
+			first = 0;
+			if (result) {
+				break;
+			}
+		}
+		result = vfs_kwrite(vn, &tb->tb_records[first],
+				    count * sizeof(struct trace_record), &pos);
+	}
+
+	vfs_close(vn);
+	return result;
+}
@@ -463,3 +463,117 @@ dev_create_vnode(struct device *dev)
 
 	return v;
 }
+
+/*
+ * Synchronous I/O for devices that have d_submit.
+ *
+ * The device moves the data from its interrupt handler, which can't
+ * touch user memory, so user transfers go through a kernel buffer a
+ * piece at a time.
+ */
+
+#define DEV_BOUNCESIZE 4096
+
+struct devwait {
+	struct semaphore *dw_sem;
+	int dw_result;
+};
+
+static
+void
+dev_syncdone(struct devreq *dr, int result)
+{
+	struct devwait *dw = dr->dr_data;
+
+	dw->dw_result = result;
+	V(dw->dw_sem);
+}
+
+/*
+ * Submit one kernel-space transfer and sleep until it's done.
+ */
+static
+int
+dev_waitio(struct device *d, struct uio *uio, struct semaphore *sem)
+{
+	struct devreq dr;
+	struct devwait dw;
+	int result;
+
+	dw.dw_sem = sem;
+	dw.dw_result = 0;
+	dr.dr_uio = uio;
+	dr.dr_done = dev_syncdone;
+	dr.dr_data = &dw;
+	dr.dr_next = NULL;
+
+	result = d->d_submit(d, &dr);
+	if (result) {
+		return result;
+	}
+	P(sem);
+	return dw.dw_result;
+}
+
+int
+dev_syncio(struct device *d, struct uio *uio)
+{
+	struct semaphore *sem;
+	struct iovec iov;
+	struct uio ku;
+	char *buf;
+	size_t len;
+	int result;
+
+	KASSERT(d->d_submit != NULL);
+
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	sem = sem_create("devio", 0);
+	if (sem == NULL) {
+		return ENOMEM;
+	}
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		result = dev_waitio(d, uio, sem);
+		sem_destroy(sem);
+		return result;
+	}
+
+	buf = kmalloc(DEV_BOUNCESIZE);
+	if (buf == NULL) {
+		sem_destroy(sem);
+		return ENOMEM;
+	}
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > DEV_BOUNCESIZE) {
+			len = DEV_BOUNCESIZE;
+		}
+		uio_kinit(&iov, &ku, buf, len, uio->uio_offset, uio->uio_rw);
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(buf, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = dev_waitio(d, &ku, sem);
+		if (result) {
+			break;
+		}
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(buf, len, uio);
+			if (result) {
+				break;
+			}
+		}
+	}
+
+	kfree(buf);
+	sem_destroy(sem);
+	return result;
+}
@@ -111,6 +111,7 @@ devnull_create(void)
 	dev->d_open = nullopen;
 	dev->d_close = nullclose;
 	dev->d_io = nullio;
+	dev->d_submit = NULL;
 	dev->d_ioctl = nullioctl;
 
 	dev->d_blocks = 0;
@@ -0,0 +1,443 @@
+/*
+ * Anonymous pipes.
+ *
+ * A pipe is a one-page ring buffer with two vnodes, one for each end.
+ * The ends are refcounted separately like any other vnode; when the
+ * last reference to the write end goes away readers see EOF, and when
+ * the read end goes away writers get EPIPE. The pipe itself is freed
+ * when both ends are gone.
+ *
+ * Wakeups are batched: a writer only wakes readers when at least
+ * PIPE_READWAKE bytes are buffered (and once more when its write is
+ * done, so short messages aren't held back), and a reader only wakes
+ * writers once PIPE_WRITEWAKE bytes of space are free. This saves a
+ * context switch per chunk when large amounts of data stream through.
+ *
+ * All data is copied into the buffer and out again; there is no path
+ * that hands a writer's pages to the reader, since dumbvm can't remap
+ * pages between address spaces.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define PIPE_SIZE       PAGE_SIZE
+#define PIPE_READWAKE   (PIPE_SIZE / 4)
+#define PIPE_WRITEWAKE  (PIPE_SIZE / 4)
+
+struct pipe {
+	struct lock *pp_lock;
+	struct cv *pp_readcv;		/* readers wait here for data */
+	struct cv *pp_writecv;		/* writers wait here for space */
+	char *pp_buf;
+	unsigned pp_start;		/* offset of first buffered byte */
+	unsigned pp_count;		/* number of buffered bytes */
+	bool pp_readopen;
+	bool pp_writeopen;
+	struct vnode pp_readvn;
+	struct vnode pp_writevn;
+};
+
+static
+void
+pipe_free(struct pipe *pp)
+{
+	kfree(pp->pp_buf);
+	cv_destroy(pp->pp_writecv);
+	cv_destroy(pp->pp_readcv);
+	lock_destroy(pp->pp_lock);
+	kfree(pp);
+}
+
+/*
+ * Called when either end's refcount hits zero.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool last;
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		pp->pp_readopen = false;
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	}
+	else {
+		KASSERT(v == &pp->pp_writevn);
+		pp->pp_writeopen = false;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+	}
+	last = !pp->pp_readopen && !pp->pp_writeopen;
+	lock_release(pp->pp_lock);
+
+	VOP_CLEANUP(v);
+	if (last) {
+		pipe_free(pp);
+	}
+	return 0;
+}
+
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t len;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	if (v != &pp->pp_readvn) {
+		return EBADF;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (pp->pp_count == 0 && pp->pp_writeopen) {
+		result = cv_wait_intr(pp->pp_readcv, pp->pp_lock);
+		if (result) {
+			lock_release(pp->pp_lock);
+			return result;
+		}
+	}
+
+	/* Take what's there, in at most two pieces because of the wrap. */
+	while (uio->uio_resid > 0 && pp->pp_count > 0) {
+		len = PIPE_SIZE - pp->pp_start;
+		if (len > pp->pp_count) {
+			len = pp->pp_count;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pp->pp_buf + pp->pp_start, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_start = (pp->pp_start + len) % PIPE_SIZE;
+		pp->pp_count -= len;
+	}
+	if (pp->pp_count == 0) {
+		pp->pp_start = 0;
+	}
+
+	if (PIPE_SIZE - pp->pp_count >= PIPE_WRITEWAKE) {
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	}
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t len;
+	unsigned end;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	if (v != &pp->pp_writevn) {
+		return EBADF;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (uio->uio_resid > 0) {
+		if (!pp->pp_readopen) {
+			result = EPIPE;
+			break;
+		}
+		if (pp->pp_count == PIPE_SIZE) {
+			cv_broadcast(pp->pp_readcv, pp->pp_lock);
+			result = cv_wait_intr(pp->pp_writecv, pp->pp_lock);
+			if (result) {
+				break;
+			}
+			continue;
+		}
+
+		end = (pp->pp_start + pp->pp_count) % PIPE_SIZE;
+		len = (end >= pp->pp_start ? PIPE_SIZE : pp->pp_start) - end;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pp->pp_buf + end, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_count += len;
+
+		if (pp->pp_count >= PIPE_READWAKE) {
+			cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		}
+	}
+	cv_broadcast(pp->pp_readcv, pp->pp_lock);
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *pp = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	statbuf->st_size = pp->pp_count;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+static
+int
+pipe_nop(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * Used for several functions with the same type signature that are
+ * not meaningful on pipes.
+ */
+static
+int
+pipe_openfail(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+static
+int
+pipe_uiofail(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *pathname, struct vnode **result)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *v, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for pipe vnodes. Both ends share it; read and write
+ * check which end they were called on.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_openfail,
+	pipe_nop,       /* close */
+	pipe_reclaim,
+	pipe_read,
+	pipe_uiofail,   /* readlink */
+	pipe_uiofail,   /* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_nop,       /* fsync */
+	pipe_mmap,
+	pipe_truncate,
+	pipe_uiofail,   /* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,    /* remove */
+	pipe_nameop,    /* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+/*
+ * Create a pipe. Hands back a reference to each end.
+ */
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *pp;
+
+	pp = kmalloc(sizeof(struct pipe));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pp->pp_lock = lock_create("pipe");
+	if (pp->pp_lock == NULL) {
+		goto fail;
+	}
+	pp->pp_readcv = cv_create("pipe read");
+	if (pp->pp_readcv == NULL) {
+		goto fail_lock;
+	}
+	pp->pp_writecv = cv_create("pipe write");
+	if (pp->pp_writecv == NULL) {
+		goto fail_readcv;
+	}
+	pp->pp_buf = kmalloc(PIPE_SIZE);
+	if (pp->pp_buf == NULL) {
+		goto fail_writecv;
+	}
+	pp->pp_start = 0;
+	pp->pp_count = 0;
+	pp->pp_readopen = true;
+	pp->pp_writeopen = true;
+
+	VOP_INIT(&pp->pp_readvn, &pipe_vnode_ops, NULL, pp);
+	VOP_INIT(&pp->pp_writevn, &pipe_vnode_ops, NULL, pp);
+
+	*readend = &pp->pp_readvn;
+	*writeend = &pp->pp_writevn;
+	return 0;
+
+ fail_writecv:
+	cv_destroy(pp->pp_writecv);
+ fail_readcv:
+	cv_destroy(pp->pp_readcv);
+ fail_lock:
+	lock_destroy(pp->pp_lock);
+ fail:
+	kfree(pp);
+	return ENOMEM;
+}
@@ -36,6 +36,7 @@
 #include <kern/fcntl.h>
 #include <limits.h>
 #include <lib.h>
+#include <uio.h>
 #include <vfs.h>
 #include <vnode.h>
 
@@ -136,6 +137,42 @@ vfs_close(struct vnode *vn)
 	VOP_DECREF(vn);
 }
 
+/* Create a file for the kernel to write into. */
+int
+vfs_kcreate(const char *path, struct vnode **ret)
+{
+	char *name;
+	int result;
+
+	name = kstrdup(path);
+	if (name == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664, ret);
+	kfree(name);
+	return result;
+}
+
+/* Write kernel memory to a file opened with vfs_kcreate. */
+int
+vfs_kwrite(struct vnode *vn, const void *buf, size_t len, off_t *pos)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return ENOSPC;
+	}
+	*pos = ku.uio_offset;
+	return 0;
+}
+
 /* Does most of the work for remove(). */
 int
 vfs_remove(char *path)
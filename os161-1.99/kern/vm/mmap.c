@@ -0,0 +1,812 @@
+/*
+ * File mappings (see mmap.h).
+ *
+ * Locking: mmapLock, a spinlock, protects every address space's list
+ * of mappings and the page pointers in each mapping, so a fault on a
+ * page that is already in memory never sleeps. Anything that does I/O
+ * or changes the lists also holds the VFS biglock, which covers the
+ * page cache too. The biglock comes first; since it's recursive, a
+ * fault taken while the filesystem holds it (say, read() into a mapped
+ * buffer) still works.
+ *
+ * read() and write() on files go through mmap_fileio, which uses the
+ * page cache for any pages of the file that are in it, so file
+ * descriptors and shared mappings see each other's changes. Each
+ * vnode counts its cached pages, so files with none (nearly all of
+ * them) skip the cache and the biglock altogether.
+ *
+ * Pages are never paged out, so "eviction" only happens when the last
+ * mapping of a page goes away. A shared page can be mapped in several
+ * address spaces and we can't cheaply write-protect it in all of them
+ * again, so once a page is dirty it stays dirty and is written back at
+ * every msync and when it's released.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <stat.h>
+#include <cpu.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <mmap.h>
+
+#define PAGECACHE_BUCKETS 64
+
+struct mmpage {
+  struct vnode *mp_vn; // NULL for a private page
+  off_t mp_offset;
+  paddr_t mp_paddr;
+  unsigned mp_refs; // mappings using this page
+  bool mp_dirty;
+  struct mmpage *mp_next; // page cache hash chain
+};
+
+struct mmapping {
+  vaddr_t mm_base;
+  unsigned mm_npages;
+  int mm_prot;
+  int mm_flags;
+  struct vnode *mm_vn;
+  off_t mm_offset;
+  struct mmpage **mm_pages; // NULL until touched
+  struct mmapping *mm_next; // sorted by mm_base
+};
+
+static struct spinlock mmapLock = SPINLOCK_INITIALIZER;
+static struct mmpage *pagecache[PAGECACHE_BUCKETS];
+
+static
+unsigned
+pagecache_hash(struct vnode *vn, off_t offset)
+{
+  uint32_t h = (uint32_t)vn ^ (uint32_t)(offset / PAGE_SIZE);
+
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return h % PAGECACHE_BUCKETS;
+}
+
+/* Allocate a private, zeroed page. */
+static
+struct mmpage *
+mmpage_alloc(void)
+{
+  struct mmpage *mp;
+  vaddr_t kva;
+
+  mp = kmalloc(sizeof(struct mmpage));
+  if (mp == NULL) {
+    return NULL;
+  }
+  kva = alloc_kpages(1);
+  if (kva == 0) {
+    kfree(mp);
+    return NULL;
+  }
+  bzero((void *)kva, PAGE_SIZE);
+
+  mp->mp_vn = NULL;
+  mp->mp_offset = 0;
+  mp->mp_paddr = kva - MIPS_KSEG0;
+  mp->mp_refs = 1;
+  mp->mp_dirty = false;
+  mp->mp_next = NULL;
+  return mp;
+}
+
+/* Allocate a page and read it from the file. Anything past EOF is zero. */
+static
+int
+mmpage_read(struct vnode *vn, off_t offset, struct mmpage **ret)
+{
+  struct iovec iov;
+  struct uio u;
+  struct mmpage *mp;
+  int result;
+
+  mp = mmpage_alloc();
+  if (mp == NULL) {
+    return ENOMEM;
+  }
+  uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(mp->mp_paddr), PAGE_SIZE,
+            offset, UIO_READ);
+  result = VOP_READ(vn, &u);
+  if (result) {
+    free_kpages(PADDR_TO_KVADDR(mp->mp_paddr));
+    kfree(mp);
+    return result;
+  }
+  *ret = mp;
+  return 0;
+}
+
+/* Write a shared page back to its file. Mappings never extend the file. */
+static
+int
+mmpage_writeback(struct mmpage *mp)
+{
+  struct iovec iov;
+  struct uio u;
+  struct stat st;
+  size_t len;
+  int result;
+
+  KASSERT(mp->mp_vn != NULL);
+
+  result = VOP_STAT(mp->mp_vn, &st);
+  if (result) {
+    return result;
+  }
+  if (mp->mp_offset >= st.st_size) {
+    return 0;
+  }
+  len = PAGE_SIZE;
+  if (st.st_size - mp->mp_offset < PAGE_SIZE) {
+    len = st.st_size - mp->mp_offset;
+  }
+  uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(mp->mp_paddr), len,
+            mp->mp_offset, UIO_WRITE);
+  return VOP_WRITE(mp->mp_vn, &u);
+}
+
+/* Look up the shared page for (vn, offset) if it's in. Biglock held. */
+static
+struct mmpage *
+pagecache_find(struct vnode *vn, off_t offset)
+{
+  struct mmpage *mp;
+
+  KASSERT(vfs_biglock_do_i_hold());
+
+  for (mp = pagecache[pagecache_hash(vn, offset)]; mp != NULL;
+       mp = mp->mp_next) {
+    if (mp->mp_vn == vn && mp->mp_offset == offset) {
+      return mp;
+    }
+  }
+  return NULL;
+}
+
+/* Find or read in the shared page for (vn, offset). Biglock held. */
+static
+int
+pagecache_get(struct vnode *vn, off_t offset, struct mmpage **ret)
+{
+  unsigned h = pagecache_hash(vn, offset);
+  struct mmpage *mp;
+  int result;
+
+  mp = pagecache_find(vn, offset);
+  if (mp != NULL) {
+    mp->mp_refs++;
+    *ret = mp;
+    return 0;
+  }
+
+  result = mmpage_read(vn, offset, &mp);
+  if (result) {
+    return result;
+  }
+  VOP_INCREF(vn);
+  mp->mp_vn = vn;
+  mp->mp_offset = offset;
+  mp->mp_next = pagecache[h];
+  pagecache[h] = mp;
+  vn->vn_mmpages++;
+  *ret = mp;
+  return 0;
+}
+
+/*
+ * Drop a mapping's reference to a page. The last reference writes a
+ * dirty shared page back and frees it. Biglock held.
+ */
+static
+void
+mmpage_release(struct mmpage *mp)
+{
+  struct mmpage **mpp;
+  int result;
+
+  KASSERT(vfs_biglock_do_i_hold());
+  KASSERT(mp->mp_refs > 0);
+
+  mp->mp_refs--;
+  if (mp->mp_refs > 0) {
+    return;
+  }
+
+  if (mp->mp_vn != NULL) {
+    if (mp->mp_dirty) {
+      result = mmpage_writeback(mp);
+      if (result) {
+        kprintf("mmap: Warning: could not write back page: %s\n",
+                strerror(result));
+      }
+    }
+    mpp = &pagecache[pagecache_hash(mp->mp_vn, mp->mp_offset)];
+    while (*mpp != mp) {
+      KASSERT(*mpp != NULL);
+      mpp = &(*mpp)->mp_next;
+    }
+    *mpp = mp->mp_next;
+    KASSERT(mp->mp_vn->vn_mmpages > 0);
+    mp->mp_vn->vn_mmpages--;
+    VOP_DECREF(mp->mp_vn);
+  }
+  free_kpages(PADDR_TO_KVADDR(mp->mp_paddr));
+  kfree(mp);
+}
+
+/*
+ * Do one page's worth (or less) of read() or write() at the caller's
+ * offset, using BUF to stage it. A cached page is read straight from
+ * memory; a write goes to the file and also to the cached page, if
+ * there is one, so a later writeback of the page doesn't undo it.
+ * Sets *eof when a read comes up short. Biglock held.
+ */
+static
+int
+mmap_filepage(struct vnode *vn, struct uio *uio, char *buf, off_t size,
+              bool *eof)
+{
+  struct iovec iov;
+  struct uio ku;
+  struct mmpage *mp;
+  off_t offset = uio->uio_offset;
+  size_t pageoff, len;
+  char *kva;
+  int result;
+
+  pageoff = offset % PAGE_SIZE;
+  len = PAGE_SIZE - pageoff;
+  if (len > uio->uio_resid) {
+    len = uio->uio_resid;
+  }
+  mp = pagecache_find(vn, offset - pageoff);
+  kva = mp == NULL ? NULL : (char *)PADDR_TO_KVADDR(mp->mp_paddr) + pageoff;
+
+  if (uio->uio_rw == UIO_WRITE) {
+    result = uiomove(buf, len, uio);
+    if (result) {
+      return result;
+    }
+    uio_kinit(&iov, &ku, buf, len, offset, UIO_WRITE);
+    result = VOP_WRITE(vn, &ku);
+    if (result) {
+      return result;
+    }
+    if (kva != NULL) {
+      memcpy(kva, buf, len);
+    }
+    return 0;
+  }
+
+  if (kva != NULL) {
+    if (offset >= size) {
+      *eof = true;
+      return 0;
+    }
+    if ((off_t)len > size - offset) {
+      len = size - offset;
+      *eof = true;
+    }
+    return uiomove(kva, len, uio);
+  }
+
+  uio_kinit(&iov, &ku, buf, len, offset, UIO_READ);
+  result = VOP_READ(vn, &ku);
+  if (result) {
+    return result;
+  }
+  if (ku.uio_resid > 0) {
+    len -= ku.uio_resid;
+    *eof = true;
+  }
+  return uiomove(buf, len, uio);
+}
+
+/*
+ * read() and write() on VN. If none of the file's pages are cached
+ * (which is nearly always the case), this is just VOP_READ or
+ * VOP_WRITE; otherwise the transfer goes a page at a time so cached
+ * pages can be used.
+ */
+int
+mmap_fileio(struct vnode *vn, struct uio *uio)
+{
+  struct stat st;
+  off_t first, last, pg;
+  bool cached, eof;
+  char *buf;
+  int result;
+
+  /*
+   * Checking the file's count without the biglock is only a hint; a
+   * page that comes in just after is no different from one that
+   * comes in just after the transfer.
+   */
+  cached = false;
+  if (vn->vn_mmpages > 0 && uio->uio_resid > 0) {
+    vfs_biglock_acquire();
+    first = uio->uio_offset - uio->uio_offset % PAGE_SIZE;
+    last = uio->uio_offset + uio->uio_resid - 1;
+    for (pg = first; pg <= last && !cached; pg += PAGE_SIZE) {
+      cached = pagecache_find(vn, pg) != NULL;
+    }
+    if (!cached) {
+      vfs_biglock_release();
+    }
+  }
+  if (!cached) {
+    if (uio->uio_rw == UIO_READ) {
+      return VOP_READ(vn, uio);
+    }
+    return VOP_WRITE(vn, uio);
+  }
+
+  buf = kmalloc(PAGE_SIZE);
+  if (buf == NULL) {
+    vfs_biglock_release();
+    return ENOMEM;
+  }
+  st.st_size = 0;
+  result = 0;
+  if (uio->uio_rw == UIO_READ) {
+    result = VOP_STAT(vn, &st);
+  }
+  eof = false;
+  while (result == 0 && !eof && uio->uio_resid > 0) {
+    result = mmap_filepage(vn, uio, buf, st.st_size, &eof);
+  }
+  vfs_biglock_release();
+  kfree(buf);
+  return result;
+}
+
+static
+vaddr_t
+mmapping_end(struct mmapping *mm)
+{
+  return mm->mm_base + mm->mm_npages * PAGE_SIZE;
+}
+
+/* Find the mapping containing VA. mmapLock or the biglock held. */
+static
+struct mmapping *
+mmap_find(struct addrspace *as, vaddr_t va)
+{
+  struct mmapping *mm;
+
+  for (mm = as->as_mmaps; mm != NULL; mm = mm->mm_next) {
+    if (va >= mm->mm_base && va < mmapping_end(mm)) {
+      return mm;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Unlinked mapping; drop its pages. Biglock held. Every other CPU has
+ * dropped its TLB entries by the time ipi_tlbshootdown_broadcast
+ * returns, and since the mapping was unlinked under mmapLock no fault
+ * can load them again, so the frames can go.
+ */
+static
+void
+mmapping_free(struct addrspace *as, struct mmapping *mm, bool shootdown)
+{
+  struct tlbshootdown ts;
+  unsigned i;
+
+  ts.ts_addrspace = as;
+  for (i = 0; i < mm->mm_npages; i++) {
+    if (mm->mm_pages[i] == NULL) {
+      continue;
+    }
+    if (shootdown) {
+      ts.ts_vaddr = mm->mm_base + i * PAGE_SIZE;
+      vm_tlbshootdown(&ts);
+      ipi_tlbshootdown_broadcast(&ts);
+    }
+    mmpage_release(mm->mm_pages[i]);
+  }
+  VOP_DECREF(mm->mm_vn);
+  kfree(mm->mm_pages);
+  kfree(mm);
+}
+
+/*
+ * Set up a mapping at FIXED, or if FIXED is 0 wherever there's room
+ * between MMAP_BASE and MMAP_TOP. A fixed mapping that would overlap
+ * another mapping, a region, or the stacks is rejected with EINVAL.
+ */
+static
+int
+mmap_insert(struct addrspace *as, struct vnode *vn, off_t offset,
+            size_t len, int prot, int flags, vaddr_t fixed, vaddr_t *ret)
+{
+  struct mmapping *mm, **mmp;
+  unsigned npages, i;
+  vaddr_t base;
+  int result;
+
+  KASSERT(offset % PAGE_SIZE == 0);
+  KASSERT(fixed % PAGE_SIZE == 0);
+  KASSERT(flags == MAP_SHARED || flags == MAP_PRIVATE);
+
+  if (len == 0 || len > MMAP_TOP - MMAP_BASE) {
+    return EINVAL;
+  }
+  npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  mm = kmalloc(sizeof(struct mmapping));
+  if (mm == NULL) {
+    return ENOMEM;
+  }
+  mm->mm_pages = kmalloc(npages * sizeof(struct mmpage *));
+  if (mm->mm_pages == NULL) {
+    kfree(mm);
+    return ENOMEM;
+  }
+  for (i = 0; i < npages; i++) {
+    mm->mm_pages[i] = NULL;
+  }
+  mm->mm_npages = npages;
+  mm->mm_prot = prot;
+  mm->mm_flags = flags;
+  mm->mm_offset = offset;
+
+  vfs_biglock_acquire();
+
+  if (fixed != 0) {
+    base = fixed;
+    if (as_overlaps(as, base, npages * PAGE_SIZE)) {
+      result = EINVAL;
+      goto fail;
+    }
+    for (mmp = &as->as_mmaps; *mmp != NULL; mmp = &(*mmp)->mm_next) {
+      if ((*mmp)->mm_base >= base) {
+        break;
+      }
+      if (mmapping_end(*mmp) > base) {
+        result = EINVAL;
+        goto fail;
+      }
+    }
+    if (*mmp != NULL && (*mmp)->mm_base - base < npages * PAGE_SIZE) {
+      result = EINVAL;
+      goto fail;
+    }
+  }
+  else {
+    // first fit
+    base = MMAP_BASE;
+    for (mmp = &as->as_mmaps; *mmp != NULL; mmp = &(*mmp)->mm_next) {
+      if ((*mmp)->mm_base >= base &&
+          (*mmp)->mm_base - base >= npages * PAGE_SIZE) {
+        break;
+      }
+      if (mmapping_end(*mmp) > base) {
+        base = mmapping_end(*mmp);
+      }
+    }
+    if (base > MMAP_TOP || MMAP_TOP - base < npages * PAGE_SIZE) {
+      result = ENOMEM;
+      goto fail;
+    }
+  }
+
+  VOP_INCREF(vn);
+  mm->mm_vn = vn;
+  mm->mm_base = base;
+
+  spinlock_acquire(&mmapLock);
+  mm->mm_next = *mmp;
+  *mmp = mm;
+  spinlock_release(&mmapLock);
+
+  vfs_biglock_release();
+
+  *ret = base;
+  return 0;
+
+ fail:
+  vfs_biglock_release();
+  kfree(mm->mm_pages);
+  kfree(mm);
+  return result;
+}
+
+int
+mmap_map(struct addrspace *as, struct vnode *vn, off_t offset,
+         size_t len, int prot, int flags, vaddr_t *ret)
+{
+  return mmap_insert(as, vn, offset, len, prot, flags, 0, ret);
+}
+
+/*
+ * Map program text straight from the executable at VADDR. Since the
+ * mapping is shared and read-only, every process running the same
+ * file uses the same frames, and pages nobody touches are never read.
+ */
+int
+mmap_text(struct addrspace *as, struct vnode *vn, off_t offset,
+          vaddr_t vaddr, size_t len)
+{
+  vaddr_t base;
+
+  return mmap_insert(as, vn, offset, len, PROT_READ | PROT_EXEC,
+                     MAP_SHARED, vaddr, &base);
+}
+
+/*
+ * Only whole mappings can be unmapped; a range that cuts one in two
+ * is rejected, as is one outside the mmap area (program text).
+ */
+int
+mmap_unmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+  struct mmapping *mm, **mmp;
+  vaddr_t end;
+
+  if (addr % PAGE_SIZE != 0 || len == 0 || addr + len < addr) {
+    return EINVAL;
+  }
+  end = addr + len;
+  if (addr < MMAP_BASE || end > MMAP_TOP) {
+    return EINVAL;
+  }
+
+  vfs_biglock_acquire();
+
+  for (mm = as->as_mmaps; mm != NULL; mm = mm->mm_next) {
+    if (mm->mm_base < end && mmapping_end(mm) > addr &&
+        (mm->mm_base < addr || mmapping_end(mm) > end)) {
+      vfs_biglock_release();
+      return EINVAL;
+    }
+  }
+
+  mmp = &as->as_mmaps;
+  while (*mmp != NULL) {
+    mm = *mmp;
+    if (mm->mm_base >= addr && mmapping_end(mm) <= end) {
+      spinlock_acquire(&mmapLock);
+      *mmp = mm->mm_next;
+      spinlock_release(&mmapLock);
+      mmapping_free(as, mm, true);
+    }
+    else {
+      mmp = &mm->mm_next;
+    }
+  }
+
+  vfs_biglock_release();
+  return 0;
+}
+
+int
+mmap_sync(struct addrspace *as, vaddr_t addr, size_t len)
+{
+  struct mmapping *mm;
+  struct mmpage *mp;
+  vaddr_t va, end;
+  unsigned i;
+  int result = 0;
+
+  if (addr % PAGE_SIZE != 0 || addr + len < addr) {
+    return EINVAL;
+  }
+  end = addr + len;
+
+  vfs_biglock_acquire();
+  for (mm = as->as_mmaps; mm != NULL && result == 0; mm = mm->mm_next) {
+    if (mm->mm_flags != MAP_SHARED) {
+      continue;
+    }
+    for (i = 0; i < mm->mm_npages && result == 0; i++) {
+      va = mm->mm_base + i * PAGE_SIZE;
+      mp = mm->mm_pages[i];
+      if (va + PAGE_SIZE <= addr || va >= end || mp == NULL) {
+        continue;
+      }
+      if (mp->mp_dirty) {
+        result = mmpage_writeback(mp);
+      }
+    }
+  }
+  vfs_biglock_release();
+  return result;
+}
+
+static
+bool
+mmap_allowed(struct mmapping *mm, int faulttype)
+{
+  if (mm->mm_prot == PROT_NONE) {
+    return false;
+  }
+  return faulttype == VM_FAULT_READ || (mm->mm_prot & PROT_WRITE);
+}
+
+/*
+ * Whether a page may be mapped writable. Shared pages are mapped
+ * read-only until the first write so we know which need writing
+ * back. mmapLock held.
+ */
+static
+bool
+mmap_writable(struct mmapping *mm, struct mmpage *mp, int faulttype)
+{
+  if (!(mm->mm_prot & PROT_WRITE)) {
+    return false;
+  }
+  if (mm->mm_flags == MAP_PRIVATE) {
+    return true;
+  }
+  if (faulttype != VM_FAULT_READ) {
+    mp->mp_dirty = true;
+  }
+  return mp->mp_dirty;
+}
+
+int
+mmap_fault(struct addrspace *as, vaddr_t va, int faulttype,
+           void (*tlbload)(vaddr_t va, paddr_t pa, bool writable))
+{
+  struct mmapping *mm;
+  struct mmpage *mp;
+  unsigned ix;
+  int result;
+
+  /* Fast path: the page is already in. */
+  spinlock_acquire(&mmapLock);
+  mm = mmap_find(as, va);
+  if (mm == NULL || !mmap_allowed(mm, faulttype)) {
+    spinlock_release(&mmapLock);
+    return EFAULT;
+  }
+  ix = (va - mm->mm_base) / PAGE_SIZE;
+  mp = mm->mm_pages[ix];
+  if (mp != NULL) {
+    tlbload(va, mp->mp_paddr, mmap_writable(mm, mp, faulttype));
+    spinlock_release(&mmapLock);
+    return 0;
+  }
+  spinlock_release(&mmapLock);
+
+  /*
+   * Read it in. Nothing can unmap or fill pages while we hold the
+   * biglock, but that may have happened before we got it, so look
+   * again first.
+   */
+  vfs_biglock_acquire();
+  mm = mmap_find(as, va);
+  if (mm == NULL || !mmap_allowed(mm, faulttype)) {
+    vfs_biglock_release();
+    return EFAULT;
+  }
+  ix = (va - mm->mm_base) / PAGE_SIZE;
+  mp = mm->mm_pages[ix];
+  if (mp == NULL) {
+    if (mm->mm_flags == MAP_SHARED) {
+      result = pagecache_get(mm->mm_vn,
+                             mm->mm_offset + (off_t)ix * PAGE_SIZE, &mp);
+    }
+    else {
+      result = mmpage_read(mm->mm_vn,
+                           mm->mm_offset + (off_t)ix * PAGE_SIZE, &mp);
+    }
+    if (result) {
+      vfs_biglock_release();
+      return result;
+    }
+  }
+
+  spinlock_acquire(&mmapLock);
+  mm->mm_pages[ix] = mp;
+  tlbload(va, mp->mp_paddr, mmap_writable(mm, mp, faulttype));
+  spinlock_release(&mmapLock);
+
+  vfs_biglock_release();
+  return 0;
+}
+
+/*
+ * Give NEW the same mappings as OLD, for fork. Shared pages are
+ * shared; private pages that have been touched are copied. On error
+ * NEW may hold some of the mappings; as_destroy cleans them up.
+ */
+int
+mmap_copy(struct addrspace *old, struct addrspace *new)
+{
+  struct mmapping *mm, *nmm, **tail;
+  struct mmpage *mp;
+  unsigned i;
+
+  if (old->as_mmaps == NULL) {
+    return 0;
+  }
+
+  vfs_biglock_acquire();
+  tail = &new->as_mmaps;
+  for (mm = old->as_mmaps; mm != NULL; mm = mm->mm_next) {
+    nmm = kmalloc(sizeof(struct mmapping));
+    if (nmm == NULL) {
+      vfs_biglock_release();
+      return ENOMEM;
+    }
+    nmm->mm_pages = kmalloc(mm->mm_npages * sizeof(struct mmpage *));
+    if (nmm->mm_pages == NULL) {
+      kfree(nmm);
+      vfs_biglock_release();
+      return ENOMEM;
+    }
+    for (i = 0; i < mm->mm_npages; i++) {
+      nmm->mm_pages[i] = NULL;
+    }
+    nmm->mm_base = mm->mm_base;
+    nmm->mm_npages = mm->mm_npages;
+    nmm->mm_prot = mm->mm_prot;
+    nmm->mm_flags = mm->mm_flags;
+    nmm->mm_offset = mm->mm_offset;
+    VOP_INCREF(mm->mm_vn);
+    nmm->mm_vn = mm->mm_vn;
+    nmm->mm_next = NULL;
+    *tail = nmm;
+    tail = &nmm->mm_next;
+
+    for (i = 0; i < mm->mm_npages; i++) {
+      if (mm->mm_pages[i] == NULL) {
+        continue;
+      }
+      if (mm->mm_flags == MAP_SHARED) {
+        mm->mm_pages[i]->mp_refs++;
+        nmm->mm_pages[i] = mm->mm_pages[i];
+        continue;
+      }
+      mp = mmpage_alloc();
+      if (mp == NULL) {
+        vfs_biglock_release();
+        return ENOMEM;
+      }
+      memmove((void *)PADDR_TO_KVADDR(mp->mp_paddr),
+              (const void *)PADDR_TO_KVADDR(mm->mm_pages[i]->mp_paddr),
+              PAGE_SIZE);
+      nmm->mm_pages[i] = mp;
+    }
+  }
+  vfs_biglock_release();
+  return 0;
+}
+
+/*
+ * Drop all of an address space's mappings. Nobody else can be using
+ * the address space any more.
+ */
+void
+mmap_destroy(struct addrspace *as)
+{
+  struct mmapping *mm;
+
+  if (as->as_mmaps == NULL) {
+    return;
+  }
+
+  vfs_biglock_acquire();
+  while ((mm = as->as_mmaps) != NULL) {
+    spinlock_acquire(&mmapLock);
+    as->as_mmaps = mm->mm_next;
+    spinlock_release(&mmapLock);
+    mmapping_free(as, mm, false);
+  }
+  vfs_biglock_release();
+}
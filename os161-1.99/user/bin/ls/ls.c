@@ -303,6 +303,13 @@ main(int argc, char *argv[])
 {
 	int i,j, items=0;
 
+	/*
+	 * Listings can be long; buffer them rather than writing each
+	 * line separately. (Errors go to stderr, which err flushes
+	 * stdout ahead of.)
+	 */
+	setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+
 	/*
 	 * Go through the arguments and count how many non-option args.
 	 */
@@ -41,6 +41,80 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/* Buffering modes for setvbuf */
+#define _IOFBF 0	/* full: write when the buffer fills */
+#define _IOLBF 1	/* line: also write at each newline */
+#define _IONBF 2	/* none: write before each call returns */
+
+#define BUFSIZ    1024	/* default buffer size */
+#define FOPEN_MAX 20	/* streams open at once, counting stdin etc. */
+
+/*
+ * Buffered I/O stream. The insides are for libc use only.
+ *
+ * The buffer holds either data read ahead (from __pos up to __len)
+ * or data waiting to be written (up to __pos), never both; which one
+ * is given by __STDIO_RDBUF or __STDIO_WRBUF.
+ */
+typedef struct __file {
+	int __fd;		/* file descriptor */
+	int __flags;		/* __STDIO_* below */
+	int __mode;		/* _IOFBF, _IOLBF, or _IONBF */
+	char *__buf;		/* buffer, or NULL until first needed */
+	size_t __bufsize;	/* its size */
+	size_t __pos;		/* current position in buffer */
+	size_t __len;		/* end of data read into buffer */
+} FILE;
+
+#define __STDIO_INUSE  0x01	/* slot in use */
+#define __STDIO_READ   0x02	/* open for reading */
+#define __STDIO_WRITE  0x04	/* open for writing */
+#define __STDIO_RDBUF  0x08	/* buffer holds data read ahead */
+#define __STDIO_WRBUF  0x10	/* buffer holds data to be written */
+#define __STDIO_MYBUF  0x20	/* buffer was malloc'd by us */
+#define __STDIO_EOF    0x40	/* end of file seen */
+#define __STDIO_ERR    0x80	/* error seen */
+
+/* All the streams (for libc internal use only) */
+extern FILE __stdio_streams[FOPEN_MAX];
+
+/*
+ * The standard streams. All three start out unbuffered, so output
+ * appears (and fork copies nothing) exactly as if it were written
+ * directly; each call is still written in one piece. Programs that
+ * write a lot can ask for more with setvbuf.
+ */
+extern FILE *stdin, *stdout, *stderr;
+
+/* Streams */
+FILE *fopen(const char *path, const char *mode);
+FILE *fdopen(int fd, const char *mode);
+int fclose(FILE *f);
+int fflush(FILE *f);		/* NULL means all streams */
+int setvbuf(FILE *f, char *buf, int mode, size_t size);
+int fileno(FILE *f);
+int feof(FILE *f);
+int ferror(FILE *f);
+void clearerr(FILE *f);
+
+/* Stream I/O */
+size_t fread(void *ptr, size_t size, size_t nitems, FILE *f);
+size_t fwrite(const void *ptr, size_t size, size_t nitems, FILE *f);
+int fgetc(FILE *f);
+int getc(FILE *f);
+int fputc(int ch, FILE *f);
+int putc(int ch, FILE *f);
+int fputs(const char *s, FILE *f);
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
+
+/*
+ * Stream helpers
+ * (for libc internal use only)
+ */
+void __stdio_getbuf(FILE *f);
+int __stdio_writeall(int fd, const void *buf, size_t len);
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -0,0 +1,47 @@
+/*
+ * User-level synchronization for threads created with threadfork().
+ *
+ * These are built on the __futexwait/__futexwake system calls, so an
+ * uncontended lock or unlock never enters the kernel.
+ */
+
+#ifndef _SYNCH_H_
+#define _SYNCH_H_
+
+/*
+ * Mutex. um_state is 0 when unlocked, 1 when locked, and 2 when
+ * locked and some thread may be asleep waiting for it.
+ */
+struct umutex {
+	volatile int um_state;
+};
+
+#define UMUTEX_INITIALIZER { 0 }
+
+void umutex_init(struct umutex *m);
+void umutex_lock(struct umutex *m);
+void umutex_unlock(struct umutex *m);
+
+/*
+ * Condition variable, with Mesa semantics like the kernel's. ucv_seq
+ * changes on every signal or broadcast, which is what waiters sleep on.
+ */
+struct ucv {
+	volatile int ucv_seq;
+};
+
+#define UCV_INITIALIZER { 0 }
+
+void ucv_init(struct ucv *cv);
+void ucv_wait(struct ucv *cv, struct umutex *m);
+void ucv_signal(struct ucv *cv);
+void ucv_broadcast(struct ucv *cv);
+
+/*
+ * Atomic operations (using LL/SC) the above are built from; also
+ * handy for benchmarks and tests.
+ */
+int atomic_swap(volatile int *p, int val);
+int atomic_add(volatile int *p, int delta);
+
+#endif /* _SYNCH_H_ */
@@ -39,8 +39,10 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/syscallstats.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
@@ -61,6 +63,7 @@
  * header files as well, as follows:
  * 
  *     waitpid:  sys/wait.h
+ *     mmap:     sys/mman.h
  *     open:     fcntl.h or sys/fcntl.h
  *     reboot:   sys/reboot.h
  *     ioctl:    sys/ioctl.h
@@ -107,6 +110,9 @@
  */
 
 
+/* Returned by mmap on error */
+#define MAP_FAILED ((void *)-1)
+
 #ifdef __GNUC__
 /* GCC gets into a snit if _exit isn't declared to not return */
 #define __DEAD __attribute__((__noreturn__))
@@ -146,6 +152,7 @@ int link(const char *oldfile, const char *newfile);
 int chdir(const char *path);
 
 /* Optional. */
+pid_t vfork(void);
 void *sbrk(int change);
 int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
@@ -154,6 +161,16 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int __threadfork(void (*start)(void *), void *arg);
+__DEAD void __threadexit(void);
+int __futexwait(volatile int *addr, int expected);
+int __futexwake(volatile int *addr, int count);
+void *mmap(void *addr, size_t len, int prot, int flags, int filehandle,
+	   off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+int __syscallstats(int callno, struct syscallstat *stats);
+int nanosleep(const struct timespec *request, struct timespec *remaining);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -163,5 +180,6 @@ int __getcwd(char *buf, size_t buflen);
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int threadfork(void (*func)(void));		/* calls __threadfork */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * fflush - write out a stream's pending output.
+ */
+
+static
+int
+flushone(FILE *f)
+{
+	if (f->__flags & __STDIO_WRBUF) {
+		f->__flags &= ~__STDIO_WRBUF;
+		if (__stdio_writeall(f->__fd, f->__buf, f->__pos) < 0) {
+			f->__flags |= __STDIO_ERR;
+			f->__pos = 0;
+			return EOF;
+		}
+	}
+	else if (f->__flags & __STDIO_RDBUF) {
+		/*
+		 * Give back whatever was read ahead, so the file
+		 * position is where the caller thinks it is. The console
+		 * and pipes can't take it back; then the data stays
+		 * buffered for the next read, and the flush fails.
+		 */
+		if (f->__len > f->__pos &&
+		    lseek(f->__fd, -(off_t)(f->__len - f->__pos),
+			  SEEK_CUR) < 0) {
+			f->__flags |= __STDIO_ERR;
+			return EOF;
+		}
+		f->__flags &= ~__STDIO_RDBUF;
+		f->__len = 0;
+	}
+	f->__pos = 0;
+	return 0;
+}
+
+/*
+ * With NULL, flush the output of every stream; read-ahead is left
+ * alone.
+ */
+int
+fflush(FILE *f)
+{
+	int i, result;
+
+	if (f != NULL) {
+		return flushone(f);
+	}
+
+	result = 0;
+	for (i=0; i<FOPEN_MAX; i++) {
+		f = &__stdio_streams[i];
+		if ((f->__flags & __STDIO_INUSE) &&
+		    (f->__flags & __STDIO_WRBUF)) {
+			if (flushone(f)) {
+				result = EOF;
+			}
+		}
+	}
+	return result;
+}
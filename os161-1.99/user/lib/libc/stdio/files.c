@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * The stream table, and opening and closing streams.
+ *
+ * Buffers are only allocated the first time a stream is actually
+ * read or written, so opening a file and closing it again doesn't
+ * touch malloc.
+ */
+
+FILE __stdio_streams[FOPEN_MAX] = {
+	{ STDIN_FILENO,  __STDIO_INUSE|__STDIO_READ,  _IONBF, NULL, 0, 0, 0 },
+	{ STDOUT_FILENO, __STDIO_INUSE|__STDIO_WRITE, _IONBF, NULL, 0, 0, 0 },
+	{ STDERR_FILENO, __STDIO_INUSE|__STDIO_WRITE, _IONBF, NULL, 0, 0, 0 },
+};
+
+FILE *stdin = &__stdio_streams[0];
+FILE *stdout = &__stdio_streams[1];
+FILE *stderr = &__stdio_streams[2];
+
+/*
+ * Turn an fopen mode string into open() flags and stream flags.
+ * Returns -1 if the mode isn't valid.
+ */
+static
+int
+modeflags(const char *mode, int *oflagsret)
+{
+	int oflags, flags;
+
+	switch (*mode++) {
+	    case 'r':
+		oflags = O_RDONLY;
+		flags = __STDIO_READ;
+		break;
+	    case 'w':
+		oflags = O_WRONLY|O_CREAT|O_TRUNC;
+		flags = __STDIO_WRITE;
+		break;
+	    case 'a':
+		oflags = O_WRONLY|O_CREAT|O_APPEND;
+		flags = __STDIO_WRITE;
+		break;
+	    default:
+		return -1;
+	}
+
+	for (; *mode; mode++) {
+		if (*mode == '+') {
+			oflags = (oflags & ~O_ACCMODE) | O_RDWR;
+			flags = __STDIO_READ|__STDIO_WRITE;
+		}
+		else if (*mode != 'b') {
+			return -1;
+		}
+	}
+
+	*oflagsret = oflags;
+	return flags;
+}
+
+/*
+ * Set up a free slot for FD. Returns NULL if there isn't one.
+ */
+static
+FILE *
+newstream(int fd, int flags)
+{
+	FILE *f;
+	int i;
+
+	for (i=0; i<FOPEN_MAX; i++) {
+		f = &__stdio_streams[i];
+		if ((f->__flags & __STDIO_INUSE) == 0) {
+			f->__fd = fd;
+			f->__flags = __STDIO_INUSE | flags;
+			f->__mode = _IOFBF;
+			f->__buf = NULL;
+			f->__bufsize = BUFSIZ;
+			f->__pos = 0;
+			f->__len = 0;
+			return f;
+		}
+	}
+	return NULL;
+}
+
+FILE *
+fopen(const char *path, const char *mode)
+{
+	FILE *f;
+	int fd, flags, oflags;
+
+	flags = modeflags(mode, &oflags);
+	if (flags < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fd = open(path, oflags, 0664);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	f = newstream(fd, flags);
+	if (f == NULL) {
+		close(fd);
+		errno = EMFILE;
+		return NULL;
+	}
+	return f;
+}
+
+FILE *
+fdopen(int fd, const char *mode)
+{
+	FILE *f;
+	int flags, oflags;
+
+	flags = modeflags(mode, &oflags);
+	if (flags < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	f = newstream(fd, flags);
+	if (f == NULL) {
+		errno = EMFILE;
+		return NULL;
+	}
+	return f;
+}
+
+int
+fclose(FILE *f)
+{
+	int result = 0;
+
+	if (fflush(f)) {
+		result = EOF;
+	}
+	if (close(f->__fd)) {
+		result = EOF;
+	}
+	if (f->__flags & __STDIO_MYBUF) {
+		free(f->__buf);
+	}
+	f->__buf = NULL;
+	f->__flags = 0;
+	return result;
+}
+
+/*
+ * Change a stream's buffering. Unlike the standard, this may be used
+ * at any time; pending output is flushed first. If BUF is NULL, a
+ * buffer of SIZE bytes (BUFSIZ if SIZE is 0) is allocated when it's
+ * first needed.
+ */
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (fflush(f)) {
+		return -1;
+	}
+
+	if (f->__flags & __STDIO_MYBUF) {
+		free(f->__buf);
+		f->__flags &= ~__STDIO_MYBUF;
+	}
+	f->__mode = mode;
+	f->__buf = mode == _IONBF ? NULL : buf;
+	f->__bufsize = size ? size : BUFSIZ;
+	f->__pos = 0;
+	f->__len = 0;
+	return 0;
+}
+
+/*
+ * Make sure a buffered stream has its buffer. If there isn't memory
+ * for one, the stream quietly becomes unbuffered instead.
+ */
+void
+__stdio_getbuf(FILE *f)
+{
+	if (f->__mode == _IONBF || f->__buf != NULL) {
+		return;
+	}
+	f->__buf = malloc(f->__bufsize);
+	if (f->__buf == NULL) {
+		f->__mode = _IONBF;
+		return;
+	}
+	f->__flags |= __STDIO_MYBUF;
+}
+
+int
+fileno(FILE *f)
+{
+	return f->__fd;
+}
+
+int
+feof(FILE *f)
+{
+	return (f->__flags & __STDIO_EOF) != 0;
+}
+
+int
+ferror(FILE *f)
+{
+	return (f->__flags & __STDIO_ERR) != 0;
+}
+
+void
+clearerr(FILE *f)
+{
+	f->__flags &= ~(__STDIO_EOF|__STDIO_ERR);
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+/*
+ * fprintf - formatted output to a stream.
+ */
+
+/*
+ * Function passed to __vprintf to do the actual output.
+ */
+static
+void
+__fprintf_send(void *mydata, const char *data, size_t len)
+{
+	FILE *f = mydata;
+
+	fwrite(data, 1, len, f);
+}
+
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/*
+ * __vprintf hands over its output in many small pieces. On an
+ * unbuffered stream, collect them in a buffer on the stack and write
+ * them together, so one printf is (usually) one write.
+ */
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	char buf[BUFSIZ];
+	FILE tmp;
+	int chars, olderr;
+
+	if (f->__mode != _IONBF) {
+		olderr = f->__flags & __STDIO_ERR;
+		chars = __vprintf(__fprintf_send, f, fmt, ap);
+		if ((f->__flags & __STDIO_ERR) && !olderr) {
+			return -1;
+		}
+		return chars;
+	}
+
+	tmp.__fd = f->__fd;
+	tmp.__flags = f->__flags & (__STDIO_INUSE|__STDIO_WRITE);
+	tmp.__mode = _IOFBF;
+	tmp.__buf = buf;
+	tmp.__bufsize = sizeof(buf);
+	tmp.__pos = 0;
+	tmp.__len = 0;
+
+	chars = __vprintf(__fprintf_send, &tmp, fmt, ap);
+	fflush(&tmp);
+	if (ferror(&tmp)) {
+		f->__flags |= __STDIO_ERR;
+		return -1;
+	}
+	return chars;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * fread and the other stream input functions.
+ */
+
+/*
+ * Read into P, setting the EOF and error flags. Returns the number
+ * of bytes read (0 at end of file or on error).
+ */
+static
+size_t
+readsome(FILE *f, void *p, size_t len)
+{
+	int r;
+
+	r = read(f->__fd, p, len);
+	if (r < 0) {
+		f->__flags |= __STDIO_ERR;
+		return 0;
+	}
+	if (r == 0) {
+		f->__flags |= __STDIO_EOF;
+	}
+	return r;
+}
+
+size_t
+fread(void *ptr, size_t size, size_t nitems, FILE *f)
+{
+	char *p = ptr;
+	size_t len, done, n;
+
+	len = size * nitems;
+	if (len == 0) {
+		return 0;
+	}
+	if ((f->__flags & __STDIO_READ) == 0) {
+		f->__flags |= __STDIO_ERR;
+		errno = EBADF;
+		return 0;
+	}
+	if (f->__flags & __STDIO_WRBUF) {
+		if (fflush(f)) {
+			return 0;
+		}
+	}
+
+	/*
+	 * Before waiting for input, make sure a pending prompt on
+	 * a line-buffered stdout has been written out.
+	 */
+	if (f->__mode != _IOFBF && stdout->__mode == _IOLBF &&
+	    (stdout->__flags & __STDIO_WRBUF)) {
+		fflush(stdout);
+	}
+	__stdio_getbuf(f);
+
+	done = 0;
+	while (done < len) {
+		if (f->__flags & __STDIO_RDBUF) {
+			n = f->__len - f->__pos;
+			if (n > len - done) {
+				n = len - done;
+			}
+			memcpy(p + done, f->__buf + f->__pos, n);
+			f->__pos += n;
+			done += n;
+			if (f->__pos == f->__len) {
+				f->__flags &= ~__STDIO_RDBUF;
+				f->__pos = f->__len = 0;
+			}
+			continue;
+		}
+
+		if (f->__mode == _IONBF || len - done >= f->__bufsize) {
+			/* Read straight into the caller's memory. */
+			n = readsome(f, p + done, len - done);
+		}
+		else {
+			n = readsome(f, f->__buf, f->__bufsize);
+			if (n > 0) {
+				f->__pos = 0;
+				f->__len = n;
+				f->__flags |= __STDIO_RDBUF;
+				continue;
+			}
+		}
+		if (n == 0) {
+			break;
+		}
+		done += n;
+	}
+	return done / size;
+}
+
+int
+fgetc(FILE *f)
+{
+	unsigned char ch;
+
+	if (fread(&ch, 1, 1, f) != 1) {
+		return EOF;
+	}
+	return ch;
+}
+
+int
+getc(FILE *f)
+{
+	return fgetc(f);
+}
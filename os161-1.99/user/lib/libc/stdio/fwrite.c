@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * fwrite and the other stream output functions.
+ */
+
+/*
+ * Write all of BUF, retrying after short writes. Returns 0, or -1
+ * on error.
+ */
+int
+__stdio_writeall(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	int r;
+
+	while (len > 0) {
+		r = write(fd, p, len);
+		if (r <= 0) {
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static
+int
+hasnewline(const char *p, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (p[i] == '\n') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+size_t
+fwrite(const void *ptr, size_t size, size_t nitems, FILE *f)
+{
+	size_t len = size * nitems;
+
+	if (len == 0) {
+		return 0;
+	}
+	if ((f->__flags & __STDIO_WRITE) == 0) {
+		f->__flags |= __STDIO_ERR;
+		errno = EBADF;
+		return 0;
+	}
+	if (f->__flags & __STDIO_RDBUF) {
+		/* can't write over read-ahead we couldn't give back */
+		if (fflush(f)) {
+			return 0;
+		}
+	}
+	__stdio_getbuf(f);
+
+	if (f->__mode == _IONBF) {
+		if (__stdio_writeall(f->__fd, ptr, len) < 0) {
+			f->__flags |= __STDIO_ERR;
+			return 0;
+		}
+		return nitems;
+	}
+
+	if (f->__pos + len > f->__bufsize) {
+		if (fflush(f)) {
+			return 0;
+		}
+	}
+	if (len >= f->__bufsize) {
+		/* Too big to be worth copying; the buffer is empty now. */
+		if (__stdio_writeall(f->__fd, ptr, len) < 0) {
+			f->__flags |= __STDIO_ERR;
+			return 0;
+		}
+		return nitems;
+	}
+
+	memcpy(f->__buf + f->__pos, ptr, len);
+	f->__pos += len;
+	f->__flags |= __STDIO_WRBUF;
+
+	if (f->__mode == _IOLBF && hasnewline(ptr, len)) {
+		if (fflush(f)) {
+			return 0;
+		}
+	}
+	return nitems;
+}
+
+int
+fputc(int ch, FILE *f)
+{
+	char c = ch;
+
+	if (fwrite(&c, 1, 1, f) != 1) {
+		return EOF;
+	}
+	return (int)(unsigned char)c;
+}
+
+int
+putc(int ch, FILE *f)
+{
+	return fputc(ch, f);
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+	size_t len = strlen(s);
+
+	if (len > 0 && fwrite(s, 1, len, f) != len) {
+		return EOF;
+	}
+	return 0;
+}
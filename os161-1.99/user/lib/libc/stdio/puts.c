@@ -36,7 +36,8 @@
 int
 puts(const char *s)
 {
-	__puts(s);
-	putchar('\n');
+	if (fprintf(stdout, "%s\n", s) < 0) {
+		return EOF;
+	}
 	return 0;
 }
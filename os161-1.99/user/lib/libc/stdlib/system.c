@@ -74,7 +74,8 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
+	/* The child only execs, so don't bother copying our memory. */
+	pid = vfork();
 	switch (pid) {
 	    case -1:
 		return -1;
@@ -0,0 +1,55 @@
+/*
+ * Atomic operations on ints, using LL/SC.
+ *
+ * As in the kernel's spinlock code, the LL and SC are kept in a
+ * single asm statement and we just go around again if the SC fails.
+ */
+
+#include <synch.h>
+
+/*
+ * Store VAL in *P and return the old value.
+ */
+int
+atomic_swap(volatile int *p, int val)
+{
+	int x, y;
+
+	do {
+		y = val;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p) : "memory");
+	} while (y == 0);
+
+	return x;
+}
+
+/*
+ * Add DELTA to *P and return the new value.
+ */
+int
+atomic_add(volatile int *p, int delta)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + delta */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (delta)
+			: "memory");
+	} while (y == 0);
+
+	return x + delta;
+}
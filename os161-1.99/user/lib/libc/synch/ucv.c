@@ -0,0 +1,51 @@
+/*
+ * Futex-based condition variable.
+ *
+ * Waiters sleep on ucv_seq, which signal and broadcast bump before
+ * waking anyone. A waiter that read the old value just before a
+ * signal won't go to sleep, because the kernel rechecks it.
+ */
+
+#include <unistd.h>
+#include <synch.h>
+
+#define UCV_WAKEALL 0x7fffffff
+
+void
+ucv_init(struct ucv *cv)
+{
+	cv->ucv_seq = 0;
+}
+
+void
+ucv_wait(struct ucv *cv, struct umutex *m)
+{
+	int seq;
+
+	seq = cv->ucv_seq;
+	umutex_unlock(m);
+	__futexwait(&cv->ucv_seq, seq);
+
+	/*
+	 * Other threads may have been woken along with us, so take the
+	 * mutex in its contended state rather than through the fast
+	 * path; otherwise their wakeups could get lost.
+	 */
+	while (atomic_swap(&m->um_state, 2) != 0) {
+		__futexwait(&m->um_state, 2);
+	}
+}
+
+void
+ucv_signal(struct ucv *cv)
+{
+	atomic_add(&cv->ucv_seq, 1);
+	__futexwake(&cv->ucv_seq, 1);
+}
+
+void
+ucv_broadcast(struct ucv *cv)
+{
+	atomic_add(&cv->ucv_seq, 1);
+	__futexwake(&cv->ucv_seq, UCV_WAKEALL);
+}
@@ -0,0 +1,46 @@
+/*
+ * Futex-based mutex.
+ *
+ * This is the swap-only variant of the usual three-state futex lock:
+ * um_state is 0 (unlocked), 1 (locked, nobody waiting) or 2 (locked,
+ * maybe somebody waiting). The fast path is a single atomic swap in
+ * each direction; only contended operations make system calls.
+ */
+
+#include <unistd.h>
+#include <synch.h>
+
+void
+umutex_init(struct umutex *m)
+{
+	m->um_state = 0;
+}
+
+void
+umutex_lock(struct umutex *m)
+{
+	int c;
+
+	c = atomic_swap(&m->um_state, 1);
+	if (c == 0) {
+		/* fast path */
+		return;
+	}
+
+	/*
+	 * If we just overwrote a 2 with a 1 we may have hidden some
+	 * waiters from the holder; putting 2 back before we get the
+	 * lock makes sure our own unlock wakes them.
+	 */
+	while ((c = atomic_swap(&m->um_state, 2)) != 0) {
+		__futexwait(&m->um_state, 2);
+	}
+}
+
+void
+umutex_unlock(struct umutex *m)
+{
+	if (atomic_swap(&m->um_state, 0) == 2) {
+		__futexwake(&m->um_state, 1);
+	}
+}
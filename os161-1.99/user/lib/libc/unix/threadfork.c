@@ -0,0 +1,26 @@
+/*
+ * threadfork - start a new thread in the current process.
+ *
+ * The kernel gives the new thread its own stack and starts it in
+ * threadstart, which runs the caller's function and then leaves the
+ * process through __threadexit, so returning from the function ends
+ * the thread.
+ */
+
+#include <unistd.h>
+
+static
+void
+threadstart(void *arg)
+{
+	void (*func)(void) = (void (*)(void))arg;
+
+	func();
+	__threadexit();
+}
+
+int
+threadfork(void (*func)(void))
+{
+	return __threadfork(threadstart, (void *)func);
+}
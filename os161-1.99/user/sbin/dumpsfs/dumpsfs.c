@@ -56,6 +56,31 @@
 
 #include "disk.h"
 
+static
+void
+dumpjournal(uint32_t start, uint32_t nblocks)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+
+	if (nblocks == 0) {
+		printf("No journal\n");
+		return;
+	}
+	diskread(&jh, start);
+	if (SWAPL(jh.jh_magic) != SFS_JMAGIC_HEADER) {
+		printf("Journal: blocks %u-%u, bad header\n",
+		       start, start + nblocks - 1);
+		return;
+	}
+	diskread(&jd, start + 1);
+	printf("Journal: blocks %u-%u, next transaction %u%s\n",
+	       start, start + nblocks - 1, SWAPL(jh.jh_seq),
+	       SWAPL(jd.jd_magic) == SFS_JMAGIC_DESC &&
+	       SWAPL(jd.jd_seq) == SWAPL(jh.jh_seq) ?
+	       " (log not empty)" : "");
+}
+
 static
 uint32_t
 dumpsb(void)
@@ -68,33 +93,72 @@ dumpsb(void)
 	sp.sp_volname[sizeof(sp.sp_volname)-1] = 0;
 	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
 	       SWAPL(sp.sp_nblocks));
+	dumpjournal(SWAPL(sp.sp_journalstart), SWAPL(sp.sp_journalblocks));
 
 	return SWAPL(sp.sp_nblocks);
 }
 
+/* Home bucket of NAME in a hashed directory with NB buckets */
+static
+uint32_t
+homebucket(const char *name, uint32_t nb)
+{
+	uint32_t h = SFS_NAMEHASH_INIT;
+
+	for (; *name; name++) {
+		h = SFS_NAMEHASH(h, *name);
+	}
+	return h % nb;
+}
+
+/*
+ * Print NSDS directory entries. In a hashed directory (NB buckets)
+ * they're bucket BUCKET, and entries that overflowed from another
+ * bucket are marked.
+ */
 static
 void
-dodirblock(uint32_t block)
+doentries(struct sfs_dir *sds, int nsds, uint32_t bucket, uint32_t nb)
 {
-	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
-	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	uint32_t home;
 	int i;
 
-	diskread(&sds, block);
-
-	printf("    [block %u]\n", block);
 	for (i=0; i<nsds; i++) {
 		uint32_t ino = SWAPL(sds[i].sfd_ino);
 		if (ino==SFS_NOINO) {
 			printf("        [free entry]\n");
+			continue;
 		}
-		else {
-			sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
-			printf("        %u %s\n", ino, sds[i].sfd_name);
+		sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
+		printf("        %u %s", ino, sds[i].sfd_name);
+		if (nb != 0) {
+			home = homebucket(sds[i].sfd_name, nb);
+			if (home != bucket) {
+				printf(" (from bucket %u)", home);
+			}
 		}
+		printf("\n");
 	}
 }
 
+static
+void
+dodirblock(uint32_t block, uint32_t bucket, uint32_t nb)
+{
+	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
+	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+
+	diskread(&sds, block);
+
+	if (nb != 0) {
+		printf("    [block %u, bucket %u]\n", block, bucket);
+	}
+	else {
+		printf("    [block %u]\n", block);
+	}
+	doentries(sds, nsds, bucket, nb);
+}
+
 static
 void
 dumpdir(uint32_t ino)
@@ -102,20 +166,37 @@ dumpdir(uint32_t ino)
 	struct sfs_inode sfi;
 	uint32_t ib[SFS_DBPERIDB];
 	int nentries, i;
-	uint32_t block, nblocks=0;
+	uint32_t block, nblocks=0, nb;
 
 	diskread(&sfi, ino);
+	nb = SWAPL(sfi.sfi_dirbuckets);
 
 	nentries = SWAPL(sfi.sfi_size) / sizeof(struct sfs_dir);
 	if (SWAPL(sfi.sfi_size) % sizeof(struct sfs_dir) != 0) {
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
-	printf("Directory %u: %d entries\n", ino, nentries);
+	if (nb != 0) {
+		printf("Directory %u: %d entries, hashed, %u buckets\n",
+		       ino, nentries, nb);
+	}
+	else {
+		printf("Directory %u: %d entries\n", ino, nentries);
+	}
+
+	if (SWAPL(sfi.sfi_size) <= SFS_INLINESIZE &&
+	    sfi.sfi_direct[0] == 0 && sfi.sfi_indirect == 0) {
+		struct sfs_dir sds[SFS_INLINESIZE/sizeof(struct sfs_dir)];
+
+		memcpy(sds, sfi.sfi_inline, nentries*sizeof(struct sfs_dir));
+		printf("    [in inode]\n");
+		doentries(sds, nentries, 0, 0);
+		return;
+	}
 
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = SWAPL(sfi.sfi_direct[i]);
 		if (block) {
-			dodirblock(block);
+			dodirblock(block, i, nb);
 			nblocks++;
 		}
 	}
@@ -124,7 +205,7 @@ dumpdir(uint32_t ino)
 		for (i=0; i<SFS_DBPERIDB; i++) {
 			block = SWAPL(ib[i]);
 			if (block) {
-				dodirblock(block);
+				dodirblock(block, SFS_NDIRECT + i, nb);
 				nblocks++;
 			}
 		}
@@ -104,26 +104,70 @@ diskblocks(void)
 	return nblocks;
 }
 
-void
-diskwrite(const void *data, uint32_t block)
+/*
+ * Byte offset of BLOCK in the disk file.
+ */
+static
+off_t
+diskpos(uint32_t block)
 {
-	const char *cdata = data;
-	uint32_t tot=0;
-	int len;
-
-	assert(fd>=0);
-
 #ifdef HOST
 	// skip over disk file header
 	block++;
 #endif
+	return (off_t)block*BLOCKSIZE;
+}
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+/*
+ * On the host, sfsck checks the disk from several threads at once, so
+ * use pread/pwrite, which don't share a file position. OS/161 doesn't
+ * have them, but there are no threads there either.
+ */
+static
+ssize_t
+doread(void *buf, size_t len, off_t pos)
+{
+#ifdef HOST
+	return pread(fd, buf, len, pos);
+#else
+	if (lseek(fd, pos, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
+	return read(fd, buf, len);
+#endif
+}
+
+static
+ssize_t
+dowrite(const void *buf, size_t len, off_t pos)
+{
+#ifdef HOST
+	return pwrite(fd, buf, len, pos);
+#else
+	if (lseek(fd, pos, SEEK_SET)<0) {
+		err(1, "lseek");
+	}
+	return write(fd, buf, len);
+#endif
+}
+
+/*
+ * Write COUNT consecutive blocks starting at BLOCK in one transfer.
+ */
+void
+diskwritemany(const void *data, uint32_t block, uint32_t count)
+{
+	const char *cdata = data;
+	off_t pos;
+	size_t tot=0, size;
+	int len;
+
+	assert(fd>=0);
 
-	while (tot < BLOCKSIZE) {
-		len = write(fd, cdata + tot, BLOCKSIZE - tot);
+	pos = diskpos(block);
+	size = (size_t)count*BLOCKSIZE;
+	while (tot < size) {
+		len = dowrite(cdata + tot, size - tot, pos + tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -138,25 +182,28 @@ diskwrite(const void *data, uint32_t block)
 }
 
 void
-diskread(void *data, uint32_t block)
+diskwrite(const void *data, uint32_t block)
+{
+	diskwritemany(data, block, 1);
+}
+
+/*
+ * Read COUNT consecutive blocks starting at BLOCK in one transfer.
+ */
+void
+diskreadmany(void *data, uint32_t block, uint32_t count)
 {
 	char *cdata = data;
-	uint32_t tot=0;
+	off_t pos;
+	size_t tot=0, size;
 	int len;
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
-		err(1, "lseek");
-	}
-
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	pos = diskpos(block);
+	size = (size_t)count*BLOCKSIZE;
+	while (tot < size) {
+		len = doread(cdata + tot, size - tot, pos + tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -170,6 +217,30 @@ diskread(void *data, uint32_t block)
 	}
 }
 
+void
+diskread(void *data, uint32_t block)
+{
+	diskreadmany(data, block, 1);
+}
+
+/*
+ * Hint that COUNT blocks starting at BLOCK will be read soon, so the
+ * host can start fetching them. OS/161 has no way to say this.
+ */
+void
+diskprefetch(uint32_t block, uint32_t count)
+{
+	assert(fd>=0);
+
+#if defined(HOST) && defined(POSIX_FADV_WILLNEED)
+	(void)posix_fadvise(fd, diskpos(block), (off_t)count*BLOCKSIZE,
+			    POSIX_FADV_WILLNEED);
+#else
+	(void)block;
+	(void)count;
+#endif
+}
+
 void
 closedisk(void)
 {
@@ -33,6 +33,9 @@ uint32_t diskblocksize(void);
 uint32_t diskblocks(void);
 
 void diskwrite(const void *data, uint32_t block);
+void diskwritemany(const void *data, uint32_t block, uint32_t count);
 void diskread(void *data, uint32_t block);
+void diskreadmany(void *data, uint32_t block, uint32_t count);
+void diskprefetch(uint32_t block, uint32_t count);
 
 void closedisk(void);
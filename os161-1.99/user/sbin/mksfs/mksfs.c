@@ -40,23 +40,42 @@
 
 #ifdef HOST
 
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <netinet/in.h> // for arpa/inet.h
 #include <arpa/inet.h>  // for ntohl
 #include "hostcompat.h"
 #define SWAPL(x) ntohl(x)
 #define SWAPS(x) ntohs(x)
 
+#define USAGE "Usage: mksfs [-d hostdir] device/diskfile volume-name"
+
 #else
 
 #define SWAPL(x) (x)
 #define SWAPS(x) (x)
 
+#define USAGE "Usage: mksfs device/diskfile volume-name"
+
 #endif
 
 #include "disk.h"
 
 #define MAXBITBLOCKS 32
 
+/*
+ * The journal gets room for a few of the largest transactions the
+ * kernel makes (every bitmap block plus a handful of others), but no
+ * more than an eighth of the disk. Disks too small for even the
+ * minimum don't get one.
+ */
+#define JOURNAL_BASE 64
+#define JOURNAL_MIN  16
+
 static
 void
 check(void)
@@ -68,7 +87,8 @@ check(void)
 
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks,
+	   uint32_t jstart, uint32_t jblocks)
 {
 	struct sfs_super sp;
 
@@ -81,10 +101,43 @@ writesuper(const char *volname, uint32_t nblocks)
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
 	strcpy(sp.sp_volname, volname);
+	sp.sp_journalstart = SWAPL(jstart);
+	sp.sp_journalblocks = SWAPL(jblocks);
 
 	diskwrite(&sp, SFS_SB_LOCATION);
 }
 
+static
+uint32_t
+journalsize(uint32_t nblocks)
+{
+	uint32_t jblocks = JOURNAL_BASE + 4*SFS_BITBLOCKS(nblocks);
+
+	if (jblocks > nblocks / 8) {
+		jblocks = nblocks / 8;
+	}
+	return jblocks < JOURNAL_MIN ? 0 : jblocks;
+}
+
+/*
+ * Write the journal header and clear the first log block, so nothing
+ * left on the disk from before looks like a transaction.
+ */
+static
+void
+writejournal(uint32_t jstart, uint32_t jblocks)
+{
+	static char buf[2*SFS_BLOCKSIZE];
+	struct sfs_jheader *jh = (struct sfs_jheader *)buf;
+
+	if (jblocks == 0) {
+		return;
+	}
+	jh->jh_magic = SWAPL(SFS_JMAGIC_HEADER);
+	jh->jh_seq = SWAPL(1);
+	diskwritemany(buf, jstart, 2);
+}
+
 static
 void
 writerootdir(void)
@@ -113,14 +166,17 @@ doallocbit(uint32_t bit)
 	bitbuf[byte] |= mask;
 }
 
+/*
+ * Write the bitmap. Blocks from the end of the bitmap up to USEDEND
+ * hold the journal and anything filled in from a host directory.
+ */
 static
 void
-writebitmap(uint32_t fsblocks)
+writebitmap(uint32_t fsblocks, uint32_t usedend)
 {
 
 	uint32_t nbits = SFS_BITMAPSIZE(fsblocks);
 	uint32_t nblocks = SFS_BITBLOCKS(fsblocks);
-	char *ptr;
 	uint32_t i;
 
 	if (nblocks > MAXBITBLOCKS) {
@@ -133,28 +189,373 @@ writebitmap(uint32_t fsblocks)
 	for (i=0; i<nblocks; i++) {
 		doallocbit(SFS_MAP_LOCATION+i);
 	}
+	for (i=SFS_MAP_LOCATION+nblocks; i<usedend; i++) {
+		doallocbit(i);
+	}
 	for (i=fsblocks; i<nbits; i++) {
 		doallocbit(i);
 	}
 
-	for (i=0; i<nblocks; i++) {
-		ptr = bitbuf + i*SFS_BLOCKSIZE;
-		diskwrite(ptr, SFS_MAP_LOCATION+i);
+	diskwritemany(bitbuf, SFS_MAP_LOCATION, nblocks);
+}
+
+#ifdef HOST
+
+/*
+ * Filling the volume from a host directory (-d).
+ *
+ * The kernel's SFS has only the root directory (lookups don't split
+ * paths), so only the regular files at the top of the host directory
+ * are copied; subdirectories are skipped with a warning rather than
+ * built into a tree nothing could reach.
+ *
+ * Everything is read and laid out first. Each file gets one
+ * contiguous run of blocks: its inode, its first SFS_NDIRECT blocks,
+ * then its indirect block and the rest. The root directory's inode
+ * is fixed at SFS_ROOT_LOCATION, so only its contents are in its run,
+ * which comes first. The whole volume is then written from start to
+ * finish in large transfers.
+ */
+
+/* largest file SFS can hold */
+#define MAXFILEBLOCKS (SFS_NDIRECT + SFS_DBPERIDB)
+
+/* blocks written at once */
+#define WBATCH 128
+
+struct hostfile {
+	char *hf_path;			/* path on the host */
+	char hf_name[SFS_NAMELEN];	/* name in its directory */
+	int hf_isdir;
+	uint32_t hf_size;		/* bytes */
+	uint32_t hf_ino;		/* inode block */
+	uint32_t hf_data;		/* first content block */
+	struct hostfile **hf_children;	/* root only, by name */
+	unsigned hf_nchildren;
+};
+
+static char wbuf[WBATCH*SFS_BLOCKSIZE];
+static uint32_t wstart, wcount;
+
+static
+void *
+domalloc(size_t len)
+{
+	void *x;
+
+	x = malloc(len);
+	if (x == NULL) {
+		errx(1, "Out of memory");
 	}
+	return x;
 }
 
+/*
+ * Blocks needed to hold SIZE bytes: none if they fit in the inode.
+ */
+static
+uint32_t
+datablocks(uint32_t size)
+{
+	if (size <= SFS_INLINESIZE) {
+		return 0;
+	}
+	return SFS_ROUNDUP(size, SFS_BLOCKSIZE) / SFS_BLOCKSIZE;
+}
+
+/*
+ * Where content block I of HF goes: the indirect block sits between
+ * the direct blocks and the rest.
+ */
+static
+uint32_t
+contentblock(const struct hostfile *hf, uint32_t i)
+{
+	return i < SFS_NDIRECT ? hf->hf_data + i : hf->hf_data + i + 1;
+}
+
+static
+int
+childcmp(const void *a, const void *b)
+{
+	const struct hostfile *const *ha = a, *const *hb = b;
+
+	return strcmp((*ha)->hf_name, (*hb)->hf_name);
+}
+
+/*
+ * Read the host file or directory at PATH. NAME is its name in the
+ * root directory, or NULL for the root itself. Returns NULL for
+ * things SFS can't hold, including directories other than the root.
+ */
+static
+struct hostfile *
+scantree(const char *path, const char *name)
+{
+	struct hostfile *hf, *child;
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	char *childpath;
+	unsigned maxchildren = 0;
+	size_t len;
+
+	if (stat(path, &st) < 0) {
+		err(1, "%s", path);
+	}
+	if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+		warnx("%s: Not a file or directory (skipped)", path);
+		return NULL;
+	}
+	if (name != NULL && S_ISDIR(st.st_mode)) {
+		warnx("%s: SFS has no subdirectories (skipped)", path);
+		return NULL;
+	}
+	if (name != NULL) {
+		if (strlen(name) >= SFS_NAMELEN) {
+			errx(1, "%s: Name too long for SFS", path);
+		}
+		if (strchr(name, ':') != NULL) {
+			errx(1, "%s: Colons are not allowed in names", path);
+		}
+	}
+
+	hf = domalloc(sizeof(*hf));
+	bzero(hf, sizeof(*hf));
+	hf->hf_path = domalloc(strlen(path) + 1);
+	strcpy(hf->hf_path, path);
+	strcpy(hf->hf_name, name != NULL ? name : "");
+
+	if (S_ISREG(st.st_mode)) {
+		if (st.st_size > MAXFILEBLOCKS * SFS_BLOCKSIZE) {
+			errx(1, "%s: Too large for SFS", path);
+		}
+		hf->hf_size = st.st_size;
+		return hf;
+	}
+
+	hf->hf_isdir = 1;
+	dir = opendir(path);
+	if (dir == NULL) {
+		err(1, "%s", path);
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		len = strlen(path) + strlen(de->d_name) + 2;
+		childpath = domalloc(len);
+		snprintf(childpath, len, "%s/%s", path, de->d_name);
+		child = scantree(childpath, de->d_name);
+		free(childpath);
+		if (child == NULL) {
+			continue;
+		}
+		if (hf->hf_nchildren == maxchildren) {
+			maxchildren = maxchildren ? maxchildren*2 : 16;
+			hf->hf_children = realloc(hf->hf_children,
+				maxchildren * sizeof(struct hostfile *));
+			if (hf->hf_children == NULL) {
+				errx(1, "Out of memory");
+			}
+		}
+		hf->hf_children[hf->hf_nchildren++] = child;
+	}
+	closedir(dir);
+
+	qsort(hf->hf_children, hf->hf_nchildren, sizeof(struct hostfile *),
+	      childcmp);
+
+	/* . and .. come first */
+	hf->hf_size = (hf->hf_nchildren + 2) * sizeof(struct sfs_dir);
+	if (datablocks(hf->hf_size) > MAXFILEBLOCKS) {
+		errx(1, "%s: Too many entries for SFS", path);
+	}
+	return hf;
+}
+
+/*
+ * Hand out HF's run of blocks, and then its files', starting at *NEXT.
+ */
+static
+void
+layout(struct hostfile *hf, uint32_t *next)
+{
+	uint32_t n;
+	unsigned i;
+
+	if (hf->hf_ino != SFS_ROOT_LOCATION) {
+		hf->hf_ino = (*next)++;
+	}
+	hf->hf_data = *next;
+	n = datablocks(hf->hf_size);
+	*next += n + (n > SFS_NDIRECT ? 1 : 0);
+
+	for (i=0; i<hf->hf_nchildren; i++) {
+		layout(hf->hf_children[i], next);
+	}
+}
+
+static
+void
+emitflush(void)
+{
+	if (wcount > 0) {
+		diskwritemany(wbuf, wstart, wcount);
+		wstart += wcount;
+		wcount = 0;
+	}
+}
+
+/*
+ * Queue BLOCK to be written. Blocks must come in order.
+ */
+static
+void
+emit(const void *data, uint32_t block)
+{
+	assert(block == wstart + wcount);
+	memcpy(wbuf + wcount*SFS_BLOCKSIZE, data, SFS_BLOCKSIZE);
+	wcount++;
+	if (wcount == WBATCH) {
+		emitflush();
+	}
+}
+
+/*
+ * Write HF's inode and contents. CONTENTS is padded with zeros to a
+ * whole number of blocks, or to SFS_INLINESIZE if it goes in the
+ * inode.
+ */
+static
+void
+writeobject(const struct hostfile *hf, const char *contents)
+{
+	struct sfs_inode sfi;
+	uint32_t indir[SFS_DBPERIDB];
+	uint32_t n, i;
+
+	n = datablocks(hf->hf_size);
+
+	bzero(&sfi, sizeof(sfi));
+	sfi.sfi_size = SWAPL(hf->hf_size);
+	sfi.sfi_type = SWAPS(hf->hf_isdir ? SFS_TYPE_DIR : SFS_TYPE_FILE);
+	sfi.sfi_linkcount = SWAPS(hf->hf_isdir ? 2 : 1);
+	if (n == 0) {
+		memcpy(sfi.sfi_inline, contents, SFS_INLINESIZE);
+	}
+	for (i=0; i<n && i<SFS_NDIRECT; i++) {
+		sfi.sfi_direct[i] = SWAPL(contentblock(hf, i));
+	}
+	if (n > SFS_NDIRECT) {
+		bzero(indir, sizeof(indir));
+		for (i=SFS_NDIRECT; i<n; i++) {
+			indir[i - SFS_NDIRECT] = SWAPL(contentblock(hf, i));
+		}
+		sfi.sfi_indirect = SWAPL(hf->hf_data + SFS_NDIRECT);
+	}
+
+	if (hf->hf_ino == SFS_ROOT_LOCATION) {
+		diskwrite(&sfi, SFS_ROOT_LOCATION);
+	}
+	else {
+		emit(&sfi, hf->hf_ino);
+	}
+
+	for (i=0; i<n; i++) {
+		if (i == SFS_NDIRECT) {
+			emit(indir, hf->hf_data + SFS_NDIRECT);
+		}
+		emit(contents + i*SFS_BLOCKSIZE, contentblock(hf, i));
+	}
+}
+
+static
+void
+readhostfile(const struct hostfile *hf, char *buf)
+{
+	uint32_t tot = 0;
+	ssize_t len;
+	int fd;
+
+	fd = open(hf->hf_path, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", hf->hf_path);
+	}
+	while (tot < hf->hf_size) {
+		len = read(fd, buf + tot, hf->hf_size - tot);
+		if (len < 0) {
+			err(1, "%s", hf->hf_path);
+		}
+		if (len == 0) {
+			errx(1, "%s: File shrank while being copied",
+			     hf->hf_path);
+		}
+		tot += len;
+	}
+	close(fd);
+}
+
+/*
+ * Write HF and the files in it. The directory is finished with its
+ * contents buffer before going on to the files, so one buffer does
+ * for all of them.
+ */
+static
+void
+writetree(const struct hostfile *hf, uint32_t parentino)
+{
+	static char contents[MAXFILEBLOCKS*SFS_BLOCKSIZE];
+	struct sfs_dir *sd;
+	uint32_t n;
+	unsigned i;
+
+	n = datablocks(hf->hf_size);
+	bzero(contents, n > 0 ? n * SFS_BLOCKSIZE : SFS_INLINESIZE);
+	if (!hf->hf_isdir) {
+		readhostfile(hf, contents);
+		writeobject(hf, contents);
+		return;
+	}
+
+	sd = (struct sfs_dir *)contents;
+	sd[0].sfd_ino = SWAPL(hf->hf_ino);
+	strcpy(sd[0].sfd_name, ".");
+	sd[1].sfd_ino = SWAPL(parentino);
+	strcpy(sd[1].sfd_name, "..");
+	for (i=0; i<hf->hf_nchildren; i++) {
+		sd[i+2].sfd_ino = SWAPL(hf->hf_children[i]->hf_ino);
+		strcpy(sd[i+2].sfd_name, hf->hf_children[i]->hf_name);
+	}
+	writeobject(hf, contents);
+
+	for (i=0; i<hf->hf_nchildren; i++) {
+		writetree(hf->hf_children[i], hf->hf_ino);
+	}
+}
+
+#endif /* HOST */
+
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize, jstart, jblocks, datastart, next;
 	char *volname, *s;
-
 #ifdef HOST
+	struct hostfile *root = NULL;
+	const char *hostdir = NULL;
+
 	hostcompat_init(argc, argv);
+
+	if (argc==5 && !strcmp(argv[1], "-d")) {
+		hostdir = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
 #endif
 
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, USAGE);
 	}
 
 	check();
@@ -184,10 +585,43 @@ main(int argc, char **argv)
 		     blocksize, SFS_BLOCKSIZE);
 	}
 	size = diskblocks();
+	jstart = SFS_MAP_LOCATION + SFS_BITBLOCKS(size);
+	jblocks = journalsize(size);
+	datastart = jstart + jblocks;
+	next = datastart;
 
-	writesuper(volname, size);
+#ifdef HOST
+	if (hostdir != NULL) {
+		root = scantree(hostdir, NULL);
+		if (root == NULL || !root->hf_isdir) {
+			errx(1, "%s: Not a directory", hostdir);
+		}
+		root->hf_ino = SFS_ROOT_LOCATION;
+		layout(root, &next);
+		if (next > size) {
+			errx(1, "%s needs %lu blocks; the disk has %lu",
+			     hostdir, (unsigned long) next,
+			     (unsigned long) size);
+		}
+	}
+#endif
+
+	writesuper(volname, size, jstart, jblocks);
+	writebitmap(size, next);
+	writejournal(jstart, jblocks);
+
+#ifdef HOST
+	if (root != NULL) {
+		wstart = datastart;
+		writetree(root, SFS_ROOT_LOCATION);
+		emitflush();
+	}
+	else {
+		writerootdir();
+	}
+#else
 	writerootdir();
-	writebitmap(size);
+#endif
 
 	closedisk();
 
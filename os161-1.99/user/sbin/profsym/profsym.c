@@ -0,0 +1,354 @@
+/*
+ * profsym - print a kernel profile by function.
+ *
+ * Usage: profsym dumpfile kernel [program]
+ *
+ * Reads a file written by the kernel menu's "prof dump" command and
+ * the kernel it was taken with, and prints how many samples landed in
+ * each kernel function, busiest first. If the user program that was
+ * running is given too, user samples are broken down the same way;
+ * otherwise they are lumped together.
+ *
+ * This only runs on the host. It reads the ELF symbol tables itself,
+ * so it doesn't depend on the host having ELF headers or libraries.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for ntohl
+
+#include "kern/prof.h"
+
+/* The bits of ELF we need. */
+#define EI_CLASS       4
+#define EI_DATA        5
+#define ELFCLASS32     1
+#define ELFDATA2LSB    1
+#define SHT_SYMTAB     2
+#define STT_NOTYPE     0
+#define STT_FUNC       2
+#define SHN_UNDEF      0
+
+struct symbol {
+	uint32_t addr;
+	uint32_t size;
+	const char *name;
+	unsigned long samples;
+};
+
+struct symtab {
+	struct symbol *syms;
+	unsigned nsyms;
+};
+
+/* one line of output */
+struct entry {
+	const char *name;
+	unsigned long samples;
+};
+
+static struct entry *entries;
+static unsigned nentries, maxentries;
+static unsigned long totalsamples;
+
+////////////////////////////////////////////////////////////
+// files
+
+static
+void *
+readfile(const char *file, size_t *lenret)
+{
+	FILE *f;
+	char *buf;
+	long len;
+
+	f = fopen(file, "rb");
+	if (f == NULL) {
+		err(1, "%s", file);
+	}
+	if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0) {
+		err(1, "%s", file);
+	}
+	rewind(f);
+	buf = malloc(len + 1);
+	if (buf == NULL) {
+		errx(1, "Out of memory");
+	}
+	if (fread(buf, 1, len, f) != (size_t)len) {
+		errx(1, "%s: Read error", file);
+	}
+	fclose(f);
+	*lenret = len;
+	return buf;
+}
+
+////////////////////////////////////////////////////////////
+// ELF symbols
+
+static int elf_lsb;
+
+static
+uint32_t
+get16(const unsigned char *p)
+{
+	return elf_lsb ? p[0] | p[1] << 8 : p[0] << 8 | p[1];
+}
+
+static
+uint32_t
+get32(const unsigned char *p)
+{
+	return elf_lsb ?
+		(uint32_t)p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24 :
+		(uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static
+int
+symcmp(const void *a, const void *b)
+{
+	const struct symbol *sa = a, *sb = b;
+
+	if (sa->addr != sb->addr) {
+		return sa->addr < sb->addr ? -1 : 1;
+	}
+	/* prefer functions with a size over bare labels */
+	return sa->size > sb->size ? -1 : sa->size < sb->size;
+}
+
+/*
+ * Load the function symbols from an ELF file, sorted by address.
+ */
+static
+void
+loadsyms(const char *file, struct symtab *st)
+{
+	const unsigned char *buf, *sh, *sym, *symtab = NULL;
+	const char *strtab;
+	uint32_t shoff, shentsize, shnum, symsize = 0, strndx = 0, stroff;
+	uint32_t i, type;
+	size_t len;
+
+	buf = readfile(file, &len);
+	if (len < 52 || memcmp(buf, "\177ELF", 4) != 0 ||
+	    buf[EI_CLASS] != ELFCLASS32) {
+		errx(1, "%s: Not a 32-bit ELF file", file);
+	}
+	elf_lsb = buf[EI_DATA] == ELFDATA2LSB;
+
+	shoff = get32(buf + 32);
+	shentsize = get16(buf + 46);
+	shnum = get16(buf + 48);
+	if (shoff + shnum * shentsize > len) {
+		errx(1, "%s: Bad section headers", file);
+	}
+
+	for (i = 0; i < shnum; i++) {
+		sh = buf + shoff + i * shentsize;
+		if (get32(sh + 4) == SHT_SYMTAB) {
+			symtab = buf + get32(sh + 16);
+			symsize = get32(sh + 20);
+			strndx = get32(sh + 24);
+			break;
+		}
+	}
+	if (symtab == NULL || strndx >= shnum) {
+		errx(1, "%s: No symbol table", file);
+	}
+	stroff = get32(buf + shoff + strndx * shentsize + 16);
+	strtab = (const char *)buf + stroff;
+
+	st->syms = malloc((symsize / 16 + 1) * sizeof(struct symbol));
+	if (st->syms == NULL) {
+		errx(1, "Out of memory");
+	}
+	st->nsyms = 0;
+	for (sym = symtab; sym + 16 <= symtab + symsize; sym += 16) {
+		type = sym[12] & 0xf;
+		if ((type != STT_FUNC && type != STT_NOTYPE) ||
+		    get16(sym + 14) == SHN_UNDEF || get32(sym) == 0) {
+			continue;
+		}
+		st->syms[st->nsyms].name = strtab + get32(sym);
+		st->syms[st->nsyms].addr = get32(sym + 4);
+		st->syms[st->nsyms].size = get32(sym + 8);
+		st->syms[st->nsyms].samples = 0;
+		if (st->syms[st->nsyms].name[0] == '\0') {
+			continue;
+		}
+		st->nsyms++;
+	}
+	qsort(st->syms, st->nsyms, sizeof(struct symbol), symcmp);
+}
+
+/*
+ * Find the symbol that covers ADDR: the last one starting at or
+ * before it, as long as ADDR isn't past its end.
+ */
+static
+struct symbol *
+findsym(struct symtab *st, uint32_t addr)
+{
+	unsigned lo = 0, hi = st->nsyms, mid;
+	struct symbol *s;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (st->syms[mid].addr <= addr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return NULL;
+	}
+	s = &st->syms[lo - 1];
+	/* labels in assembler code often have no size */
+	if (s->size != 0 && addr >= s->addr + s->size) {
+		return NULL;
+	}
+	return s;
+}
+
+////////////////////////////////////////////////////////////
+// output
+
+static
+void
+addentry(const char *name, unsigned long samples)
+{
+	if (samples == 0) {
+		return;
+	}
+	if (nentries == maxentries) {
+		maxentries = maxentries ? maxentries * 2 : 256;
+		entries = realloc(entries, maxentries * sizeof(struct entry));
+		if (entries == NULL) {
+			errx(1, "Out of memory");
+		}
+	}
+	entries[nentries].name = name;
+	entries[nentries].samples = samples;
+	nentries++;
+	totalsamples += samples;
+}
+
+/*
+ * Attribute a histogram's buckets to the functions in ST, or lump
+ * them all under LUMPNAME if there's no symbol table.
+ */
+static
+void
+attribute(const uint32_t *counts, uint32_t nbuckets, uint32_t base,
+	  uint32_t shift, struct symtab *st, const char *lumpname,
+	  const char *unknownname)
+{
+	unsigned long unknown = 0, lump = 0;
+	struct symbol *s;
+	uint32_t i, n;
+
+	for (i = 0; i < nbuckets; i++) {
+		n = ntohl(counts[i]);
+		if (n == 0) {
+			continue;
+		}
+		if (st == NULL) {
+			lump += n;
+			continue;
+		}
+		s = findsym(st, base + (i << shift));
+		if (s == NULL) {
+			unknown += n;
+		}
+		else {
+			s->samples += n;
+		}
+	}
+
+	if (st != NULL) {
+		for (i = 0; i < st->nsyms; i++) {
+			addentry(st->syms[i].name, st->syms[i].samples);
+		}
+	}
+	addentry(lumpname, lump);
+	addentry(unknownname, unknown);
+}
+
+static
+int
+entrycmp(const void *a, const void *b)
+{
+	const struct entry *ea = a, *eb = b;
+
+	if (ea->samples != eb->samples) {
+		return ea->samples > eb->samples ? -1 : 1;
+	}
+	return strcmp(ea->name, eb->name);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct symtab ksyms, usyms;
+	const struct prof_header *ph;
+	const uint32_t *kcounts, *ucounts;
+	uint32_t hz, shift, nk, nu;
+	unsigned i;
+	size_t len;
+	char *buf;
+
+	if (argc != 3 && argc != 4) {
+		errx(1, "Usage: profsym dumpfile kernel [program]");
+	}
+
+	buf = readfile(argv[1], &len);
+	ph = (const struct prof_header *)buf;
+	if (len < sizeof(*ph) || ntohl(ph->ph_magic) != PROF_MAGIC) {
+		errx(1, "%s: Not a profile dump", argv[1]);
+	}
+	hz = ntohl(ph->ph_hz);
+	shift = ntohl(ph->ph_shift);
+	nk = ntohl(ph->ph_nkbuckets);
+	nu = ntohl(ph->ph_nubuckets);
+	if (len != sizeof(*ph) + (nk + nu) * sizeof(uint32_t)) {
+		errx(1, "%s: Wrong size", argv[1]);
+	}
+	kcounts = (const uint32_t *)(buf + sizeof(*ph));
+	ucounts = kcounts + nk;
+
+	loadsyms(argv[2], &ksyms);
+	attribute(kcounts, nk, ntohl(ph->ph_kbase), shift, &ksyms,
+		  NULL, "(kernel, unknown)");
+	if (argc == 4) {
+		loadsyms(argv[3], &usyms);
+		attribute(ucounts, nu, ntohl(ph->ph_ubase), shift, &usyms,
+			  NULL, "(user, unknown)");
+	}
+	else {
+		attribute(ucounts, nu, ntohl(ph->ph_ubase), shift, NULL,
+			  "(user)", NULL);
+	}
+	addentry("(other)", ntohl(ph->ph_other));
+
+	if (totalsamples == 0) {
+		printf("No samples.\n");
+		return 0;
+	}
+	qsort(entries, nentries, sizeof(struct entry), entrycmp);
+
+	printf("%lu samples at %u Hz per cpu\n\n", totalsamples, hz);
+	printf("  samples      %%  function\n");
+	for (i = 0; i < nentries; i++) {
+		printf("%9lu %6.2f  %s\n", entries[i].samples,
+		       100.0 * entries[i].samples / totalsamples,
+		       entries[i].name);
+	}
+	return 0;
+}
@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <err.h>
 
 #include "support.h"
@@ -42,9 +43,12 @@
 #ifdef HOST
 #include <netinet/in.h> // for arpa/inet.h
 #include <arpa/inet.h>  // for ntohl
+#include <sys/time.h>
+#include <pthread.h>
 #include "hostcompat.h"
 #define SWAPL(x) ntohl(x)
 #define SWAPS(x) ntohs(x)
+#define USE_THREADS
 
 #else
 
@@ -57,6 +61,22 @@
 
 #include "disk.h"
 
+/*
+ * With threads, everything pass 1b shares (the bitmaps, the counters,
+ * and badness) is protected by one lock. The threads spend most of
+ * their time reading, so it isn't contended much.
+ */
+#ifdef USE_THREADS
+static pthread_mutex_t fscklock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK()   pthread_mutex_lock(&fscklock)
+#define UNLOCK() pthread_mutex_unlock(&fscklock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/* most blocks read in one transfer */
+#define BATCH 64
 
 #define EXIT_USAGE    4
 #define EXIT_FATAL    3
@@ -70,9 +90,11 @@ static
 void
 setbadness(int code)
 {
+	LOCK();
 	if (badness < code) {
 		badness = code;
 	}
+	UNLOCK();
 }
 
 ////////////////////////////////////////////////////////////
@@ -83,6 +105,8 @@ swapsb(struct sfs_super *sp)
 {
 	sp->sp_magic = SWAPL(sp->sp_magic);
 	sp->sp_nblocks = SWAPL(sp->sp_nblocks);
+	sp->sp_journalstart = SWAPL(sp->sp_journalstart);
+	sp->sp_journalblocks = SWAPL(sp->sp_journalblocks);
 }
 
 static
@@ -98,6 +122,7 @@ swapinode(struct sfs_inode *sfi)
 	for (i=0; i<SFS_NDIRECT; i++) {
 		sfi->sfi_direct[i] = SWAPL(sfi->sfi_direct[i]);
 	}
+	sfi->sfi_dirbuckets = SWAPL(sfi->sfi_dirbuckets);
 
 #ifdef SFS_NIDIRECT
 	for (i=0; i<SFS_NIDIRECT; i++) {
@@ -172,6 +197,7 @@ domalloc(size_t len)
 typedef enum {
 	B_SUPERBLOCK,	/* Block that is the superblock */
 	B_BITBLOCK,	/* Block used by free-block bitmap */
+	B_JOURNAL,	/* Block of the metadata journal */
 	B_INODE,	/* Block that is an inode */
 	B_IBLOCK,	/* Indirect (or doubly-indirect etc.) block */
 	B_DIRDATA,	/* Data block of a directory */
@@ -210,6 +236,7 @@ blockusagestr(blockusage_t how, uint32_t howdesc)
 	switch (how) {
 	    case B_SUPERBLOCK: return "superblock";
 	    case B_BITBLOCK: return "bitmap block";
+	    case B_JOURNAL: return "journal block";
 	    case B_INODE: return "inode";
 	    case B_IBLOCK: 
 		snprintf(rv, sizeof(rv), "indirect block of inode %lu", 
@@ -238,17 +265,19 @@ bitmap_mark(uint32_t block, blockusage_t how, uint32_t howdesc)
 {
 	unsigned index = block/8;
 	uint8_t mask = ((uint8_t)1)<<(block%8);
+	int inuse = 0;
 
+	LOCK();
 	if (how == B_TOFREE) {
-		if (tofreedata[index] & mask) {
-			/* already marked to free once, ignore */
-			return;
-		}
-		if (bitmapdata[index] & mask) {
-			/* block is used elsewhere, ignore */
-			return;
+		/*
+		 * Ignore it if it's already marked to free once, or if
+		 * it's used elsewhere.
+		 */
+		if ((tofreedata[index] & mask) == 0 &&
+		    (bitmapdata[index] & mask) == 0) {
+			tofreedata[index] |= mask;
 		}
-		tofreedata[index] |= mask;
+		UNLOCK();
 		return;
 	}
 
@@ -258,9 +287,10 @@ bitmap_mark(uint32_t block, blockusage_t how, uint32_t howdesc)
 	}
 
 	if (bitmapdata[index] & mask) {
+		/* blockusagestr's buffer is covered by the lock too */
 		warnx("Block %lu (used as %s) already in use! (NOT FIXED)",
 		      (unsigned long) block, blockusagestr(how, howdesc));
-		setbadness(EXIT_UNRECOV);
+		inuse = 1;
 	}
 
 	bitmapdata[index] |= mask;
@@ -268,6 +298,11 @@ bitmap_mark(uint32_t block, blockusage_t how, uint32_t howdesc)
 	if (how != B_PASTEND) {
 		count_blocks++;
 	}
+	UNLOCK();
+
+	if (inuse) {
+		setbadness(EXIT_UNRECOV);
+	}
 }
 
 static
@@ -373,38 +408,22 @@ check_bitmap(void)
 
 ////////////////////////////////////////////////////////////
 
-struct inodememory {
-	uint32_t ino;
-	uint32_t linkcount;	/* files only; 0 for dirs */
-};
+/*
+ * What the directory walk found at each inode, indexed by block
+ * number: INODE_UNSEEN, INODE_DIR, or for a file the number of links
+ * to it seen so far. Indexing by block makes each lookup a single
+ * access, and lets pass 1b visit the files in disk order.
+ */
+#define INODE_UNSEEN  0
+#define INODE_DIR     0xffffffff
 
-static struct inodememory *inodes = NULL;
-static int ninodes=0, maxinodes=0;
+static uint32_t *inodeuse;
 
 static
-void
-addmemory(uint32_t ino, uint32_t linkcount)
+int
+isfile(uint32_t ino)
 {
-	assert(ninodes <= maxinodes);
-	if (ninodes == maxinodes) {
-#ifdef NO_REALLOC
-		int newmax = (maxinodes+1)*2;
-		void *p = domalloc(newmax * sizeof(struct inodememory));
-		if (inodes) {
-			memcpy(p, inodes, ninodes);
-			free(inodes);
-		}
-		inodes = p;
-#else
-		maxinodes = (maxinodes+1)*2;
-		inodes = realloc(inodes, maxinodes * sizeof(uint32_t));
-		if (inodes==NULL) {
-			errx(EXIT_FATAL, "Out of memory");
-		}
-#endif
-	}
-	inodes[ninodes].ino = ino;
-	inodes[ninodes].linkcount = linkcount;
+	return inodeuse[ino] != INODE_UNSEEN && inodeuse[ino] != INODE_DIR;
 }
 
 /* returns nonzero if directory already remembered */
@@ -412,66 +431,32 @@ static
 int
 remember_dir(uint32_t ino, const char *pathsofar)
 {
-	int i;
-
 	/* don't use this for now */
 	(void)pathsofar;
 
-	for (i=0; i<ninodes; i++) {
-		if (inodes[i].ino==ino) {
-			assert(inodes[i].linkcount==0);
-			return 1;
-		}
+	if (inodeuse[ino] != INODE_UNSEEN) {
+		assert(inodeuse[ino] == INODE_DIR);
+		return 1;
 	}
-
-	addmemory(ino, 0);
-
+	inodeuse[ino] = INODE_DIR;
 	return 0;
 }
 
+/*
+ * Count a link to a file. Its blocks are checked later, by pass 1b,
+ * once however many links it has.
+ */
 static
 void
 observe_filelink(uint32_t ino)
 {
-	int i;
-	for (i=0; i<ninodes; i++) {
-		if (inodes[i].ino==ino) {
-			assert(inodes[i].linkcount>0);
-			inodes[i].linkcount++;
-			return;
-		}
+	if (inodeuse[ino] != INODE_UNSEEN) {
+		assert(isfile(ino));
+		inodeuse[ino]++;
+		return;
 	}
 	bitmap_mark(ino, B_INODE, ino);
-	addmemory(ino, 1);
-}
-
-static
-void
-adjust_filelinks(void)
-{
-	struct sfs_inode sfi;
-	int i;
-
-	for (i=0; i<ninodes; i++) {
-		if (inodes[i].linkcount==0) {
-			/* directory */
-			continue;
-		}
-		diskread(&sfi, inodes[i].ino);
-		swapinode(&sfi);
-		assert(sfi.sfi_type == SFS_TYPE_FILE);
-		if (sfi.sfi_linkcount != inodes[i].linkcount) {
-			warnx("File %lu link count %lu should be %lu (fixed)",
-			      (unsigned long) inodes[i].ino,
-			      (unsigned long) sfi.sfi_linkcount,
-			      (unsigned long) inodes[i].linkcount);
-			sfi.sfi_linkcount = inodes[i].linkcount;
-			setbadness(EXIT_RECOV);
-			swapinode(&sfi);
-			diskwrite(&sfi, inodes[i].ino);
-		}
-		count_files++;
-	}
+	inodeuse[ino] = 1;
 }
 
 ////////////////////////////////////////////////////////////
@@ -508,6 +493,115 @@ checkbadstring(char *buf)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Replaying the journal, as the kernel does at mount; see kern/sfs.h.
+ * This has to happen before anything else is looked at.
+ */
+
+/* Add a block into a transaction's checksum */
+static
+uint32_t
+jsum(uint32_t sum, const void *block)
+{
+	const uint32_t *words = block;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(uint32_t); i++) {
+		sum = SFS_JSUM(sum, SWAPL(words[i]));
+	}
+	return sum;
+}
+
+/*
+ * Check the transaction SEQ whose first descriptor is at block POS
+ * (counted from LOG) and, if it's complete, return the block after its
+ * commit record; otherwise 0. If APPLY is set, also write the images
+ * to where they belong.
+ */
+static
+uint32_t
+journal_tx(uint32_t log, uint32_t size, uint32_t pos, uint32_t seq,
+	   int apply)
+{
+	union {
+		struct sfs_jdesc jd;
+		struct sfs_jcommit jc;
+	} buf;
+	char image[SFS_BLOCKSIZE];
+	uint32_t sum = 0, first = pos, count, i;
+
+	while (pos < size) {
+		diskread(&buf, log + pos);
+		if (SWAPL(buf.jc.jc_magic) == SFS_JMAGIC_COMMIT &&
+		    SWAPL(buf.jc.jc_seq) == seq && pos > first) {
+			if (SWAPL(buf.jc.jc_nblocks) != pos - first ||
+			    SWAPL(buf.jc.jc_sum) != sum) {
+				return 0;
+			}
+			return pos + 1;
+		}
+		count = SWAPL(buf.jd.jd_count);
+		if (SWAPL(buf.jd.jd_magic) != SFS_JMAGIC_DESC ||
+		    SWAPL(buf.jd.jd_seq) != seq ||
+		    count == 0 || count > SFS_JDESC_MAX) {
+			return 0;
+		}
+		for (i=0; i<count; i++) {
+			if (SWAPL(buf.jd.jd_blocks[i]) >= nblocks) {
+				return 0;
+			}
+		}
+		sum = jsum(sum, &buf);
+		pos++;
+		for (i=0; i<count && pos < size; i++, pos++) {
+			diskread(image, log + pos);
+			sum = jsum(sum, image);
+			if (apply) {
+				diskwrite(image, SWAPL(buf.jd.jd_blocks[i]));
+			}
+		}
+	}
+	return 0;
+}
+
+static
+void
+replay_journal(uint32_t start, uint32_t size)
+{
+	struct sfs_jheader jh;
+	uint32_t seq, pos = 0, next, count = 0;
+
+	diskread(&jh, start);
+	if (SWAPL(jh.jh_magic) != SFS_JMAGIC_HEADER) {
+		warnx("Journal header has bad magic number (fixed)");
+		setbadness(EXIT_RECOV);
+		bzero(&jh, sizeof(jh));
+		jh.jh_magic = SWAPL(SFS_JMAGIC_HEADER);
+		jh.jh_seq = SWAPL(1);
+		diskwrite(&jh, start);
+		/* and make sure the log looks empty */
+		diskwrite(&jh, start + 1);
+		return;
+	}
+	seq = SWAPL(jh.jh_seq);
+
+	/* Check each transaction completely before applying any of it. */
+	while ((next = journal_tx(start + 1, size - 1, pos, seq, 0)) != 0) {
+		journal_tx(start + 1, size - 1, pos, seq, 1);
+		pos = next;
+		seq++;
+		count++;
+	}
+	if (count > 0) {
+		warnx("Replayed %lu journal transaction%s",
+		      (unsigned long) count, count == 1 ? "" : "s");
+		jh.jh_seq = SWAPL(seq);
+		diskwrite(&jh, start);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 static
 void
 check_sb(void)
@@ -529,7 +623,28 @@ check_sb(void)
 	assert(nblocks>0);
 	assert(bitblocks>0);
 
+	if (sp.sp_journalblocks != 0 &&
+	    (sp.sp_journalstart < SFS_MAP_LOCATION + bitblocks ||
+	     sp.sp_journalblocks < 2 ||
+	     sp.sp_journalstart + sp.sp_journalblocks > nblocks)) {
+		warnx("Journal location is invalid (journal removed)");
+		setbadness(EXIT_RECOV);
+		sp.sp_journalstart = 0;
+		sp.sp_journalblocks = 0;
+		schanged = 1;
+	}
+	else if (sp.sp_journalblocks != 0) {
+		replay_journal(sp.sp_journalstart, sp.sp_journalblocks);
+		/* the superblock may have been in there */
+		diskread(&sp, SFS_SB_LOCATION);
+		swapsb(&sp);
+	}
+
 	bitmap_init(bitblocks);
+	inodeuse = domalloc(bitblocks * SFS_BLOCKBITS * sizeof(uint32_t));
+	for (i=0; i<bitblocks * SFS_BLOCKBITS; i++) {
+		inodeuse[i] = INODE_UNSEEN;
+	}
 	for (i=nblocks; i<bitblocks*SFS_BLOCKBITS; i++) {
 		bitmap_mark(i, B_PASTEND, 0);
 	}
@@ -554,6 +669,9 @@ check_sb(void)
 	for (i=0; i<bitblocks; i++) {
 		bitmap_mark(SFS_MAP_LOCATION+i, B_BITBLOCK, i);
 	}
+	for (i=0; i<sp.sp_journalblocks; i++) {
+		bitmap_mark(sp.sp_journalstart+i, B_JOURNAL, i);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -703,6 +821,44 @@ check_inode_blocks(uint32_t ino, struct sfs_inode *sfi, int isdir)
 	return 0;
 }
 
+/*
+ * Check if an inode keeps its contents inline. Only meaningful once
+ * check_inode_blocks has dropped any blocks past EOF.
+ */
+static
+int
+isinline(const struct sfs_inode *sfi)
+{
+	return sfi->sfi_size <= SFS_INLINESIZE && sfi->sfi_direct[0] == 0;
+}
+
+/*
+ * Inline space past EOF, or in an inode that has blocks, must be zero.
+ * Returns nonzero if inode modified.
+ */
+static
+int
+check_inline(uint32_t ino, struct sfs_inode *sfi)
+{
+	uint32_t i, start;
+
+	start = isinline(sfi) ? sfi->sfi_size : 0;
+	for (i=start; i<SFS_INLINESIZE; i++) {
+		if (sfi->sfi_inline[i] != 0) {
+			break;
+		}
+	}
+	if (i == SFS_INLINESIZE) {
+		return 0;
+	}
+
+	warnx("Inode %lu: garbage in inline data (cleared)",
+	      (unsigned long) ino);
+	bzero(sfi->sfi_inline + start, SFS_INLINESIZE - start);
+	setbadness(EXIT_RECOV);
+	return 1;
+}
+
 ////////////////////////////////////////////////////////////
 
 static
@@ -809,13 +965,27 @@ dirread(struct sfs_inode *sfi, struct sfs_dir *d, unsigned nd)
 {
 	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
 	unsigned nblocks = SFS_ROUNDUP(nd, atonce) / atonce;
-	unsigned i, j;
+	unsigned i, j, n;
 
-	for (i=0; i<nblocks; i++) {
+	if (isinline(sfi)) {
+		memcpy(d, sfi->sfi_inline, nd*sizeof(struct sfs_dir));
+		for (i=0; i<nd; i++) {
+			swapdir(&d[i]);
+		}
+		return;
+	}
+
+	for (i=0; i<nblocks; i+=n) {
 		uint32_t block = dobmap(sfi, i);
+		n = 1;
 		if (block!=0) {
-			diskread(d + i*atonce, block);
-			for (j=0; j<atonce; j++) {
+			/* read runs of consecutive blocks together */
+			while (i+n < nblocks && n < BATCH &&
+			       dobmap(sfi, i+n) == block+n) {
+				n++;
+			}
+			diskreadmany(d + i*atonce, block, n);
+			for (j=0; j<n*atonce; j++) {
 				swapdir(&d[i*atonce+j]);
 			}
 		}
@@ -826,14 +996,23 @@ dirread(struct sfs_inode *sfi, struct sfs_dir *d, unsigned nd)
 	}
 }
 
+/* returns nonzero if inode modified (the directory is inline) */
 static
-void
-dirwrite(const struct sfs_inode *sfi, struct sfs_dir *d, int nd)
+int
+dirwrite(struct sfs_inode *sfi, struct sfs_dir *d, int nd)
 {
 	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
 	unsigned nblocks = SFS_ROUNDUP(nd, atonce) / atonce;
 	unsigned i, j, bad;
 
+	if (isinline(sfi)) {
+		for (j=0; j<(unsigned)nd; j++) {
+			swapdir(&d[j]);
+		}
+		memcpy(sfi->sfi_inline, d, nd*sizeof(struct sfs_dir));
+		return 1;
+	}
+
 	for (i=0; i<nblocks; i++) {
 		uint32_t block = dobmap(sfi, i);
 		if (block!=0) {
@@ -856,6 +1035,7 @@ dirwrite(const struct sfs_inode *sfi, struct sfs_dir *d, int nd)
 			}
 		}
 	}
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -867,9 +1047,9 @@ dirsortfunc(const void *aa, const void *bb)
 {
 	const int *a = (const int *)aa;
 	const int *b = (const int *)bb;
-	const struct sfs_dir *ad = &global_sortdirs[*a];
-	const struct sfs_dir *bd = &global_sortdirs[*b];
-	return strcmp(ad->sfd_name, bd->sfd_name);
+	uint32_t aino = global_sortdirs[*a].sfd_ino;
+	uint32_t bino = global_sortdirs[*b].sfd_ino;
+	return aino < bino ? -1 : aino > bino;
 }
 
 #ifdef NO_QSORT
@@ -877,22 +1057,23 @@ static
 void
 qsort(int *data, int num, size_t size, int (*f)(const void *, const void *))
 {
-	int i, j;
+	int gap, i, j, tmp;
 	(void)size;
 
-	/* because I'm lazy, bubble sort */
-	for (i=0; i<num-1; i++) {
-		for (j=i+1; j<num; j++) {
-			if (f(&data[i], &data[j]) < 0) {
-				int tmp = data[i];
-				data[i] = data[j];
-				data[j] = tmp;
+	/* shell sort */
+	for (gap=num/2; gap>0; gap/=2) {
+		for (i=gap; i<num; i++) {
+			tmp = data[i];
+			for (j=i; j>=gap && f(&data[j-gap], &tmp) > 0; j-=gap) {
+				data[j] = data[j-gap];
 			}
+			data[j] = tmp;
 		}
 	}
 }
 #endif
 
+/* sorts entry numbers by inode number */
 static
 void
 sortdir(int *vector, struct sfs_dir *d, int nd)
@@ -901,6 +1082,214 @@ sortdir(int *vector, struct sfs_dir *d, int nd)
 	qsort(vector, nd, sizeof(int), dirsortfunc);
 }
 
+/*
+ * Read the inodes named by a directory's entries (other than . and
+ * ..) into INODES, indexed like the entries. They're read in block
+ * order, and runs of consecutive inodes, which is how mksfs and the
+ * kernel usually place a directory's files, are read in one transfer.
+ */
+static
+void
+read_entry_inodes(struct sfs_dir *d, uint32_t nd, struct sfs_inode *inodes)
+{
+	struct sfs_inode *buf;
+	int *vector;
+	uint32_t first, last, ino, i, j, k, n;
+
+	vector = domalloc(nd * sizeof(int));
+	buf = domalloc(BATCH * sizeof(struct sfs_inode));
+
+	for (i=n=0; i<nd; i++) {
+		if (d[i].sfd_ino != SFS_NOINO &&
+		    strcmp(d[i].sfd_name, ".") && strcmp(d[i].sfd_name, "..")) {
+			vector[n++] = i;
+		}
+	}
+	sortdir(vector, d, n);
+
+	for (j=0; j<n; j=k) {
+		first = last = d[vector[j]].sfd_ino;
+		for (k=j+1; k<n; k++) {
+			ino = d[vector[k]].sfd_ino;
+			if (ino > last+1 || ino - first >= BATCH) {
+				break;
+			}
+			last = ino;
+		}
+		diskreadmany(buf, first, last - first + 1);
+		for (i=j; i<k; i++) {
+			ino = d[vector[i]].sfd_ino;
+			memcpy(&inodes[vector[i]], &buf[ino - first],
+			       sizeof(struct sfs_inode));
+			swapinode(&inodes[vector[i]]);
+		}
+	}
+
+	free(buf);
+	free(vector);
+}
+
+static
+uint32_t
+namehash(const char *name)
+{
+	uint32_t h = SFS_NAMEHASH_INIT;
+
+	/* FNV-1a, the same hash hashed directories use */
+	for (; *name; name++) {
+		h = SFS_NAMEHASH(h, *name);
+	}
+	return h;
+}
+
+/*
+ * Find NAME in a hash set of entry numbers with SIZE slots (a power of
+ * two). Returns the slot it's in, or the empty slot it would go in.
+ */
+static
+uint32_t
+nameset_find(const int *set, uint32_t size, const struct sfs_dir *d,
+	     const char *name)
+{
+	uint32_t i;
+
+	i = namehash(name) & (size-1);
+	while (set[i] >= 0 && strcmp(d[set[i]].sfd_name, name)) {
+		i = (i+1) & (size-1);
+	}
+	return i;
+}
+
+/*
+ * Look for entries with the same name, adding each entry to a hash
+ * set of the names seen so far. Returns nonzero if anything changed.
+ */
+static
+int
+check_dir_dups(const char *pathsofar, struct sfs_dir *d, uint32_t nd)
+{
+	char oldname[SFS_NAMELEN];
+	struct sfs_dir *prev;
+	uint32_t size, slot, i;
+	int *set;
+	int dchanged = 0;
+
+	/* keep the set at most half full */
+	for (size=1; size < nd*2; size *= 2);
+	set = domalloc(size * sizeof(int));
+	for (i=0; i<size; i++) {
+		set[i] = -1;
+	}
+
+	for (i=0; i<nd; i++) {
+		if (d[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		slot = nameset_find(set, size, d, d[i].sfd_name);
+		if (set[slot] < 0) {
+			set[slot] = i;
+			continue;
+		}
+
+		prev = &d[set[slot]];
+		if (prev->sfd_ino == d[i].sfd_ino) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory /%s: Duplicate entries for "
+			      "%s (merged)",
+			      pathsofar, d[i].sfd_name);
+			d[i].sfd_ino = SFS_NOINO;
+			d[i].sfd_name[0] = 0;
+		}
+		else {
+			strcpy(oldname, d[i].sfd_name);
+			do {
+				snprintf(d[i].sfd_name, sizeof(d[i].sfd_name),
+					 "FSCK.%lu.%lu",
+					 (unsigned long) d[i].sfd_ino,
+					 (unsigned long) uniquecounter++);
+				slot = nameset_find(set, size, d,
+						    d[i].sfd_name);
+			} while (set[slot] >= 0);
+			set[slot] = i;
+			setbadness(EXIT_RECOV);
+			warnx("Directory /%s: Duplicate names %s "
+			      "(one renamed: %s)",
+			      pathsofar, oldname, d[i].sfd_name);
+		}
+		dchanged = 1;
+	}
+
+	free(set);
+	return dchanged;
+}
+
+/* returns nonzero if bucket B of a hashed directory has no free entry */
+static
+int
+bucket_full(const struct sfs_dir *d, uint32_t b)
+{
+	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	unsigned j;
+
+	for (j=0; j<atonce; j++) {
+		if (d[b*atonce+j].sfd_ino == SFS_NOINO) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Check that every entry of a hashed directory with NB buckets can be
+ * found from its home bucket: every bucket from there to the one it's
+ * in must be full (see <kern/sfs.h>). If not, put the entries back in
+ * order. Returns nonzero if anything changed.
+ */
+static
+int
+check_dir_hash(const char *pathsofar, struct sfs_dir *d, uint32_t nb)
+{
+	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	struct sfs_dir *old;
+	uint32_t b, k, j;
+	int bad = 0;
+
+	for (b=0; b<nb && !bad; b++) {
+		for (j=0; j<atonce && !bad; j++) {
+			if (d[b*atonce+j].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			k = namehash(d[b*atonce+j].sfd_name) % nb;
+			for (; k != b && !bad; k = (k+1) % nb) {
+				bad = !bucket_full(d, k);
+			}
+		}
+	}
+	if (!bad) {
+		return 0;
+	}
+
+	setbadness(EXIT_RECOV);
+	warnx("Directory /%s: Hash table out of order (rebuilt)", pathsofar);
+
+	old = domalloc(nb * SFS_BLOCKSIZE);
+	memcpy(old, d, nb * SFS_BLOCKSIZE);
+	bzero(d, nb * SFS_BLOCKSIZE);
+	for (j=0; j<nb*atonce; j++) {
+		if (old[j].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		k = namehash(old[j].sfd_name) % nb;
+		while (bucket_full(d, k)) {
+			k = (k+1) % nb;
+		}
+		for (b=0; d[k*atonce+b].sfd_ino != SFS_NOINO; b++);
+		d[k*atonce+b] = old[j];
+	}
+	free(old);
+	return 1;
+}
+
 /* tries to add a directory entry; returns 0 on success */
 static
 int
@@ -966,18 +1355,22 @@ check_dir_entry(const char *pathsofar, uint32_t index, struct sfs_dir *sfd)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Check the directory with inode INO, whose contents the caller has
+ * already read into DIRSFI.
+ */
 static
 int
-check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
+check_dir(uint32_t ino, const struct sfs_inode *dirsfi, uint32_t parentino,
+	  const char *pathsofar)
 {
 	struct sfs_inode sfi;
+	struct sfs_inode *subinodes;
 	struct sfs_dir *direntries;
-	int *sortvector;
 	uint32_t dirsize, ndirentries, maxdirentries, subdircount, i;
 	int ichanged=0, dchanged=0, dotseen=0, dotdotseen=0;
 
-	diskread(&sfi, ino);
-	swapinode(&sfi);
+	sfi = *dirsfi;
 
 	if (remember_dir(ino, pathsofar)) {
 		/* crosslinked dir */
@@ -996,16 +1389,33 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		ichanged = 1;
 	}
 
+	if (sfi.sfi_dirbuckets != 0 &&
+	    (sfi.sfi_dirbuckets > SFS_NDIRECT + SFS_DBPERIDB ||
+	     sfi.sfi_size != sfi.sfi_dirbuckets * SFS_BLOCKSIZE)) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory /%s has bad hash table size %lu (made plain)",
+		      pathsofar, (unsigned long) sfi.sfi_dirbuckets);
+		sfi.sfi_dirbuckets = 0;
+		ichanged = 1;
+	}
+
 	if (check_inode_blocks(ino, &sfi, 1)) {
 		ichanged = 1;
 	}
+	if (check_inline(ino, &sfi)) {
+		ichanged = 1;
+	}
 
 	ndirentries = sfi.sfi_size/sizeof(struct sfs_dir);
-	maxdirentries = SFS_ROUNDUP(ndirentries, 
-				    SFS_BLOCKSIZE/sizeof(struct sfs_dir));
+	if (isinline(&sfi)) {
+		maxdirentries = SFS_INLINESIZE/sizeof(struct sfs_dir);
+	}
+	else {
+		maxdirentries = SFS_ROUNDUP(ndirentries,
+					SFS_BLOCKSIZE/sizeof(struct sfs_dir));
+	}
 	dirsize = maxdirentries * sizeof(struct sfs_dir);
 	direntries = domalloc(dirsize);
-	sortvector = domalloc(ndirentries * sizeof(int));
 
 	dirread(&sfi, direntries, ndirentries);
 	for (i=ndirentries; i<maxdirentries; i++) {
@@ -1017,42 +1427,10 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		if (check_dir_entry(pathsofar, i, &direntries[i])) {
 			dchanged = 1;
 		}
-		sortvector[i] = i;
 	}
 
-	sortdir(sortvector, direntries, ndirentries);
-
-	/* don't use ndirentries-1 here in case ndirentries == 0 */
-	for (i=0; i+1<ndirentries; i++) {
-		struct sfs_dir *d1 = &direntries[sortvector[i]];
-		struct sfs_dir *d2 = &direntries[sortvector[i+1]];
-		assert(d1 != d2);
-
-		if (d1->sfd_ino == SFS_NOINO) {
-			continue;
-		}
-
-		if (!strcmp(d1->sfd_name, d2->sfd_name)) {
-			if (d1->sfd_ino == d2->sfd_ino) {
-				setbadness(EXIT_RECOV);
-				warnx("Directory /%s: Duplicate entries for "
-				      "%s (merged)",
-				      pathsofar, d1->sfd_name);
-				d1->sfd_ino = SFS_NOINO;
-				d1->sfd_name[0] = 0;
-			}
-			else {
-				snprintf(d1->sfd_name, sizeof(d1->sfd_name),
-					 "FSCK.%lu.%lu",
-					 (unsigned long) d1->sfd_ino,
-					 (unsigned long) uniquecounter++);
-				setbadness(EXIT_RECOV);
-				warnx("Directory /%s: Duplicate names %s "
-				      "(one renamed: %s)",
-				      pathsofar, d2->sfd_name, d1->sfd_name);
-			}
-			dchanged = 1;
-		}
+	if (check_dir_dups(pathsofar, direntries, ndirentries)) {
+		dchanged = 1;
 	}
 
 	for (i=0; i<ndirentries; i++) {
@@ -1127,6 +1505,12 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		}
 	}
 
+	subinodes = NULL;
+	if (ndirentries > 0) {
+		subinodes = domalloc(ndirentries * sizeof(struct sfs_inode));
+		read_entry_inodes(direntries, ndirentries, subinodes);
+	}
+
 	subdircount=0;
 	for (i=0; i<ndirentries; i++) {
 		if (!strcmp(direntries[i].sfd_name, ".")) {
@@ -1140,25 +1524,17 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		}
 		else {
 			char path[strlen(pathsofar)+SFS_NAMELEN+1];
-			struct sfs_inode subsfi;
 
-			diskread(&subsfi, direntries[i].sfd_ino);
-			swapinode(&subsfi);
 			snprintf(path, sizeof(path), "%s/%s", 
 				 pathsofar, direntries[i].sfd_name);
 
-			switch (subsfi.sfi_type) {
+			switch (subinodes[i].sfi_type) {
 			    case SFS_TYPE_FILE:
-				if (check_inode_blocks(direntries[i].sfd_ino,
-						       &subsfi, 0)) {
-					swapinode(&subsfi);
-					diskwrite(&subsfi, 
-						  direntries[i].sfd_ino);
-				}
 				observe_filelink(direntries[i].sfd_ino);
 				break;
 			    case SFS_TYPE_DIR:
 				if (check_dir(direntries[i].sfd_ino,
+					      &subinodes[i],
 					      ino,
 					      path)) {
 					setbadness(EXIT_RECOV);
@@ -1185,6 +1561,12 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		}
 	}
 
+	/* Entries may have been added, renamed, or removed above */
+	if (sfi.sfi_dirbuckets != 0 &&
+	    check_dir_hash(pathsofar, direntries, sfi.sfi_dirbuckets)) {
+		dchanged = 1;
+	}
+
 	if (sfi.sfi_linkcount != subdircount+2) {
 		setbadness(EXIT_RECOV);
 		warnx("Directory /%s: Link count %lu should be %lu (fixed)",
@@ -1194,8 +1576,8 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		ichanged = 1;
 	}
 
-	if (dchanged) {
-		dirwrite(&sfi, direntries, ndirentries);
+	if (dchanged && dirwrite(&sfi, direntries, ndirentries)) {
+		ichanged = 1;
 	}
 
 	if (ichanged) {
@@ -1204,7 +1586,7 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	}
 
 	free(direntries);
-	free(sortvector);
+	free(subinodes);
 
 	return 0;
 }
@@ -1232,10 +1614,202 @@ check_root_dir(void)
 		sfi.sfi_type = SFS_TYPE_DIR;
 		swapinode(&sfi);
 		diskwrite(&sfi, SFS_ROOT_LOCATION);
+		swapinode(&sfi);
 		break;
 	}
 
-	check_dir(SFS_ROOT_LOCATION, SFS_ROOT_LOCATION, "");
+	check_dir(SFS_ROOT_LOCATION, &sfi, SFS_ROOT_LOCATION, "");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Pass 1b: check the blocks and link count of every file the
+ * directory walk found. The inodes are read in disk order, in windows
+ * of up to BATCH blocks, and the host is asked to start fetching the
+ * next window while this one is checked. On the host, several threads
+ * take windows in turn.
+ */
+
+static uint32_t nextscan;	/* first block of the next window */
+
+/*
+ * Hand out the next window that has files in it. Returns 0 when
+ * there are none left.
+ */
+static
+int
+getwindow(uint32_t *startp, uint32_t *countp)
+{
+	uint32_t start, end, last, b;
+
+	LOCK();
+	while (nextscan < nblocks && !isfile(nextscan)) {
+		nextscan++;
+	}
+	if (nextscan >= nblocks) {
+		UNLOCK();
+		return 0;
+	}
+	start = last = nextscan;
+	end = nblocks - start > BATCH ? start + BATCH : nblocks;
+	for (b=start; b<end; b++) {
+		if (isfile(b)) {
+			last = b;
+		}
+	}
+	nextscan = end;
+	UNLOCK();
+
+	*startp = start;
+	*countp = last - start + 1;
+	return 1;
+}
+
+static
+void
+check_file(uint32_t ino, struct sfs_inode *sfi)
+{
+	int ichanged;
+
+	swapinode(sfi);
+	assert(sfi->sfi_type == SFS_TYPE_FILE);
+
+	ichanged = check_inode_blocks(ino, sfi, 0);
+	if (check_inline(ino, sfi)) {
+		ichanged = 1;
+	}
+
+	if (sfi->sfi_dirbuckets != 0) {
+		warnx("File %lu has a directory hash table size (fixed)",
+		      (unsigned long) ino);
+		sfi->sfi_dirbuckets = 0;
+		setbadness(EXIT_RECOV);
+		ichanged = 1;
+	}
+
+	if (sfi->sfi_linkcount != inodeuse[ino]) {
+		warnx("File %lu link count %lu should be %lu (fixed)",
+		      (unsigned long) ino,
+		      (unsigned long) sfi->sfi_linkcount,
+		      (unsigned long) inodeuse[ino]);
+		sfi->sfi_linkcount = inodeuse[ino];
+		setbadness(EXIT_RECOV);
+		ichanged = 1;
+	}
+
+	if (ichanged) {
+		swapinode(sfi);
+		diskwrite(sfi, ino);
+	}
+}
+
+static
+void
+check_files_worker(void)
+{
+	struct sfs_inode *buf;
+	uint32_t start, count, next, i;
+	unsigned long nfiles = 0;
+
+	buf = domalloc(BATCH * sizeof(struct sfs_inode));
+	while (getwindow(&start, &count)) {
+		next = start + count;
+		if (next < nblocks) {
+			diskprefetch(next, nblocks - next > BATCH ?
+				     BATCH : nblocks - next);
+		}
+		diskreadmany(buf, start, count);
+		for (i=0; i<count; i++) {
+			if (isfile(start + i)) {
+				check_file(start + i, &buf[i]);
+				nfiles++;
+			}
+		}
+	}
+	free(buf);
+
+	LOCK();
+	count_files += nfiles;
+	UNLOCK();
+}
+
+#ifdef USE_THREADS
+
+#define MAXTHREADS 16
+
+static
+void *
+check_files_thread(void *arg)
+{
+	(void)arg;
+	check_files_worker();
+	return NULL;
+}
+
+/*
+ * One thread per online cpu, counting this one. If some can't be
+ * started the others do the work.
+ */
+static
+void
+check_files(void)
+{
+	pthread_t threads[MAXTHREADS];
+	long nthreads, i;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+	if (nthreads > MAXTHREADS) {
+		nthreads = MAXTHREADS;
+	}
+	for (i=1; i<nthreads; i++) {
+		if (pthread_create(&threads[i], NULL,
+				   check_files_thread, NULL)) {
+			nthreads = i;
+			break;
+		}
+	}
+	check_files_worker();
+	for (i=1; i<nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+#else
+
+static
+void
+check_files(void)
+{
+	check_files_worker();
+}
+
+#endif
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Current time in milliseconds, for the speed report.
+ */
+static
+uint64_t
+getmsecs(void)
+{
+#ifdef HOST
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
+#else
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (uint64_t)secs*1000 + nsecs/1000000;
+#endif
 }
 
 ////////////////////////////////////////////////////////////
@@ -1243,6 +1817,8 @@ check_root_dir(void)
 int
 main(int argc, char **argv)
 {
+	uint64_t start, msecs;
+
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
@@ -1255,17 +1831,25 @@ main(int argc, char **argv)
 	assert(sizeof(struct sfs_inode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
 
+	start = getmsecs();
 	opendisk(argv[1]);
 
 	check_sb();
 	check_root_dir();
+	check_files();
 	check_bitmap();
-	adjust_filelinks();
 
 	closedisk();
+	msecs = getmsecs() - start;
+	if (msecs == 0) {
+		msecs = 1;
+	}
 
 	warnx("%lu blocks used (of %lu); %lu directories; %lu files",
 	      count_blocks, (unsigned long) nblocks, count_dirs, count_files);
+	warnx("Checked in %lu.%03lu seconds (%lu blocks/sec)",
+	      (unsigned long) (msecs / 1000), (unsigned long) (msecs % 1000),
+	      (unsigned long) (count_blocks * 1000 / msecs));
 
 	switch (badness) {
 	    case EXIT_USAGE:
@@ -0,0 +1,350 @@
+/*
+ * tracedecode - print a kernel trace dump as a timeline.
+ *
+ * Usage: tracedecode dumpfile
+ *
+ * Reads a file written by the kernel menu's "trace dump" command and
+ * prints every event, all cpus merged in time order. Times are in
+ * microseconds since the first event. System calls and disk transfers
+ * also show how long they took.
+ *
+ * Each cpu's cycle counter starts when that cpu does, so times on
+ * different cpus are only roughly comparable.
+ *
+ * Runs on the host as well as on OS/161.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "kern/trace.h"
+
+#ifdef HOST
+
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for ntohl
+#include "hostcompat.h"
+#define SWAPL(x) ntohl(x)
+#define SWAPS(x) ntohs(x)
+
+#else
+
+#define SWAPL(x) (x)
+#define SWAPS(x) (x)
+
+#endif
+
+/* sys161 supports at most 32 cpus */
+#define MAXRUNS 32
+
+/* enough for the threads and disks seen in one trace */
+#define MAXPENDING 256
+
+/* one cpu's events: records[start] through records[end - 1] */
+struct run {
+	unsigned start;
+	unsigned end;
+};
+
+/* the start of an operation (syscall or disk transfer) not yet finished */
+struct pending {
+	uint32_t key;
+	uint64_t when;
+};
+
+static struct trace_record *records;
+static unsigned nrecords;
+static uint32_t cyclerate;
+
+static struct run runs[MAXRUNS];
+static unsigned nruns;
+
+static struct pending pending[MAXPENDING];
+static unsigned npending;
+
+static
+void
+readall(int fd, void *buf, size_t len, const char *file)
+{
+	ssize_t r;
+
+	r = read(fd, buf, len);
+	if (r < 0) {
+		err(1, "%s", file);
+	}
+	if ((size_t)r != len) {
+		errx(1, "%s: Short file", file);
+	}
+}
+
+/*
+ * Read the dump and convert it to host byte order.
+ */
+static
+void
+load(const char *file)
+{
+	struct trace_header th;
+	struct trace_record *tr;
+	unsigned i;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	readall(fd, &th, sizeof(th), file);
+	if (SWAPL(th.th_magic) != TRACE_MAGIC) {
+		errx(1, "%s: Not a trace dump", file);
+	}
+	cyclerate = SWAPL(th.th_cyclerate);
+	nrecords = SWAPL(th.th_nrecords);
+	if (cyclerate == 0) {
+		errx(1, "%s: Bad header", file);
+	}
+
+	records = malloc(nrecords * sizeof(struct trace_record) + 1);
+	if (records == NULL) {
+		errx(1, "Out of memory");
+	}
+	readall(fd, records, nrecords * sizeof(struct trace_record), file);
+	close(fd);
+
+	for (i = 0; i < nrecords; i++) {
+		tr = &records[i];
+		tr->tr_cyclehi = SWAPL(tr->tr_cyclehi);
+		tr->tr_cyclelo = SWAPL(tr->tr_cyclelo);
+		tr->tr_thread = SWAPL(tr->tr_thread);
+		tr->tr_type = SWAPS(tr->tr_type);
+		tr->tr_cpu = SWAPS(tr->tr_cpu);
+		tr->tr_arg1 = SWAPL(tr->tr_arg1);
+		tr->tr_arg2 = SWAPL(tr->tr_arg2);
+
+		/* the kernel writes each cpu's events together */
+		if (i == 0 || tr->tr_cpu != records[i - 1].tr_cpu) {
+			if (nruns == MAXRUNS) {
+				errx(1, "%s: Too many cpus", file);
+			}
+			runs[nruns].start = i;
+			runs[nruns].end = i;
+			nruns++;
+		}
+		runs[nruns - 1].end = i + 1;
+	}
+}
+
+static
+uint64_t
+cycles(const struct trace_record *tr)
+{
+	return ((uint64_t)tr->tr_cyclehi << 32) | tr->tr_cyclelo;
+}
+
+/*
+ * Take the next event in time order: the earliest of the cpus' next
+ * events. There are only a few cpus, so just look at all of them.
+ */
+static
+struct trace_record *
+nextrecord(void)
+{
+	struct trace_record *best = NULL;
+	unsigned i, besti = 0;
+
+	for (i = 0; i < nruns; i++) {
+		if (runs[i].start == runs[i].end) {
+			continue;
+		}
+		if (best == NULL || cycles(&records[runs[i].start]) < cycles(best)) {
+			best = &records[runs[i].start];
+			besti = i;
+		}
+	}
+	if (best != NULL) {
+		runs[besti].start++;
+	}
+	return best;
+}
+
+/*
+ * Remember when an operation started, keyed on the thread (for
+ * syscalls) or the disk (for transfers).
+ */
+static
+void
+pending_start(uint32_t key, uint64_t when)
+{
+	unsigned i;
+
+	for (i = 0; i < npending; i++) {
+		if (pending[i].key == key) {
+			pending[i].when = when;
+			return;
+		}
+	}
+	if (npending < MAXPENDING) {
+		pending[npending].key = key;
+		pending[npending].when = when;
+		npending++;
+	}
+}
+
+/*
+ * Find and forget when an operation started. Returns 0 if its start
+ * isn't in the trace.
+ */
+static
+int
+pending_end(uint32_t key, uint64_t *when)
+{
+	unsigned i;
+
+	for (i = 0; i < npending; i++) {
+		if (pending[i].key == key) {
+			*when = pending[i].when;
+			pending[i] = pending[--npending];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static
+unsigned long
+usecs(uint64_t ncycles)
+{
+	return (unsigned long)(ncycles * 1000000 / cyclerate);
+}
+
+static
+void
+printelapsed(uint32_t key, uint64_t now)
+{
+	uint64_t then;
+
+	if (pending_end(key, &then)) {
+		printf(" (%lu us)", usecs(now - then));
+	}
+}
+
+static
+const char *
+statename(uint32_t state)
+{
+	/* threadstate_t from <thread.h> */
+	switch (state) {
+	    case 0: return "run";
+	    case 1: return "ready";
+	    case 2: return "sleep";
+	    case 3: return "zombie";
+	}
+	return "?";
+}
+
+static
+const char *
+faultname(uint32_t type)
+{
+	/* VM_FAULT_* from <vm.h> */
+	switch (type) {
+	    case 0: return "read";
+	    case 1: return "write";
+	    case 2: return "readonly";
+	}
+	return "?";
+}
+
+static
+void
+printrecord(const struct trace_record *tr, uint64_t base)
+{
+	uint64_t now = cycles(tr);
+	/* disks get keys no thread address can have */
+	uint32_t diskkey = 0xffffff00 | tr->tr_arg2;
+
+	printf("%10lu cpu%-2u %08x ", usecs(now - base), tr->tr_cpu,
+	       tr->tr_thread);
+
+	switch (tr->tr_type) {
+	    case TRACE_SWITCH:
+		printf("switch to %08x (%s)", tr->tr_arg1,
+		       statename(tr->tr_arg2));
+		break;
+	    case TRACE_SLEEP:
+		printf("sleep on %08x", tr->tr_arg1);
+		break;
+	    case TRACE_WAKE:
+		printf("wake %08x on %08x", tr->tr_arg2, tr->tr_arg1);
+		break;
+	    case TRACE_VMFAULT:
+		printf("vm_fault %s 0x%x", faultname(tr->tr_arg2),
+		       tr->tr_arg1);
+		break;
+	    case TRACE_SYSCALL:
+		printf("syscall %u", tr->tr_arg1);
+		pending_start(tr->tr_thread, now);
+		break;
+	    case TRACE_SYSRET:
+		printf("syscall %u returns", tr->tr_arg1);
+		if (tr->tr_arg2 != 0) {
+			printf(" error %u", tr->tr_arg2);
+		}
+		printelapsed(tr->tr_thread, now);
+		break;
+	    case TRACE_DISKREAD:
+	    case TRACE_DISKWRITE:
+		printf("lhd%u %s sector %u", tr->tr_arg2,
+		       tr->tr_type == TRACE_DISKREAD ? "read" : "write",
+		       tr->tr_arg1);
+		pending_start(diskkey, now);
+		break;
+	    case TRACE_DISKDONE:
+		printf("lhd%u done", tr->tr_arg2);
+		if (tr->tr_arg1 != 0) {
+			printf(" error %u", tr->tr_arg1);
+		}
+		printelapsed(diskkey, now);
+		break;
+	    default:
+		printf("unknown event %u (%08x %08x)", tr->tr_type,
+		       tr->tr_arg1, tr->tr_arg2);
+		break;
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct trace_record *tr;
+	uint64_t base = 0;
+	int first = 1;
+
+#ifdef HOST
+	hostcompat_init(argc, argv);
+#endif
+
+	if (argc != 2) {
+		errx(1, "Usage: tracedecode dumpfile");
+	}
+
+	load(argv[1]);
+	printf("%u events, %lu cycles/sec\n", nrecords,
+	       (unsigned long)cyclerate);
+
+	while ((tr = nextrecord()) != NULL) {
+		if (first) {
+			base = cycles(tr);
+			first = 0;
+		}
+		printrecord(tr, base);
+	}
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * appendbench - measure writing a file in small appends.
+ *
+ * Builds a file out of many small writes, closes it, and prints the
+ * rate; then reads it back and checks it. On SFS the writes are held
+ * in memory and go to disk in a few large transfers when the file is
+ * closed, so this should be much faster than one disk write per call.
+ *
+ * Usage: appendbench [chunksize [totalsize]]
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define FILENAME      "appendbench.dat"
+#define DEFAULT_CHUNK 100
+#define DEFAULT_TOTAL 65536	/* SFS files can't be much bigger */
+#define MAXCHUNK      4096
+
+static char buf[MAXCHUNK];
+
+static
+unsigned long
+msecs_since(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs, msecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		nsecs += 1000000000;
+		secs--;
+	}
+	msecs = (secs - startsecs) * 1000 + (nsecs - startnsecs) / 1000000;
+	return msecs == 0 ? 1 : msecs;
+}
+
+/* The byte at offset POS in the file */
+static
+char
+pattern(unsigned pos)
+{
+	return 'a' + (pos / 7) % 26;
+}
+
+int
+main(int argc, char *argv[])
+{
+	time_t startsecs;
+	unsigned long startnsecs, msecs;
+	unsigned chunk, total, pos, len, i;
+	int fd, r;
+
+	chunk = DEFAULT_CHUNK;
+	total = DEFAULT_TOTAL;
+	if (argc > 1) {
+		chunk = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		total = atoi(argv[2]);
+	}
+	if (chunk == 0 || chunk > MAXCHUNK || total == 0) {
+		errx(1, "Usage: appendbench [chunksize [totalsize]]");
+	}
+
+	__time(&startsecs, &startnsecs);
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (pos=0; pos<total; pos+=len) {
+		len = total - pos < chunk ? total - pos : chunk;
+		for (i=0; i<len; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		r = write(fd, buf, len);
+		if (r < 0) {
+			err(1, "%s: write", FILENAME);
+		}
+		if ((unsigned)r != len) {
+			errx(1, "%s: short write (%d of %u)", FILENAME, r, len);
+		}
+	}
+	if (close(fd) < 0) {
+		err(1, "%s: close", FILENAME);
+	}
+	msecs = msecs_since(startsecs, startnsecs);
+	printf("Wrote %u bytes in %u-byte writes in %lu.%03lu seconds, "
+	       "%lu KB per second\n", total, chunk, msecs / 1000,
+	       msecs % 1000, total * 1000UL / msecs / 1024);
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (pos=0; pos<total; pos+=r) {
+		r = read(fd, buf, sizeof(buf));
+		if (r < 0) {
+			err(1, "%s: read", FILENAME);
+		}
+		if (r == 0) {
+			errx(1, "%s: file is only %u bytes", FILENAME, pos);
+		}
+		for (i=0; i<(unsigned)r; i++) {
+			if (buf[i] != pattern(pos + i)) {
+				errx(1, "%s: wrong data at offset %u",
+				     FILENAME, pos + i);
+			}
+		}
+	}
+	close(fd);
+	if (remove(FILENAME) < 0) {
+		err(1, "%s: remove", FILENAME);
+	}
+	printf("Contents verified\n");
+	return 0;
+}
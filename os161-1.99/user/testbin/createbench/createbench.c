@@ -0,0 +1,97 @@
+/*
+ * createbench - measure small-file metadata operations.
+ *
+ * Creates a number of small files (each written and closed), then
+ * removes them all, and prints how many of each operation were done
+ * per second. Closing a file syncs it, so on a journaled SFS volume
+ * each close is a journal commit.
+ *
+ * Usage: createbench [nfiles]
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define DEFAULT_FILES 100
+#define FILESIZE      100
+
+static char buf[FILESIZE];
+
+static
+unsigned long
+msecs_since(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs, msecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		nsecs += 1000000000;
+		secs--;
+	}
+	msecs = (secs - startsecs) * 1000 + (nsecs - startnsecs) / 1000000;
+	return msecs == 0 ? 1 : msecs;
+}
+
+static
+void
+report(const char *what, unsigned n, unsigned long msecs)
+{
+	printf("%s %u files in %lu.%03lu seconds, %lu per second\n",
+	       what, n, msecs / 1000, msecs % 1000, n * 1000UL / msecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	time_t startsecs;
+	unsigned long startnsecs;
+	unsigned n, i;
+	char name[32];
+	int fd, r;
+
+	n = DEFAULT_FILES;
+	if (argc > 1) {
+		n = atoi(argv[1]);
+	}
+	if (n == 0) {
+		errx(1, "Usage: createbench [nfiles]");
+	}
+	memset(buf, 'x', sizeof(buf));
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<n; i++) {
+		snprintf(name, sizeof(name), "cb-%u", i);
+		fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		r = write(fd, buf, sizeof(buf));
+		if (r < 0) {
+			err(1, "%s: write", name);
+		}
+		if (r != sizeof(buf)) {
+			errx(1, "%s: short write (%d of %u)", name, r,
+			     (unsigned) sizeof(buf));
+		}
+		if (close(fd) < 0) {
+			err(1, "%s: close", name);
+		}
+	}
+	report("Created", n, msecs_since(startsecs, startnsecs));
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<n; i++) {
+		snprintf(name, sizeof(name), "cb-%u", i);
+		if (remove(name) < 0) {
+			err(1, "%s: remove", name);
+		}
+	}
+	report("Removed", n, msecs_since(startsecs, startnsecs));
+
+	return 0;
+}
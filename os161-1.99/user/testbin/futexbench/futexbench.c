@@ -0,0 +1,150 @@
+/*
+ * futexbench - compare futex-based and spin-only locks.
+ *
+ * Several threads (from threadfork) each increment a shared counter
+ * under a lock, first with the libc umutex, then with a plain
+ * test-and-set spinlock. For each, prints how long it took and the
+ * resulting lock/unlock throughput.
+ *
+ * Usage: futexbench [nthreads [iterations]]
+ *
+ * With more threads than CPUs, the spinlock wastes whole timeslices
+ * spinning on a holder that isn't running; the umutex puts the
+ * waiters to sleep instead.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <synch.h>
+
+#define DEFAULT_THREADS   4
+#define DEFAULT_ITERS     20000
+
+static int nthreads = DEFAULT_THREADS;
+static int niters = DEFAULT_ITERS;
+
+/* the lock under test */
+static int usespin;
+static struct umutex mutex = UMUTEX_INITIALIZER;
+static volatile int spinlock;
+
+/* the shared data it protects */
+static volatile int counter;
+
+/* completion tracking */
+static struct umutex donelock = UMUTEX_INITIALIZER;
+static struct ucv donecv = UCV_INITIALIZER;
+static int ndone;
+
+static
+void
+spin_lock(void)
+{
+	while (atomic_swap(&spinlock, 1) != 0) {
+		/* spin */
+	}
+}
+
+static
+void
+spin_unlock(void)
+{
+	atomic_swap(&spinlock, 0);
+}
+
+static
+void
+worker(void)
+{
+	int i;
+
+	for (i=0; i<niters; i++) {
+		if (usespin) {
+			spin_lock();
+			counter++;
+			spin_unlock();
+		}
+		else {
+			umutex_lock(&mutex);
+			counter++;
+			umutex_unlock(&mutex);
+		}
+	}
+
+	umutex_lock(&donelock);
+	ndone++;
+	ucv_signal(&donecv);
+	umutex_unlock(&donelock);
+}
+
+static
+void
+runbench(const char *name, int spin)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, msecs;
+	int i, total;
+
+	usespin = spin;
+	counter = 0;
+	ndone = 0;
+
+	__time(&startsecs, &startnsecs);
+
+	for (i=0; i<nthreads; i++) {
+		if (threadfork(worker) < 0) {
+			err(1, "threadfork");
+		}
+	}
+
+	umutex_lock(&donelock);
+	while (ndone < nthreads) {
+		ucv_wait(&donecv, &donelock);
+	}
+	umutex_unlock(&donelock);
+
+	__time(&endsecs, &endnsecs);
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	endnsecs -= startnsecs;
+	endsecs -= startsecs;
+
+	total = nthreads * niters;
+	if (counter != total) {
+		errx(1, "%s: counter is %d, should be %d", name, counter,
+		     total);
+	}
+
+	msecs = endsecs * 1000 + endnsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("%s: %d lock/unlock pairs in %lu.%09lu seconds "
+	       "(%lu per second)\n", name, total,
+	       (unsigned long) endsecs, endnsecs,
+	       (unsigned long) total * 1000 / msecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc > 1) {
+		nthreads = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		niters = atoi(argv[2]);
+	}
+	if (nthreads < 1 || niters < 1) {
+		errx(1, "Usage: futexbench [nthreads [iterations]]");
+	}
+
+	printf("futexbench: %d threads, %d iterations each\n",
+	       nthreads, niters);
+	runbench("umutex", 0);
+	runbench("spinlock", 1);
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * mmaptest - test file mappings.
+ *
+ * First scans a file through a read-only shared mapping and prints a
+ * checksum and how long it took. Then checks that writes to a private
+ * mapping don't show up in a shared one, and that writes to a shared
+ * mapping of a scratch file are seen by a second mapping and are
+ * still there after both are unmapped and the file is mapped again.
+ *
+ * Usage: mmaptest [file [kilobytes]]
+ *
+ * The file defaults to this program. Only the first KILOBYTES of it
+ * (default 64) are scanned; any part of that beyond the end of the
+ * file reads as zeros.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#define DEFAULT_KB   64
+#define SCRATCH      "mmaptest.tmp"
+#define SCRATCHSIZE  4096
+
+static
+void *
+mapfile(int fd, size_t len, int prot, int flags)
+{
+	void *p;
+
+	p = mmap(NULL, len, prot, flags, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+static
+void
+scan(const char *file, size_t len)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, msecs;
+	const unsigned char *p;
+	unsigned sum = 0;
+	size_t i;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	p = mapfile(fd, len, PROT_READ, MAP_SHARED);
+	close(fd);
+
+	__time(&startsecs, &startnsecs);
+	for (i = 0; i < len; i++) {
+		sum = sum * 31 + p[i];
+	}
+	__time(&endsecs, &endnsecs);
+
+	if (munmap((void *)p, len) < 0) {
+		err(1, "munmap");
+	}
+
+	msecs = (endsecs - startsecs) * 1000;
+	msecs = msecs + endnsecs / 1000000 - startnsecs / 1000000;
+	printf("scanned %lu KB of %s in %lu ms, checksum %08x\n",
+	       (unsigned long)len / 1024, file, msecs, sum);
+}
+
+static
+void
+private_test(const char *file)
+{
+	char *shared, *priv;
+	char saved;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	shared = mapfile(fd, SCRATCHSIZE, PROT_READ, MAP_SHARED);
+	priv = mapfile(fd, SCRATCHSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+	close(fd);
+
+	if (priv[0] != shared[0]) {
+		errx(1, "private mapping doesn't match the file");
+	}
+	saved = shared[0];
+	priv[0] = ~saved;
+	if (shared[0] != saved) {
+		errx(1, "write to private mapping changed shared mapping");
+	}
+
+	munmap(priv, SCRATCHSIZE);
+	munmap(shared, SCRATCHSIZE);
+	printf("private mapping: passed\n");
+}
+
+static
+void
+shared_test(void)
+{
+	static char buf[SCRATCHSIZE];
+	char *a, *b;
+	int fd;
+
+	/* files have no seek pointer yet, so fill it with a single write */
+	memset(buf, 'x', sizeof(buf));
+	fd = open(SCRATCH, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SCRATCH);
+	}
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+		err(1, "%s: write", SCRATCH);
+	}
+
+	a = mapfile(fd, SCRATCHSIZE, PROT_READ|PROT_WRITE, MAP_SHARED);
+	b = mapfile(fd, SCRATCHSIZE, PROT_READ, MAP_SHARED);
+	if (a == b) {
+		errx(1, "two mappings at the same address");
+	}
+	a[100] = 'y';
+	if (b[100] != 'y') {
+		errx(1, "write not seen through second shared mapping");
+	}
+	if (msync(a, SCRATCHSIZE, 0) < 0) {
+		err(1, "msync");
+	}
+	munmap(a, SCRATCHSIZE);
+	munmap(b, SCRATCHSIZE);
+
+	a = mapfile(fd, SCRATCHSIZE, PROT_READ, MAP_SHARED);
+	close(fd);
+	if (a[100] != 'y' || a[99] != 'x') {
+		errx(1, "write to shared mapping didn't reach the file");
+	}
+	munmap(a, SCRATCHSIZE);
+	printf("shared mapping: passed\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *file = argv[0];
+	unsigned kb = DEFAULT_KB;
+
+	if (argc > 1) {
+		file = argv[1];
+	}
+	if (argc > 2) {
+		kb = atoi(argv[2]);
+	}
+	if (kb == 0) {
+		errx(1, "Usage: mmaptest [file [kilobytes]]");
+	}
+
+	scan(file, kb * 1024);
+	private_test(file);
+	shared_test();
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * pipebench - measure pipe throughput.
+ *
+ * For each of several write sizes, forks a child that writes a fixed
+ * amount of data into a pipe in chunks of that size, while the parent
+ * reads it back out in large chunks. Prints the transfer rate for each
+ * size.
+ *
+ * Usage: pipebench [kilobytes]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#define DEFAULT_KB   1024
+#define READSIZE     16384
+#define MAXWRITE     16384
+
+static const unsigned writesizes[] = { 64, 512, 4096, 16384 };
+#define NSIZES (sizeof(writesizes) / sizeof(writesizes[0]))
+
+static char wbuf[MAXWRITE];
+static char rbuf[READSIZE];
+
+static
+void
+writer(int fd, unsigned total, unsigned size)
+{
+	unsigned done, len;
+	int r;
+
+	for (done = 0; done < total; done += len) {
+		len = total - done < size ? total - done : size;
+		r = write(fd, wbuf, len);
+		if (r < 0) {
+			err(1, "write");
+		}
+		if ((unsigned)r != len) {
+			errx(1, "short write (%d of %u)", r, len);
+		}
+	}
+}
+
+static
+void
+runbench(unsigned total, unsigned size)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, msecs;
+	unsigned got;
+	int fds[2];
+	int pid, status, r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	__time(&startsecs, &startnsecs);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* child */
+		close(fds[0]);
+		writer(fds[1], total, size);
+		close(fds[1]);
+		_exit(0);
+	}
+
+	/* parent */
+	close(fds[1]);
+	got = 0;
+	while ((r = read(fds[0], rbuf, READSIZE)) > 0) {
+		got += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	close(fds[0]);
+
+	__time(&endsecs, &endnsecs);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "writer failed");
+	}
+	if (got != total) {
+		errx(1, "read %u bytes, expected %u", got, total);
+	}
+
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	endnsecs -= startnsecs;
+	endsecs -= startsecs;
+	msecs = endsecs * 1000 + endnsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	printf("%5u-byte writes: %u KB in %lu.%03lu seconds, %lu KB/s\n",
+	       size, total / 1024, (unsigned long) endsecs, endnsecs / 1000000,
+	       (unsigned long) (total / 1024) * 1000 / msecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned total, i;
+
+	total = DEFAULT_KB;
+	if (argc > 1) {
+		total = atoi(argv[1]);
+	}
+	if (total == 0) {
+		errx(1, "Usage: pipebench [kilobytes]");
+	}
+	total *= 1024;
+
+	memset(wbuf, 'x', sizeof(wbuf));
+
+	for (i=0; i<NSIZES; i++) {
+		runbench(total, writesizes[i]);
+	}
+	return 0;
+}
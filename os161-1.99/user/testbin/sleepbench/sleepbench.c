@@ -0,0 +1,92 @@
+/*
+ * sleepbench - measure how accurately nanosleep sleeps.
+ *
+ * For each of a range of intervals, from well under a scheduler tick
+ * to several ticks, sleeps that long a number of times and prints the
+ * shortest, mean, and longest time actually slept, in microseconds.
+ * No sleep should come up short; how far over they go is the cost of
+ * the timer interrupt and of getting the thread running again.
+ *
+ * Usage: sleepbench [repetitions]
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define DEFAULT_REPS  20
+
+static const uint32_t intervals[] = {
+	50000, 200000, 1000000, 5000000, 20000000, 100000000,
+};
+#define NINTERVALS (sizeof(intervals) / sizeof(intervals[0]))
+
+static
+uint64_t
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec ts;
+	uint64_t start, took, min, max, total;
+	unsigned i;
+	int j, nreps = DEFAULT_REPS, shortsleeps = 0;
+
+	if (argc > 1) {
+		nreps = atoi(argv[1]);
+	}
+	if (nreps < 1) {
+		errx(1, "Usage: sleepbench [repetitions]");
+	}
+
+	printf("   requested        min       mean        max  (us)\n");
+	for (i = 0; i < NINTERVALS; i++) {
+		ts.tv_sec = intervals[i] / 1000000000;
+		ts.tv_nsec = intervals[i] % 1000000000;
+		min = (uint64_t)-1;
+		max = total = 0;
+
+		for (j = 0; j < nreps; j++) {
+			start = now();
+			if (nanosleep(&ts, NULL) < 0) {
+				err(1, "nanosleep");
+			}
+			took = now() - start;
+
+			if (took < intervals[i]) {
+				shortsleeps++;
+			}
+			if (took < min) {
+				min = took;
+			}
+			if (took > max) {
+				max = took;
+			}
+			total += took;
+		}
+
+		printf("%12lu %10lu %10lu %10lu\n",
+		       (unsigned long)(intervals[i] / 1000),
+		       (unsigned long)(min / 1000),
+		       (unsigned long)(total / nreps / 1000),
+		       (unsigned long)(max / 1000));
+	}
+
+	if (shortsleeps > 0) {
+		printf("FAILED: %d sleeps were shorter than requested\n",
+		       shortsleeps);
+		return 1;
+	}
+	return 0;
+}
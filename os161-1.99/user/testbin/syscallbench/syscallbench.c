@@ -0,0 +1,83 @@
+/*
+ * syscallbench - measure the cost of a null system call.
+ *
+ * Calls getpid() many times and prints the average time per call as
+ * seen from userlevel, in nanoseconds and in cycles. Then uses
+ * __syscallstats to print what the kernel measured for the same
+ * calls: the mean cycles spent inside syscall() and the latency
+ * histogram. The difference between the two is the cost of the trap
+ * itself and the trip back to userlevel.
+ *
+ * Usage: syscallbench [iterations]
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <kern/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define DEFAULT_ITERS  100000
+
+int
+main(int argc, char *argv[])
+{
+	struct syscallstat before, after;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	uint64_t nsecs, cycles;
+	uint32_t count, rate;
+	int i, niters = DEFAULT_ITERS;
+	int result;
+	unsigned b;
+
+	if (argc > 1) {
+		niters = atoi(argv[1]);
+	}
+	if (niters < 1) {
+		errx(1, "Usage: syscallbench [iterations]");
+	}
+
+	result = __syscallstats(SYS_getpid, &before);
+	if (result < 0) {
+		err(1, "__syscallstats");
+	}
+	rate = result;
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<niters; i++) {
+		getpid();
+	}
+	__time(&endsecs, &endnsecs);
+
+	if (__syscallstats(SYS_getpid, &after) < 0) {
+		err(1, "__syscallstats");
+	}
+
+	nsecs = (uint64_t)(endsecs - startsecs) * 1000000000
+		+ endnsecs - startnsecs;
+	cycles = nsecs * (rate / 1000) / 1000000;
+	printf("syscallbench: %d getpid calls in %lu us\n", niters,
+	       (unsigned long)(nsecs / 1000));
+	printf("userlevel: %lu ns, %lu cycles per call\n",
+	       (unsigned long)(nsecs / niters),
+	       (unsigned long)(cycles / niters));
+
+	/* other processes' getpid calls are counted too, if any ran */
+	count = after.ss_count - before.ss_count;
+	if (count == 0) {
+		printf("kernel: no calls counted\n");
+		return 0;
+	}
+	printf("kernel: %lu cycles per call in syscall()\n",
+	       (unsigned long)((after.ss_cycles - before.ss_cycles) / count));
+	for (b=0; b<SYSSTAT_NBUCKETS; b++) {
+		if (after.ss_buckets[b] != before.ss_buckets[b]) {
+			printf("  %8lu+ cycles: %u\n", 1UL << b,
+			       after.ss_buckets[b] - before.ss_buckets[b]);
+		}
+	}
+	return 0;
+}